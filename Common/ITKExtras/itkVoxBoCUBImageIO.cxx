@@ -39,14 +39,20 @@
 #include "itkExceptionObject.h"
 #include "itkMetaDataObject.h"
 #include "itkByteSwapper.h"
+#include "itkMultiThreader.h"
+#include <algorithm>
 #include <iostream>
 #include <list>
+#include <sstream>
 #include <string>
+#include <vector>
+#include <cstring>
 #include <math.h>
 
-// Commented out because zlib is not available through Insight Applications
+// Compressed files need the zlib from ITK, see SNAP_GZIP_SUPPORT in the 
+// CMake configuration
 #ifdef SNAP_GZIP_SUPPORT
-#include <zlib.h>
+#include "itk_zlib.h"
 #endif
 
 using itk::ITK_CoordinateOrientation;
@@ -66,6 +72,11 @@ public:
   virtual void ReadData(void *data, unsigned long bytes) = 0;
   virtual void WriteData(const void *data, unsigned long bytes) = 0;
 
+  // Position of the next byte in the file, or -1 if it is not known, as is
+  // the case for compressed files
+  virtual long Tell() 
+    { return -1; }
+
   std::string ReadHeader()
     {
     // Read everything up to the \f symbol
@@ -179,6 +190,434 @@ private:
   ::gzFile m_GzFile;
 };
 
+/**
+ * Compressed VoxBo files are written as a series of gzip members, each 
+ * holding an independently compressed block of the data. Concatenated 
+ * members form a valid gzip file, so the files can be read by zlib and 
+ * gunzip. Each member carries its compressed size in an extra header field
+ * (subfield 'S','C'), which lets the reader locate the members without
+ * decompressing them, so that they can be compressed and decompressed by 
+ * several threads at once.
+ */
+class BlockedGzipCodec
+{
+public:
+  // Size of the uncompressed blocks
+  enum { BLOCK_SIZE = 0x100000 };
+
+  // Size of the member header (with the extra field) and trailer
+  enum { HEADER_SIZE = 20, TRAILER_SIZE = 8 };
+
+  typedef std::vector<unsigned char> ByteArray;
+
+  // A compressed block, and the uncompressed data it corresponds to
+  struct Job
+    {
+    const unsigned char *Input;
+    size_t InputSize;
+    unsigned char *Output;
+    size_t OutputSize;
+    ByteArray Member;
+    };
+
+  /** Compress a list of blocks into members, in parallel */
+  static void Compress(std::vector<Job> &jobs)
+    { Run(jobs, true); }
+
+  /** Decompress a list of members into their buffers, in parallel */
+  static void Decompress(std::vector<Job> &jobs)
+    { Run(jobs, false); }
+
+  /** Check whether the data starts with the header of a member */
+  static bool IsMemberHeader(const unsigned char *p)
+    {
+    return p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 && p[3] == 4 && 
+      GetInt(p + 10, 2) == 8 && p[12] == 'S' && p[13] == 'C' && 
+      GetInt(p + 14, 2) == 4;
+    }
+
+  /**
+   * Parse a member written by this codec. Returns false if the data does 
+   * not start with such a member. Otherwise returns the size of the member
+   * and of its uncompressed data.
+   */
+  static bool ParseMember(const unsigned char *p, size_t avail, 
+                          size_t &size, size_t &usize)
+    {
+    if(avail < HEADER_SIZE + TRAILER_SIZE || !IsMemberHeader(p))
+      return false;
+
+    size = GetInt(p + 16, 4);
+    if(size < HEADER_SIZE + TRAILER_SIZE || size > avail)
+      return false;
+
+    usize = GetInt(p + size - 4, 4);
+    return true;
+    }
+
+private:
+  static size_t GetInt(const unsigned char *p, unsigned int n)
+    {
+    size_t x = 0;
+    for(unsigned int i = 0; i < n; i++)
+      x |= ((size_t) p[i]) << (8 * i);
+    return x;
+    }
+
+  static void PutInt(unsigned char *p, size_t x, unsigned int n)
+    {
+    for(unsigned int i = 0; i < n; i++, x >>= 8)
+      p[i] = (unsigned char) (x & 0xff);
+    }
+
+  // Compress one block into a member. Returns false on error
+  static bool CompressJob(Job &job)
+    {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, 
+        Z_DEFAULT_STRATEGY) != Z_OK)
+      return false;
+
+    size_t bound = deflateBound(&zs, (uLong) job.InputSize);
+    job.Member.resize(HEADER_SIZE + bound + TRAILER_SIZE);
+    zs.next_in = const_cast<Bytef *>(job.Input);
+    zs.avail_in = (uInt) job.InputSize;
+    zs.next_out = &job.Member[HEADER_SIZE];
+    zs.avail_out = (uInt) bound;
+    int rc = deflate(&zs, Z_FINISH);
+    size_t csize = zs.total_out;
+    deflateEnd(&zs);
+    if(rc != Z_STREAM_END)
+      return false;
+
+    // Fill in the header: no file name, extra field with the member size
+    size_t size = HEADER_SIZE + csize + TRAILER_SIZE;
+    unsigned char *p = &job.Member[0];
+    memset(p, 0, HEADER_SIZE);
+    p[0] = 0x1f; p[1] = 0x8b; p[2] = 8; p[3] = 4; p[9] = 255;
+    PutInt(p + 10, 8, 2);
+    p[12] = 'S'; p[13] = 'C';
+    PutInt(p + 14, 4, 2);
+    PutInt(p + 16, size, 4);
+
+    // Fill in the trailer: CRC and size of the uncompressed data
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, job.Input, (uInt) job.InputSize);
+    PutInt(p + HEADER_SIZE + csize, crc, 4);
+    PutInt(p + HEADER_SIZE + csize + 4, job.InputSize, 4);
+    job.Member.resize(size);
+    return true;
+    }
+
+  // Decompress one member and check its CRC. Returns false on error
+  static bool DecompressJob(Job &job)
+    {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(inflateInit2(&zs, -15) != Z_OK)
+      return false;
+
+    zs.next_in = const_cast<Bytef *>(job.Input + HEADER_SIZE);
+    zs.avail_in = (uInt) (job.InputSize - HEADER_SIZE - TRAILER_SIZE);
+    zs.next_out = job.Output;
+    zs.avail_out = (uInt) job.OutputSize;
+    int rc = inflate(&zs, Z_FINISH);
+    bool ok = (rc == Z_STREAM_END && zs.total_out == job.OutputSize);
+    inflateEnd(&zs);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, job.Output, (uInt) job.OutputSize);
+    return ok && crc == GetInt(job.Input + job.InputSize - TRAILER_SIZE, 4);
+    }
+
+  // Data shared by the threads
+  struct ThreadData
+    {
+    std::vector<Job> *Jobs;
+    bool Compress;
+    std::vector<char> Failed;
+    };
+
+  static ITK_THREAD_RETURN_TYPE ThreadCallback(void *arg)
+    {
+    MultiThreader::ThreadInfoStruct *info = 
+      static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+    ThreadData *td = static_cast<ThreadData *>(info->UserData);
+
+    // Jobs are dealt out to the threads in turn
+    std::vector<Job> &jobs = *td->Jobs;
+    for(size_t i = info->ThreadID; i < jobs.size(); i += info->NumberOfThreads)
+      {
+      bool ok = td->Compress ? CompressJob(jobs[i]) : DecompressJob(jobs[i]);
+      if(!ok)
+        td->Failed[info->ThreadID] = 1;
+      }
+
+    return ITK_THREAD_RETURN_VALUE;
+    }
+
+  static void Run(std::vector<Job> &jobs, bool compress)
+    {
+    if(jobs.size() == 0)
+      return;
+
+    MultiThreader::Pointer mt = MultiThreader::New();
+    int nThreads = std::min(mt->GetNumberOfThreads(), (int) jobs.size());
+    mt->SetNumberOfThreads(nThreads);
+
+    ThreadData td;
+    td.Jobs = &jobs;
+    td.Compress = compress;
+    td.Failed.resize(nThreads, 0);
+    mt->SetSingleMethod(ThreadCallback, &td);
+    mt->SingleMethodExecute();
+
+    for(int t = 0; t < nThreads; t++)
+      {
+      if(td.Failed[t])
+        {
+        ExceptionObject exception;
+        exception.SetDescription(compress 
+          ? "Error compressing data" : "Compressed data is corrupted");
+        throw exception;
+        }
+      }
+    }
+};
+
+/**
+ * A reader and writer for gzip files made up of members written by the
+ * BlockedGzipCodec. The members are compressed and decompressed in parallel
+ */
+class BlockedCUBFileAdaptor : public GenericCUBFileAdaptor
+{
+public:
+  typedef BlockedGzipCodec::ByteArray ByteArray;
+  typedef BlockedGzipCodec::Job Job;
+
+  BlockedCUBFileAdaptor(const char *file, const char *mode)
+    {
+    m_File = fopen(file, mode);
+    if(m_File == NULL)
+      {
+      ExceptionObject exception;
+      exception.SetDescription("File cannot be accessed");
+      throw exception;
+      }
+
+    m_Position = 0;
+    m_UncompressedSize = 0;
+    m_CachedMember = (size_t) -1;
+    m_Loaded = false;
+    }
+
+  ~BlockedCUBFileAdaptor()
+    {
+    if(m_File)
+      fclose(m_File);
+    }
+
+  /** Check whether a file consists of members written by the codec */
+  static bool IsBlockedFile(const char *file)
+    {
+    FILE *f = fopen(file, "rb");
+    if(f == NULL)
+      return false;
+    unsigned char head[BlockedGzipCodec::HEADER_SIZE];
+    size_t n = fread(head, 1, sizeof(head), f);
+    fclose(f);
+
+    return n == sizeof(head) && BlockedGzipCodec::IsMemberHeader(head);
+    }
+
+  unsigned char ReadByte()
+    {
+    unsigned char byte;
+    ReadData(&byte, 1);
+    return byte;
+    }
+
+  void ReadData(void *data, unsigned long bytes)
+    {
+    // The file is only loaded when data is first needed
+    if(!m_Loaded)
+      LoadMembers();
+
+    unsigned char *out = static_cast<unsigned char *>(data);
+    size_t start = m_Position, end = m_Position + bytes;
+    if(end > m_UncompressedSize)
+      {
+      std::ostringstream oss;
+      oss << "File size does not match header: " 
+        << bytes << " bytes requested but only "
+        << m_UncompressedSize - m_Position << " bytes available!";
+      ExceptionObject exception;
+      exception.SetDescription(oss.str().c_str());
+      throw exception;
+      }
+
+    // Small reads (e.g., of the header) go through a cached member
+    if(bytes < BlockedGzipCodec::BLOCK_SIZE)
+      {
+      while(m_Position < end)
+        {
+        size_t i = FindMember(m_Position);
+        CacheMember(i);
+        size_t first = m_Position - m_MemberStart[i];
+        size_t n = std::min(end, m_MemberStart[i + 1]) - m_Position;
+        memcpy(out, &m_Cache[first], n);
+        out += n;
+        m_Position += n;
+        }
+      return;
+      }
+
+    // Members that lie entirely in the requested range are decompressed 
+    // straight into the output. The members at the ends are decompressed
+    // into temporary buffers and copied
+    size_t iFirst = FindMember(start), iLast = FindMember(end - 1);
+    std::vector<Job> jobs(iLast - iFirst + 1);
+    std::vector<ByteArray> partial(jobs.size());
+    for(size_t i = iFirst; i <= iLast; i++)
+      {
+      Job &job = jobs[i - iFirst];
+      job.Input = &m_Data[m_MemberOffset[i]];
+      job.InputSize = m_MemberOffset[i + 1] - m_MemberOffset[i];
+      job.OutputSize = m_MemberStart[i + 1] - m_MemberStart[i];
+      if(m_MemberStart[i] >= start && m_MemberStart[i + 1] <= end)
+        {
+        job.Output = out + (m_MemberStart[i] - start);
+        }
+      else
+        {
+        partial[i - iFirst].resize(job.OutputSize);
+        job.Output = &partial[i - iFirst][0];
+        }
+      }
+
+    BlockedGzipCodec::Decompress(jobs);
+
+    for(size_t i = iFirst; i <= iLast; i++)
+      {
+      if(partial[i - iFirst].size())
+        {
+        size_t lo = std::max(start, m_MemberStart[i]);
+        size_t hi = std::min(end, m_MemberStart[i + 1]);
+        memcpy(out + (lo - start), 
+          &partial[i - iFirst][lo - m_MemberStart[i]], hi - lo);
+        }
+      }
+    m_Position = end;
+    }
+
+  void WriteData(const void *data, unsigned long bytes)
+    {
+    // Compress a batch of blocks at a time, to limit the memory taken up by
+    // the compressed data
+    const unsigned char *in = static_cast<const unsigned char *>(data);
+    size_t nBatch = 4 * MultiThreader::GetGlobalDefaultNumberOfThreads();
+    size_t nBlocks = 
+      (bytes + BlockedGzipCodec::BLOCK_SIZE - 1) / BlockedGzipCodec::BLOCK_SIZE;
+    for(size_t iBatch = 0; iBatch < nBlocks; iBatch += nBatch)
+      {
+      std::vector<Job> jobs(std::min(nBatch, nBlocks - iBatch));
+      for(size_t j = 0; j < jobs.size(); j++)
+        {
+        size_t offset = (iBatch + j) * BlockedGzipCodec::BLOCK_SIZE;
+        jobs[j].Input = in + offset;
+        jobs[j].InputSize = std::min(
+          (size_t) BlockedGzipCodec::BLOCK_SIZE, (size_t) bytes - offset);
+        }
+
+      BlockedGzipCodec::Compress(jobs);
+
+      for(size_t j = 0; j < jobs.size(); j++)
+        {
+        size_t n = jobs[j].Member.size();
+        if(fwrite(&jobs[j].Member[0], 1, n, m_File) != n)
+          {
+          ExceptionObject exception;
+          exception.SetDescription("Could not write all bytes to file");
+          throw exception;
+          }
+        }
+      }
+    }
+
+private:
+  FILE *m_File;
+
+  // The compressed file, and the position of every member in the file and
+  // in the uncompressed data. Both arrays have an extra element at the end
+  ByteArray m_Data;
+  std::vector<size_t> m_MemberOffset, m_MemberStart;
+  size_t m_UncompressedSize, m_Position;
+  bool m_Loaded;
+
+  // The last member decompressed for small reads
+  ByteArray m_Cache;
+  size_t m_CachedMember;
+
+  // Read the compressed file and locate the members
+  void LoadMembers()
+    {
+    fseek(m_File, 0, SEEK_END);
+    long size = ftell(m_File);
+    fseek(m_File, 0, SEEK_SET);
+    m_Data.resize(size > 0 ? size : 0);
+    if(size <= 0 || fread(&m_Data[0], 1, size, m_File) != (size_t) size)
+      {
+      ExceptionObject exception;
+      exception.SetDescription("File cannot be read");
+      throw exception;
+      }
+
+    size_t offset = 0, start = 0;
+    while(offset < m_Data.size())
+      {
+      size_t msize, usize;
+      if(!BlockedGzipCodec::ParseMember(
+          &m_Data[offset], m_Data.size() - offset, msize, usize))
+        {
+        ExceptionObject exception;
+        exception.SetDescription("Compressed data is corrupted");
+        throw exception;
+        }
+      m_MemberOffset.push_back(offset);
+      m_MemberStart.push_back(start);
+      offset += msize;
+      start += usize;
+      }
+    m_MemberOffset.push_back(offset);
+    m_MemberStart.push_back(start);
+    m_UncompressedSize = start;
+    m_Loaded = true;
+    }
+
+  // Find the member that holds a position in the uncompressed data
+  size_t FindMember(size_t pos) const
+    {
+    return (std::upper_bound(m_MemberStart.begin(), m_MemberStart.end(), pos)
+      - m_MemberStart.begin()) - 1;
+    }
+
+  void CacheMember(size_t i)
+    {
+    if(m_CachedMember == i)
+      return;
+
+    std::vector<Job> jobs(1);
+    m_Cache.resize(m_MemberStart[i + 1] - m_MemberStart[i]);
+    jobs[0].Input = &m_Data[m_MemberOffset[i]];
+    jobs[0].InputSize = m_MemberOffset[i + 1] - m_MemberOffset[i];
+    jobs[0].Output = m_Cache.size() ? &m_Cache[0] : NULL;
+    jobs[0].OutputSize = m_Cache.size();
+    BlockedGzipCodec::Decompress(jobs);
+    m_CachedMember = i;
+    }
+};
+
 #endif // SNAP_GZIP_SUPPORT
 
 /**
@@ -258,6 +697,11 @@ public:
       throw exception;
       }
     }
+  long Tell()
+    {
+    return ftell(m_File);
+    }
+
 private:
   FILE *m_File;
 };
@@ -311,6 +755,7 @@ VoxBoCUBImageIO::VoxBoCUBImageIO()
   m_ByteOrder = BigEndian;
   m_Reader = NULL;
   m_Writer = NULL;
+  m_DataOffset = -1;
 }
 
 
@@ -332,7 +777,12 @@ VoxBoCUBImageIO::CreateReader(const char *filename)
     if(CheckExtension(filename, compressed))
       if(compressed)
 #ifdef SNAP_GZIP_SUPPORT
-          return new CompressedCUBFileAdaptor(filename, "rb");
+        {
+        // Files written by SNAP are decompressed in parallel
+        if(BlockedCUBFileAdaptor::IsBlockedFile(filename))
+          return new BlockedCUBFileAdaptor(filename, "rb");
+        return new CompressedCUBFileAdaptor(filename, "rb");
+        }
 #else
           return NULL;
 #endif
@@ -356,7 +806,7 @@ VoxBoCUBImageIO::CreateWriter(const char *filename)
     if(CheckExtension(filename, compressed))
       if(compressed)
 #ifdef SNAP_GZIP_SUPPORT
-          return new CompressedCUBFileAdaptor(filename, "rb");
+          return new BlockedCUBFileAdaptor(filename, "wb");
 #else
           return NULL;
 #endif        
@@ -454,6 +904,9 @@ void VoxBoCUBImageIO::ReadImageInformation()
   // Read the file header
   std::istringstream issHeader(m_Reader->ReadHeader());
 
+  // The data follows the header
+  m_DataOffset = m_Reader->Tell();
+
   // Read every string in the header. Parse the strings that are special
   while(issHeader.good())
     {
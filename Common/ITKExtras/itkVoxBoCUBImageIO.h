@@ -99,6 +99,14 @@ public:
   virtual void Write(const void* buffer);
 
 
+  /** 
+   * Get the offset of the image data in the file, known after the image 
+   * information has been read. This is -1 for compressed files, whose data
+   * can not be accessed directly.
+   */
+  long GetDataOffset() const
+    { return m_DataOffset; }
+
   VoxBoCUBImageIO();
   ~VoxBoCUBImageIO();
   void PrintSelf(std::ostream& os, Indent indent) const;
@@ -111,6 +119,7 @@ private:
   GenericCUBFileAdaptor *CreateReader(const char *filename);
   GenericCUBFileAdaptor *CreateWriter(const char *filename);
   GenericCUBFileAdaptor *m_Reader, *m_Writer;
+  long m_DataOffset;
 
   // Initialize the orientation map (from strings to ITK)
   void InitializeOrientationMap();
@@ -0,0 +1,187 @@
+/*=========================================================================
+
+  Program:   ITK-SNAP
+  Module:    LabelRegionCalculator.cxx
+  Language:  C++
+  Copyright (c) 2007 Paul A. Yushkevich
+  
+  This file is part of ITK-SNAP 
+
+  ITK-SNAP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information. 
+
+=========================================================================*/
+#include "LabelRegionCalculator.h"
+#include "itkOrientedImage.h"
+#include <algorithm>
+
+LabelRegionCalculator
+::LabelRegionCalculator()
+: m_Count(MAX_COLOR_LABELS, 0), m_Extents(6 * MAX_COLOR_LABELS, 0),
+  m_Signature(MAX_COLOR_LABELS, 0)
+{
+}
+
+// Hash of a run of voxels, given by the offset of its first voxel and its
+// length. This is the finalizer of the SplitMix64 generator
+inline unsigned long long
+LabelRegionCalculatorRunHash(unsigned long long offset, unsigned long long len)
+{
+  unsigned long long z = offset * 0x9E3779B97F4A7C15ull + len;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+ITK_THREAD_RETURN_TYPE
+LabelRegionCalculator
+::ThreadCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info = 
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  ThreadData *td = static_cast<ThreadData *>(info->UserData);
+  ThreadResult &result = (*td->Results)[info->ThreadID];
+
+  // The lines of the image handled by this thread
+  RegionType region = td->Image->GetBufferedRegion();
+  size_t nx = region.GetSize(0), ny = region.GetSize(1);
+  size_t nLines = ny * region.GetSize(2);
+  size_t iStart = (nLines * info->ThreadID) / info->NumberOfThreads;
+  size_t iEnd = (nLines * (info->ThreadID + 1)) / info->NumberOfThreads;
+
+  // The counts are allocated here, so that the memory is touched by the
+  // thread that uses it. The extents are initialized when a label is seen
+  result.Count.assign(MAX_COLOR_LABELS, 0);
+  result.Signature.assign(MAX_COLOR_LABELS, 0);
+  result.Extents.resize(6 * MAX_COLOR_LABELS);
+
+  const LabelType *buffer = td->Image->GetBufferPointer();
+  for(size_t iLine = iStart; iLine < iEnd; iLine++)
+    {
+    const LabelType *line = buffer + iLine * nx;
+    long y = region.GetIndex(1) + (long)(iLine % ny);
+    long z = region.GetIndex(2) + (long)(iLine / ny);
+
+    // Walk the line as a sequence of runs of the same label
+    for(size_t x0 = 0; x0 < nx; )
+      {
+      LabelType label = line[x0];
+      size_t x1 = x0 + 1;
+      while(x1 < nx && line[x1] == label)
+        x1++;
+
+      if(label < MAX_COLOR_LABELS)
+        {
+        long *ext = &result.Extents[6 * label];
+        long xFirst = region.GetIndex(0) + (long) x0;
+        long xLast = region.GetIndex(0) + (long) x1 - 1;
+        if(result.Count[label] == 0)
+          {
+          result.Labels.push_back(label);
+          ext[0] = xFirst; ext[1] = y; ext[2] = z;
+          ext[3] = xLast;  ext[4] = y; ext[5] = z;
+          }
+        else
+          {
+          // Lines are visited in order, so z never decreases
+          ext[0] = std::min(ext[0], xFirst);
+          ext[1] = std::min(ext[1], y);
+          ext[3] = std::max(ext[3], xLast);
+          ext[4] = std::max(ext[4], y);
+          ext[5] = z;
+          }
+        result.Count[label] += x1 - x0;
+        result.Signature[label] += 
+          LabelRegionCalculatorRunHash(iLine * nx + x0, x1 - x0);
+        }
+      x0 = x1;
+      }
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+void
+LabelRegionCalculator
+::Compute(const ImageType *image)
+{
+  // Don't start threads for small images
+  size_t nVoxels = image->GetBufferedRegion().GetNumberOfPixels();
+  unsigned int nThreads = std::max(1u, std::min(
+    (unsigned int) itk::MultiThreader::GetGlobalDefaultNumberOfThreads(),
+    (unsigned int) (nVoxels / 0x40000)));
+
+  std::vector<ThreadResult> results(nThreads);
+  ThreadData td;
+  td.Image = image;
+  td.Results = &results;
+
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads(nThreads);
+  threader->SetSingleMethod(&LabelRegionCalculator::ThreadCallback, &td);
+  threader->SingleMethodExecute();
+
+  // Merge the results of the threads, visiting only the labels they saw
+  std::fill(m_Count.begin(), m_Count.end(), 0);
+  std::fill(m_Signature.begin(), m_Signature.end(), 0);
+  for(unsigned int t = 0; t < nThreads; t++)
+    {
+    const ThreadResult &result = results[t];
+    for(size_t i = 0; i < result.Labels.size(); i++)
+      {
+      LabelType label = result.Labels[i];
+      const long *src = &result.Extents[6 * label];
+      long *trg = &m_Extents[6 * label];
+      if(m_Count[label] == 0)
+        {
+        std::copy(src, src + 6, trg);
+        }
+      else
+        {
+        for(unsigned int d = 0; d < 3; d++)
+          {
+          trg[d] = std::min(trg[d], src[d]);
+          trg[d+3] = std::max(trg[d+3], src[d+3]);
+          }
+        }
+      m_Count[label] += result.Count[label];
+      m_Signature[label] += result.Signature[label];
+      }
+    }
+}
+
+LabelRegionCalculator::RegionType
+LabelRegionCalculator
+::GetBoundingBox(LabelType label) const
+{
+  RegionType region;
+  if(m_Count[label] > 0)
+    {
+    const long *ext = &m_Extents[6 * label];
+    for(unsigned int d = 0; d < 3; d++)
+      {
+      region.SetIndex(d, ext[d]);
+      region.SetSize(d, ext[d+3] + 1 - ext[d]);
+      }
+    }
+  return region;
+}
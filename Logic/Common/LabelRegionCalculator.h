@@ -0,0 +1,110 @@
+/*=========================================================================
+
+  Program:   ITK-SNAP
+  Module:    LabelRegionCalculator.h
+  Language:  C++
+  Copyright (c) 2007 Paul A. Yushkevich
+  
+  This file is part of ITK-SNAP 
+
+  ITK-SNAP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information. 
+
+=========================================================================*/
+#ifndef __LabelRegionCalculator_h_
+#define __LabelRegionCalculator_h_
+
+#include "SNAPCommon.h"
+#include "itkImageRegion.h"
+#include "itkMultiThreader.h"
+#include <vector>
+
+namespace itk {
+  template <class TPixel,unsigned int VDimension> class OrientedImage;
+}
+
+/**
+ * \class LabelRegionCalculator
+ * \brief Computes the number of voxels and the bounding box of every label
+ * in a segmentation image.
+ *
+ * The image is scanned in a single multithreaded pass. Each thread handles
+ * a range of image lines, walking each line as a sequence of runs of the 
+ * same label, and keeps its own counts and boxes. These are merged once 
+ * all the threads are done.
+ *
+ * For each label, a 64-bit signature of the set of voxels that have the 
+ * label is also computed, as a sum of hashes of the runs. It does not 
+ * depend on the number of threads, and can be compared between passes to 
+ * tell whether the voxels of a label have changed.
+ */
+class LabelRegionCalculator
+{
+public:
+  typedef itk::OrientedImage<LabelType,3> ImageType;
+  typedef itk::ImageRegion<3> RegionType;
+
+  LabelRegionCalculator();
+
+  /** Scan the buffered region of the image */
+  void Compute(const ImageType *image);
+
+  /** Get the number of voxels that have the label */
+  unsigned long GetCount(LabelType label) const
+    { return m_Count[label]; }
+
+  /** 
+   * Get the bounding box of the voxels that have the label. The region is 
+   * empty if the label is not present in the image
+   */
+  RegionType GetBoundingBox(LabelType label) const;
+
+  /** Get the signature of the voxels that have the label */
+  unsigned long long GetSignature(LabelType label) const
+    { return m_Signature[label]; }
+
+private:
+  // Number of voxels, and box extents (min xyz and max xyz) for each label
+  std::vector<unsigned long> m_Count;
+  std::vector<long> m_Extents;
+  std::vector<unsigned long long> m_Signature;
+
+  // Partial results computed by a single thread
+  struct ThreadResult
+    {
+    std::vector<unsigned long> Count;
+    std::vector<long> Extents;
+    std::vector<unsigned long long> Signature;
+    std::vector<LabelType> Labels;
+    };
+
+  // Data shared by the threads
+  struct ThreadData
+    {
+    const ImageType *Image;
+    std::vector<ThreadResult> *Results;
+    };
+
+  static ITK_THREAD_RETURN_TYPE ThreadCallback(void *arg);
+};
+
+#endif
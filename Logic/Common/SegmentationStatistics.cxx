@@ -34,32 +34,153 @@
 =========================================================================*/
 #include "SegmentationStatistics.h"
 #include "GenericImageData.h"
+#include <algorithm>
+#include <cmath>
 
 using namespace std;
 
-struct SegmentationStatisticsSource {
-  string name;
-  GreyImageWrapper *image;
-  GreyImageWrapper::ConstIterator it; 
-  GreyTypeToNativeFunctor funk;
-};
+SegmentationStatistics
+::SegmentationStatistics()
+{
+  m_LinesPerBlock = 0;
+  m_SegmentationTime = 0;
+}
+
+void
+SegmentationStatistics
+::Reset()
+{
+  m_Blocks.clear();
+  m_BlockSource.clear();
+  m_SegmentationTime = 0;
+}
+
+// Hash of a run of voxels with the same label, used for block signatures. 
+// This is the finalizer of the SplitMix64 generator
+inline unsigned long long
+SegmentationStatisticsRunHash(LabelType label, size_t offset, size_t length)
+{
+  unsigned long long z = 
+    (offset * 0x9E3779B97F4A7C15ull + length) ^ ((unsigned long long) label << 48);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+ITK_THREAD_RETURN_TYPE
+SegmentationStatistics
+::ThreadCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info = 
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  ThreadData *td = static_cast<ThreadData *>(info->UserData);
+  td->Self->ThreadedUpdateBlocks(*td, info->ThreadID, info->NumberOfThreads);
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+void
+SegmentationStatistics
+::ThreadedUpdateBlocks(
+  const ThreadData &td, unsigned int thread, unsigned int nThreads)
+{
+  size_t nBlocks = m_Blocks.size(), ngray = td.Gray.size();
+  size_t bStart = (nBlocks * thread) / nThreads;
+  size_t bEnd = (nBlocks * (thread + 1)) / nThreads;
+
+  // Position of each label in the list of the current block, or -1
+  vector<int> slot(0x10000, -1);
+
+  for(size_t b = bStart; b < bEnd; b++)
+    {
+    Block &block = m_Blocks[b];
+    size_t first = b * m_LinesPerBlock * td.LineLength;
+    size_t last = 
+      std::min((b + 1) * m_LinesPerBlock, td.NumberOfLines) * td.LineLength;
+    size_t n = last - first;
+    const LabelType *lab = td.Labels + first;
+
+    // Compute the signature of the labels in the block. If it has not 
+    // changed, neither have the statistics
+    unsigned long long sig = 0;
+    for(size_t i = 0; i < n; )
+      {
+      LabelType label = lab[i];
+      size_t j = i + 1;
+      while(j < n && lab[j] == label) 
+        j++;
+      sig += SegmentationStatisticsRunHash(label, i, j - i);
+      i = j;
+      }
+
+    if(block.Labels.size() && block.Signature == sig)
+      continue;
+
+    // Accumulate the counts and gray sums of the labels run by run
+    block.Signature = sig;
+    block.Labels.clear();
+    block.Counts.clear();
+    block.Sums.clear();
+    for(size_t i = 0; i < n; )
+      {
+      LabelType label = lab[i];
+      size_t j = i + 1;
+      while(j < n && lab[j] == label) 
+        j++;
+
+      int &k = slot[label];
+      if(k < 0)
+        {
+        k = (int) block.Labels.size();
+        block.Labels.push_back(label);
+        block.Counts.push_back(0);
+        block.Sums.resize(block.Sums.size() + 2 * ngray, 0);
+        }
+      block.Counts[k] += j - i;
+
+      long long *sums = ngray ? &block.Sums[2 * ngray * k] : NULL;
+      for(size_t g = 0; g < ngray; g++)
+        {
+        const GreyType *gray = td.Gray[g] + first;
+        long long sum = 0, sumsq = 0;
+        for(size_t q = i; q < j; q++)
+          {
+          long long v = gray[q];
+          sum += v;
+          sumsq += v * v;
+          }
+        sums[2 * g] += sum;
+        sums[2 * g + 1] += sumsq;
+        }
+
+      i = j;
+      }
+
+    for(size_t k = 0; k < block.Labels.size(); k++)
+      slot[block.Labels[k]] = -1;
+    }
+}
 
 void
 SegmentationStatistics
 ::Compute(GenericImageData *id)
 {
-  // A list of image sources
-  vector<SegmentationStatisticsSource> isrc;
+  // The segmentation image
+  LabelImageWrapper::ImageType *seg = id->GetSegmentation()->GetImage();
+  size_t nx = seg->GetBufferedRegion().GetSize(0);
+  size_t nLines = 
+    seg->GetBufferedRegion().GetSize(1) * seg->GetBufferedRegion().GetSize(2);
+  size_t nVoxels = nx * nLines;
+
+  // A list of gray image sources, with their names. Only images that have
+  // a voxel for every voxel of the segmentation can be used
+  vector<string> names;
+  vector<GreyImageWrapper *> sources;
 
   // Populate image sources
   if(id->IsGreyLoaded())
     {
-    SegmentationStatisticsSource src;
-    src.name = "image";
-    src.image = id->GetGrey();
-    src.it = src.image->GetImageConstIterator();
-    src.funk = src.image->GetNativeMapping();
-    isrc.push_back(src);
+    names.push_back("image");
+    sources.push_back(id->GetGrey());
     }
 
   // Add all grey overlays
@@ -71,18 +192,69 @@ SegmentationStatistics
     GreyImageWrapper *wrapper = dynamic_cast<GreyImageWrapper *>(*it);
     if (wrapper)
       {
-      SegmentationStatisticsSource src;
       ostringstream oss; oss << "ovl " << k;
-      src.name = oss.str();
-      src.image = wrapper;
-      src.it = src.image->GetImageConstIterator();
-      src.funk = src.image->GetNativeMapping();
-      isrc.push_back(src);
+      names.push_back(oss.str());
+      sources.push_back(wrapper);
+      }
+    }
+
+  vector<const GreyType *> gray;
+  for(size_t j = 0; j < sources.size(); j++)
+    {
+    GreyImageWrapper::ImageType *img = sources[j]->GetImage();
+    if(img->GetBufferedRegion().GetNumberOfPixels() == nVoxels)
+      {
+      gray.push_back(img->GetBufferPointer());
+      }
+    else 
+      {
+      names.erase(names.begin() + j);
+      sources.erase(sources.begin() + j);
+      j--;
       }
     }
 
   // Get the number of gray image layers
-  size_t ngray = isrc.size();
+  size_t ngray = sources.size();
+
+  // Start over if the images are not the ones the blocks were computed for
+  vector<size_t> source;
+  source.push_back((size_t) seg);
+  source.push_back(nx);
+  source.push_back(nLines);
+  for(size_t j = 0; j < ngray; j++)
+    {
+    source.push_back((size_t) gray[j]);
+    source.push_back((size_t) sources[j]->GetImage()->GetMTime());
+    }
+  if(source != m_BlockSource)
+    {
+    m_BlockSource = source;
+    m_LinesPerBlock = std::max((size_t) 1, 0x10000 / std::max(nx, (size_t) 1));
+    m_Blocks.clear();
+    m_Blocks.resize((nLines + m_LinesPerBlock - 1) / m_LinesPerBlock);
+    m_SegmentationTime = 0;
+    }
+
+  // Update the blocks, unless the segmentation has not been touched
+  if(seg->GetMTime() != m_SegmentationTime && m_Blocks.size())
+    {
+    ThreadData td;
+    td.Self = this;
+    td.Labels = seg->GetBufferPointer();
+    td.Gray = gray;
+    td.LineLength = nx;
+    td.NumberOfLines = nLines;
+
+    unsigned int nThreads = (unsigned int) std::min(m_Blocks.size(),
+      (size_t) itk::MultiThreader::GetGlobalDefaultNumberOfThreads());
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    threader->SetNumberOfThreads(nThreads);
+    threader->SetSingleMethod(&SegmentationStatistics::ThreadCallback, &td);
+    threader->SingleMethodExecute();
+
+    m_SegmentationTime = seg->GetMTime();
+    }
 
   // Clear and initialize the statistics table
   for(size_t i = 0; i < MAX_COLOR_LABELS; i++)
@@ -91,30 +263,42 @@ SegmentationStatistics
     for(size_t j = 0; j < ngray; j++)
       {
       GrayStats gs;
-      gs.layer_id = isrc[j].name;
+      gs.layer_id = names[j];
       m_Stats[i].gray.push_back(gs);
       }
     }
 
-  // Compute the statistics by iterating over each voxel
-  for(LabelImageWrapper::ConstIterator itLabel = 
-    id->GetSegmentation()->GetImageConstIterator();
-    !itLabel.IsAtEnd(); ++itLabel)
+  // Merge the blocks in order. The mean and the sum of squared deviations 
+  // from the mean are combined pairwise (Chan et al.), which is stable even
+  // when the sums of squares are much larger than the variance. The gray
+  // fields hold the mean and the sum of squared deviations until the end
+  for(size_t b = 0; b < m_Blocks.size(); b++)
     {
-    // Get the label and the corresponding entry
-    LabelType label = itLabel.Value();
-    Entry &entry = m_Stats[label];
+    const Block &block = m_Blocks[b];
+    for(size_t i = 0; i < block.Labels.size(); i++)
+      {
+      if(block.Labels[i] >= MAX_COLOR_LABELS)
+        continue;
 
-    // Increment number of voxels for this label
-    entry.count++;
+      Entry &entry = m_Stats[block.Labels[i]];
+      long long nb = block.Counts[i];
+      double na = (double) entry.count, nab = na + nb;
+      const long long *sums = ngray ? &block.Sums[2 * ngray * i] : NULL;
+      for(size_t j = 0; j < ngray; j++)
+        {
+        long long s = sums[2 * j], ss = sums[2 * j + 1];
+        double mb = (double) s / nb;
 
-    // Update the gray statistics
-    for(size_t j = 0; j < ngray; j++)
-      {
-      double v = isrc[j].funk( isrc[j].it.Value() );
-      ++isrc[j].it;
-      entry.gray[j].sum += v;
-      entry.gray[j].sumsq += v * v;
+        // The integer form is exact as long as the products fit in 64 bits
+        double m2b = (nb <= 0x10000) 
+          ? (double) (nb * ss - s * s) / nb : ss - s * mb;
+
+        GrayStats &gs = entry.gray[j];
+        double delta = mb - gs.mean;
+        gs.mean += delta * nb / nab;
+        gs.sumsq += m2b + delta * delta * na * nb / nab;
+        }
+      entry.count += (unsigned long) nb;
       }
     }
   
@@ -123,16 +307,20 @@ SegmentationStatistics
     id->GetMain()->GetImageBase()->GetSpacing().GetDataPointer();
   double volVoxel = spacing[0] * spacing[1] * spacing[2];
   
-  // Compute the mean and standard deviation
+  // Map the mean and standard deviation to native intensity units
   for (size_t i=0; i < MAX_COLOR_LABELS; i++)
     {
     Entry &entry = m_Stats[i];
-    for(size_t j = 0; j < ngray; j++)
+    double n = (double) entry.count;
+    for(size_t j = 0; j < ngray && n > 0; j++)
       {
-      entry.gray[j].mean = entry.gray[j].sum / entry.count;
-      entry.gray[j].sd = sqrt(
-        (entry.gray[j].sumsq - entry.gray[j].sum * entry.gray[j].mean) 
-        / (entry.count - 1));
+      GreyTypeToNativeFunctor funk = sources[j]->GetNativeMapping();
+      GrayStats &gs = entry.gray[j];
+      double m2 = gs.sumsq * funk.scale * funk.scale;
+      gs.mean = funk(gs.mean);
+      gs.sd = n > 1 ? sqrt(m2 / (n - 1)) : 0.0;
+      gs.sum = n * gs.mean;
+      gs.sumsq = m2 + n * gs.mean * gs.mean;
       }
     entry.volume_mm3 = entry.count * volVoxel;
     }
@@ -36,6 +36,7 @@
 #define __SegmentationStatistics_h_
 
 #include "SNAPCommon.h"
+#include "itkMultiThreader.h"
 #include <vector>
 #include <string>
 #include <iostream>
@@ -43,6 +44,23 @@
 class GenericImageData;
 class ColorLabelTable;
 
+/**
+ * \class SegmentationStatistics
+ * \brief Voxel counts, volumes and gray intensity statistics of the labels
+ * in a segmentation.
+ *
+ * The segmentation is divided into blocks of consecutive image lines, which
+ * are processed in parallel. For each block, the number of voxels of every 
+ * label and the exact integer sums of the gray values (and of their squares)
+ * are kept, along with a signature of the block's labels. The per-label 
+ * totals are obtained by merging the blocks, using the pairwise update for
+ * the mean and the sum of squared deviations, so the results do not depend 
+ * on the number of threads.
+ *
+ * When Compute() is called again on the same images, only the blocks whose 
+ * labels changed are visited again, so that updating the statistics after
+ * an edit costs little more than scanning the labels.
+ */
 class SegmentationStatistics
 {
 public:
@@ -62,8 +80,13 @@ public:
     Entry() : count(0),volume_mm3(0) {}
   };
 
+  SegmentationStatistics();
+
   /* Compute statistics from a segmentation image */
   void Compute(GenericImageData *id);
+
+  /* Forget the block statistics, so that the next Compute visits all voxels */
+  void Reset();
   
   /* Export to a text file using legacy format */
   void ExportLegacy(std::ostream &oss, const ColorLabelTable &clt);
@@ -77,7 +100,42 @@ public:
 private:
   // Label statistics
   Entry m_Stats[MAX_COLOR_LABELS];
-  
+
+  // Statistics of the labels present in a block of the segmentation. For 
+  // each label there are 2 * ngray sums: the sum of the gray values of a 
+  // layer and the sum of their squares, in the gray image's own units
+  struct Block
+    {
+    unsigned long long Signature;
+    std::vector<LabelType> Labels;
+    std::vector<unsigned long> Counts;
+    std::vector<long long> Sums;
+    };
+
+  std::vector<Block> m_Blocks;
+  size_t m_LinesPerBlock;
+
+  // Identifies the images the blocks were computed from: the image objects,
+  // their sizes and the modification times of the gray images
+  std::vector<size_t> m_BlockSource;
+
+  // Modification time of the segmentation when the blocks were updated
+  unsigned long m_SegmentationTime;
+
+  // Data passed to the threads
+  struct ThreadData
+    {
+    SegmentationStatistics *Self;
+    const LabelType *Labels;
+    std::vector<const GreyType *> Gray;
+    size_t LineLength, NumberOfLines;
+    };
+
+  static ITK_THREAD_RETURN_TYPE ThreadCallback(void *arg);
+
+  // Update the blocks assigned to a thread
+  void ThreadedUpdateBlocks(
+    const ThreadData &td, unsigned int thread, unsigned int nThreads);
 };
 
 #endif
@@ -98,6 +98,16 @@ GenericImageData
 
   // Mark the image as modified
   m_LabelWrapper.GetImage()->Modified();
+
+  // Record the voxel as a dirty region for the undo system
+  LabelImageWrapper::RegionType region;
+  region.SetIndex(0, index[0]);
+  region.SetIndex(1, index[1]);
+  region.SetIndex(2, index[2]);
+  region.SetSize(0, 1);
+  region.SetSize(1, 1);
+  region.SetSize(2, 1);
+  m_LabelWrapper.AddDirtyRegion(region);
 }
 
 GenericImageData
@@ -48,6 +48,8 @@
 #include "MeshObject.h"
 #include "MeshExportSettings.h"
 #include "SegmentationStatistics.h"
+#include "LabelRegionCalculator.h"
+#include "AllPurposeProgressAccumulator.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIterator.h"
 #include "itkImageRegionIteratorWithIndex.h"
@@ -61,6 +63,9 @@
 #include "itkWindowedSincInterpolateImageFunction.h"
 #include "itkImageFileWriter.h"
 #include "itkFlipImageFilter.h"
+#include "itkPNGImageIO.h"
+#include "itkMultiThreader.h"
+#include "itkBinaryThresholdImageFilter.h"
 #include <itksys/SystemTools.hxx>
 #include "vtkAppendPolyData.h"
 #include "vtkUnsignedShortArray.h"
@@ -72,12 +77,21 @@
 #include <stdio.h>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
+#include <cmath>
+
+// Grey images larger than this are shown as a subsampled preview while they
+// are being loaded
+static const size_t MAX_PREVIEW_VOXELS = 0x200000;
 
 
 IRISApplication
 ::IRISApplication() 
-: m_UndoManager(4,200000)
+: m_UndoManager(4,0x10000000)
 {
+  // Keep up to 16MB of undo data in memory, the rest goes to a temp file
+  m_UndoManager.SetSpillThreshold(0x1000000);
+
   // Construct new global state object
   m_GlobalState = new GlobalState;
 
@@ -140,53 +154,74 @@ IRISApplication
   // Create the SNAP image data object
   m_SNAPImageData = new SNAPImageData(this);
 
-  // Get the roi chunk from the grey image
-  GreyImageType::Pointer imgNewGrey = 
-    m_IRISImageData->GetGrey()->DeepCopyRegion(roi,progressCommand);
+  // The progress command may abort the filter that invokes it, in which 
+  // case the SNAP image data is discarded and the exception passed on
+  try
+    {
+    // Get the roi chunk from the grey image
+    GreyImageType::Pointer imgNewGrey = 
+      m_IRISImageData->GetGrey()->DeepCopyRegion(roi,progressCommand);
 
-  // Get the size of the region
-  Vector3ui size = to_unsigned_int(
-    Vector3ul(imgNewGrey->GetLargestPossibleRegion().GetSize().GetSize()));
+    // Get the size of the region
+    Vector3ui size = to_unsigned_int(
+      Vector3ul(imgNewGrey->GetLargestPossibleRegion().GetSize().GetSize()));
 
-  // Compute an image coordinate geometry for the region of interest  
-  ImageCoordinateGeometry icg(
-    m_IRISImageData->GetImageGeometry().GetImageDirectionCosineMatrix(),
-    m_DisplayToAnatomyRAI, size);
+    // Compute an image coordinate geometry for the region of interest  
+    ImageCoordinateGeometry icg(
+      m_IRISImageData->GetImageGeometry().GetImageDirectionCosineMatrix(),
+      m_DisplayToAnatomyRAI, size);
 
-  // Assign the new wrapper to the target
-  m_SNAPImageData->SetGreyImage(
-    imgNewGrey, icg,
-    m_IRISImageData->GetGrey()->GetNativeMapping());
-  
-  // Override the interpolator in ROI for label interpolation, or we will get
-  // nonsense
-  SNAPSegmentationROISettings roiLabel = roi;
-  roiLabel.SetInterpolationMethod(SNAPSegmentationROISettings::NEAREST_NEIGHBOR);
-
-  // Get chunk of the label image
-  LabelImageType::Pointer imgNewLabel = 
-    m_IRISImageData->GetSegmentation()->DeepCopyRegion(roiLabel,progressCommand);
-
-  // Filter the segmentation image to only allow voxels of 0 intensity and 
-  // of the current drawing color
-  LabelType passThroughLabel = m_GlobalState->GetDrawingColorLabel();
-
-  typedef itk::ImageRegionIterator<LabelImageType> IteratorType;
-  IteratorType itLabel(imgNewLabel,imgNewLabel->GetBufferedRegion());  
-  while(!itLabel.IsAtEnd())
+    // Assign the new wrapper to the target
+    m_SNAPImageData->SetGreyImage(
+      imgNewGrey, icg,
+      m_IRISImageData->GetGrey()->GetNativeMapping());
+    
+    // Override the interpolator in ROI for label interpolation, or we will get
+    // nonsense
+    SNAPSegmentationROISettings roiLabel = roi;
+    roiLabel.SetInterpolationMethod(
+      SNAPSegmentationROISettings::NEAREST_NEIGHBOR);
+
+    // Get chunk of the label image
+    LabelImageType::Pointer imgNewLabel = 
+      m_IRISImageData->GetSegmentation()->DeepCopyRegion(
+        roiLabel,progressCommand);
+
+    // Filter the segmentation image to only allow voxels of 0 intensity and 
+    // of the current drawing color. The filter runs in place on the chopped 
+    // region, so it only touches the voxels of the region of interest
+    LabelType passThroughLabel = m_GlobalState->GetDrawingColorLabel();
+
+    typedef itk::BinaryThresholdImageFilter<
+      LabelImageType,LabelImageType> PassThroughFilter;
+    PassThroughFilter::Pointer fltPass = PassThroughFilter::New();
+    fltPass->SetInput(imgNewLabel);
+    fltPass->InPlaceOn();
+    fltPass->SetLowerThreshold(passThroughLabel);
+    fltPass->SetUpperThreshold(passThroughLabel);
+    fltPass->SetInsideValue(passThroughLabel);
+    fltPass->SetOutsideValue((LabelType) 0);
+    if(progressCommand)
+      fltPass->AddObserver(itk::AnyEvent(),progressCommand);
+    fltPass->Update();
+
+    imgNewLabel = fltPass->GetOutput();
+    imgNewLabel->DisconnectPipeline();
+
+    // Pass the cleaned up segmentation image to SNAP
+    m_SNAPImageData->SetSegmentationImage(imgNewLabel);
+
+    // Pass the label description of the drawing label to the SNAP image data
+    m_SNAPImageData->SetColorLabel(
+      m_ColorLabelTable->GetColorLabel(passThroughLabel));
+    }
+  catch(itk::ProcessAborted &)
     {
-    if(itLabel.Value() != passThroughLabel)
-      itLabel.Value() = (LabelType) 0;
-    ++itLabel;
+    delete m_SNAPImageData;
+    m_SNAPImageData = NULL;
+    throw;
     }
 
-  // Pass the cleaned up segmentation image to SNAP
-  m_SNAPImageData->SetSegmentationImage(imgNewLabel);
-
-  // Pass the label description of the drawing label to the SNAP image data
-  m_SNAPImageData->SetColorLabel(
-    m_ColorLabelTable->GetColorLabel(passThroughLabel));
-
   // Assign the intensity mapping function to the Snap data
   m_SNAPImageData->GetGrey()->SetReferenceIntensityRange(
     m_IRISImageData->GetGrey()->GetImageMin(),
@@ -307,12 +342,8 @@ IRISApplication
   this->m_IRISImageData->GetSegmentation()->GetImage()->FillBuffer(0);
   this->m_IRISImageData->GetSegmentation()->GetImage()->Modified();
 
-  // Fill the undo image with blanks too
-  this->m_IRISImageData->GetUndoImage()->GetImage()->FillBuffer(0);
-  this->m_IRISImageData->GetUndoImage()->GetImage()->Modified();
-
   // Clear the undo buffer
-  m_UndoManager.Clear();
+  ResetUndoState();
 }
 
 void
@@ -354,7 +385,7 @@ IRISApplication
       m_ColorLabelTable->SetColorLabelValid(it.Get(), true);
 
   // Reset the UNDO manager
-  m_UndoManager.Clear();
+  ResetUndoState();
 }
 
 LabelType
@@ -376,6 +407,124 @@ IRISApplication
       (iMode == PAINT_OVER_ONE && iDrawOver == iTarget)) ? iDrawing : iTarget;
 }
 
+// Data shared by the threads merging the SNAP segmentation into IRIS
+class IRISApplicationMergeData
+{
+public:
+  typedef itk::ImageRegion<3> RegionType;
+
+  // The SNAP level set image and the IRIS segmentation
+  const float *Source;
+  itk::Size<3> SourceSize;
+  LabelType *Target;
+  itk::Size<3> TargetSize;
+
+  // The region of the segmentation to merge into, and the source voxel 
+  // corresponding to each of its voxels along each axis
+  RegionType ROI;
+  const std::vector<long> *SourceIndex[3];
+
+  // The merge table, with one row for the outside and one for the inside of
+  // the SNAP segmentation
+  const LabelType *Table;
+  size_t TableSize;
+
+  // The bounding box of the voxels changed by each thread
+  std::vector<RegionType> Changed;
+  std::vector<char> HasChanges;
+
+  void MergeLines(unsigned int iThread, size_t iStart, size_t iEnd);
+
+  static ITK_THREAD_RETURN_TYPE ThreadCallback(void *arg);
+};
+
+void
+IRISApplicationMergeData
+::MergeLines(unsigned int iThread, size_t iStart, size_t iEnd)
+{
+  const std::vector<long> &ix = *SourceIndex[0];
+  const std::vector<long> &iy = *SourceIndex[1];
+  const std::vector<long> &iz = *SourceIndex[2];
+  size_t nx = ROI.GetSize(0), ny = ROI.GetSize(1);
+
+  // Voxels outside of the SNAP image are treated as outside of the SNAP
+  // segmentation, as the resampling filter does
+  const LabelType *tblOutside = Table;
+  const LabelType *tblInside = Table + TableSize;
+
+  long lo[3], hi[3];
+  bool changed = false;
+  for(size_t line = iStart; line < iEnd; line++)
+    {
+    size_t y = line % ny, z = line / ny;
+    LabelType *pTarget = Target 
+      + (ROI.GetIndex(2) + z) * TargetSize[0] * TargetSize[1]
+      + (ROI.GetIndex(1) + y) * TargetSize[0] + ROI.GetIndex(0);
+
+    // The line of the source image, if any
+    const float *pSource = NULL;
+    if(iy[y] >= 0 && iz[z] >= 0)
+      pSource = Source 
+        + iz[z] * SourceSize[0] * SourceSize[1] + iy[y] * SourceSize[0];
+
+    long xFirst = -1, xLast = -1;
+    for(size_t x = 0; x < nx; x++)
+      {
+      LabelType voxIRIS = pTarget[x];
+      bool inside = pSource && ix[x] >= 0 && pSource[ix[x]] <= 0.0f;
+      LabelType voxNew = inside ? tblInside[voxIRIS] : tblOutside[voxIRIS];
+      if(voxNew != voxIRIS)
+        {
+        pTarget[x] = voxNew;
+        if(xFirst < 0) 
+          xFirst = (long) x;
+        xLast = (long) x;
+        }
+      }
+
+    // Grow the bounding box of the changed voxels
+    if(xFirst >= 0)
+      {
+      long pos[3] = { xFirst, (long) y, (long) z };
+      long end[3] = { xLast, (long) y, (long) z };
+      for(unsigned int d = 0; d < 3; d++)
+        {
+        lo[d] = changed ? std::min(lo[d], pos[d]) : pos[d];
+        hi[d] = changed ? std::max(hi[d], end[d]) : end[d];
+        }
+      changed = true;
+      }
+    }
+
+  if(changed)
+    {
+    for(unsigned int d = 0; d < 3; d++)
+      {
+      Changed[iThread].SetIndex(d, ROI.GetIndex(d) + lo[d]);
+      Changed[iThread].SetSize(d, hi[d] - lo[d] + 1);
+      }
+    HasChanges[iThread] = 1;
+    }
+}
+
+ITK_THREAD_RETURN_TYPE
+IRISApplicationMergeData
+::ThreadCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info = 
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  IRISApplicationMergeData *td = 
+    static_cast<IRISApplicationMergeData *>(info->UserData);
+
+  // Each thread merges a contiguous range of lines of the ROI
+  size_t nLines = td->ROI.GetSize(1) * td->ROI.GetSize(2);
+  size_t iStart = (nLines * info->ThreadID) / info->NumberOfThreads;
+  size_t iEnd = (nLines * (info->ThreadID + 1)) / info->NumberOfThreads;
+  td->MergeLines(info->ThreadID, iStart, iEnd);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
 void 
 IRISApplication
 ::UpdateIRISWithSnapImageData(CommandType *progressCommand)
@@ -394,8 +543,32 @@ IRISApplication
   // Construct are region of interest into which the result will be pasted
   SNAPSegmentationROISettings roi = m_GlobalState->GetSegmentationROISettings();
 
-  // If the ROI has been resampled, resample the segmentation in reverse direction
-  if(roi.GetResampleFlag())
+  // For every voxel of the ROI, the index of the source voxel along each axis,
+  // or -1 for voxels that fall outside of the source image
+  std::vector<long> sourceIndex[3];
+
+  // If the ROI has been resampled, resample the segmentation in reverse 
+  // direction. Nearest neighbor sampling is done on the fly during the merge,
+  // without creating an intermediate image
+  bool nearest = roi.GetInterpolationMethod() == 
+    SNAPSegmentationROISettings::NEAREST_NEIGHBOR;
+  if(roi.GetResampleFlag() && nearest)
+    {
+    // With the identity transform, voxel j of the ROI lands on the continuous
+    // index j * spacing / sourceSpacing, which is rounded to the nearest voxel
+    for(unsigned int d = 0; d < 3; d++)
+      {
+      double ratio = target->GetSpacing()[d] / source->GetSpacing()[d];
+      double last = source->GetBufferedRegion().GetSize(d) - 1.0;
+      sourceIndex[d].resize(roi.GetROI().GetSize(d));
+      for(size_t j = 0; j < sourceIndex[d].size(); j++)
+        {
+        double x = j * ratio;
+        sourceIndex[d][j] = (x <= last) ? (long) floor(x + 0.5) : -1;
+        }
+      }
+    }
+  else if(roi.GetResampleFlag())
     {
     // Create a resampling filter
     typedef itk::ResampleImageFilter<SourceImageType,SourceImageType> ResampleFilterType;
@@ -462,53 +635,92 @@ IRISApplication
     source = fltSample->GetOutput();
     }  
   
-  // Create iterators for copying from one to the other
-  typedef itk::ImageRegionConstIterator<SourceImageType> SourceIteratorType;
-  typedef itk::ImageRegionIterator<TargetImageType> TargetIteratorType;
-  SourceIteratorType itSource(source,source->GetLargestPossibleRegion());
-  TargetIteratorType itTarget(target,roi.GetROI());
+  // Without resampling, or after resampling, the source matches the ROI 
+  for(unsigned int d = 0; d < 3; d++)
+    {
+    if(sourceIndex[d].size() == 0)
+      {
+      sourceIndex[d].resize(roi.GetROI().GetSize(d));
+      for(size_t j = 0; j < sourceIndex[d].size(); j++)
+        sourceIndex[d][j] = (long) j;
+      }
+    }
 
   // Figure out which color draws and which color is clear
   unsigned int iClear = m_GlobalState->GetPolygonInvert() ? 1 : 0;
 
   // Construct a merge table that contains an output intensity for every 
   // possible combination of two input intensities (note that snap image only
-  // has two possible intensities
-  LabelType mergeTable[2][MAX_COLOR_LABELS];
+  // has two possible intensities). Row 1 is used inside the SNAP segmentation
+  const size_t nLabels = MAX_COLOR_LABELS + 1;
+  std::vector<LabelType> mergeTable(2 * nLabels);
 
   // Perform the merge
-  for(unsigned int i=0;i<MAX_COLOR_LABELS;i++)
+  for(unsigned int i=0;i<nLabels;i++)
     {
     // Whe the SNAP image is clear, IRIS passes through to the output
     // except for the IRIS voxels of the drawing color, which get cleared out
-    mergeTable[iClear][i] = (i!=m_GlobalState->GetDrawingColorLabel()) ? i : 0;
+    mergeTable[iClear * nLabels + i] = 
+      (i!=m_GlobalState->GetDrawingColorLabel()) ? i : 0;
 
     // If mode is paint over all, the victim is overridden
-    mergeTable[1-iClear][i] = DrawOverLabel((LabelType) i);
+    mergeTable[(1-iClear) * nLabels + i] = DrawOverLabel((LabelType) i);
     }
 
-  // Go through both iterators, copy the new over the old
-  itSource.GoToBegin();
-  itTarget.GoToBegin();
-  while(!itSource.IsAtEnd())
+  // Merge the rows of the ROI in parallel
+  IRISApplicationMergeData td;
+  td.Source = source->GetBufferPointer();
+  td.SourceSize = source->GetBufferedRegion().GetSize();
+  td.Target = target->GetBufferPointer();
+  td.TargetSize = target->GetBufferedRegion().GetSize();
+  td.ROI = roi.GetROI();
+  for(unsigned int d = 0; d < 3; d++)
+    td.SourceIndex[d] = &sourceIndex[d];
+  td.Table = &mergeTable[0];
+  td.TableSize = nLabels;
+
+  size_t nLines = td.ROI.GetSize(1) * td.ROI.GetSize(2);
+  itk::MultiThreader::Pointer mt = itk::MultiThreader::New();
+  unsigned int nThreads = (unsigned int) std::max((size_t) 1, 
+    std::min((size_t) mt->GetNumberOfThreads(), nLines));
+  mt->SetNumberOfThreads(nThreads);
+  td.Changed.resize(nThreads);
+  td.HasChanges.resize(nThreads, 0);
+  mt->SetSingleMethod(IRISApplicationMergeData::ThreadCallback, &td);
+  mt->SingleMethodExecute();
+
+  // Combine the regions changed by the threads. Only the voxels that were
+  // actually changed are reported, so that the undo delta for the merge 
+  // is computed over the smallest possible region
+  bool changed = false;
+  TargetImageType::RegionType rChanged;
+  for(unsigned int t = 0; t < nThreads; t++)
     {
-    // Get the two voxels
-    LabelType &voxIRIS = itTarget.Value();    
-    float voxSNAP = itSource.Value();
-
-    // Check that we're ok (debug mode only)
-    assert(!itTarget.IsAtEnd());
-
-    // Perform the merge
-    voxIRIS = mergeTable[voxSNAP <= 0 ? 1 : 0][voxIRIS];
-
-    // Iterate
-    ++itSource;
-    ++itTarget;
+    if(!td.HasChanges[t])
+      continue;
+    if(!changed)
+      {
+      rChanged = td.Changed[t];
+      changed = true;
+      continue;
+      }
+    for(unsigned int d = 0; d < 3; d++)
+      {
+      long lo = std::min(rChanged.GetIndex(d), td.Changed[t].GetIndex(d));
+      long hi = std::max(
+        rChanged.GetIndex(d) + (long) rChanged.GetSize(d),
+        td.Changed[t].GetIndex(d) + (long) td.Changed[t].GetSize(d));
+      rChanged.SetIndex(d, lo);
+      rChanged.SetSize(d, hi - lo);
+      }
     }
 
   // The target has been modified
-  target->Modified();
+  if(changed)
+    {
+    target->Modified();
+    m_IRISImageData->GetSegmentation()->AddDirtyRegion(rChanged);
+    }
 }
 
 void
@@ -531,36 +743,39 @@ IRISApplication
 ::StoreUndoPoint(const char *text)
 {
   // Set the current state as the undo point. We store the difference between
-  // the last 'undo' image and the current segmentation image, and then copy
-  // the current segmentation image into the undo image
-  LabelImageWrapper *undo = m_IRISImageData->GetUndoImage();
+  // the image at the last undo point, which is kept by the undo manager, and
+  // the current segmentation image
   LabelImageWrapper *seg = m_IRISImageData->GetSegmentation();
   
-  LabelType *dseg = seg->GetVoxelPointer();
-  LabelType *dundo = undo->GetVoxelPointer();
-  size_t n = seg->GetNumberOfVoxels();
-
-  // Create the Undo delta object
-  UndoManagerType::Delta *delta = new UndoManagerType::Delta();
-
-  // Copy and encode
-  for(size_t i = 0; i < n; i++)
-    {
-    LabelType vSrc = dseg[i], vDst = dundo[i];
-    delta->Encode(vSrc - vDst);
-    dundo[i] = vSrc;
-    }
-
-  // Important last step!
-  delta->FinishEncoding();
-
-  // Set modified flag on the undo image
-  undo->GetImage()->Modified();
+  // Only the regions that were modified since the last undo point need to
+  // be compared. If the segmentation was modified without reporting where,
+  // the whole image is compared
+  LabelImageWrapper::RegionList regions = seg->GetDirtyRegions();
+  if(seg->HasUntrackedChanges())
+    regions.assign(1, seg->GetImage()->GetBufferedRegion());
+
+  // Compute the delta and update the undo manager's copy of the image. This
+  // is done in parallel, skipping over the unchanged parts of the image
+  UndoManagerType::Delta *delta = 
+    m_UndoManager.EncodeDelta(seg->GetVoxelPointer(), regions);
+  seg->ClearDirtyRegions();
 
   // Add the delta object
   m_UndoManager.AppendDelta(delta);
 }
 
+void
+IRISApplication
+::ResetUndoState()
+{
+  // The current segmentation becomes the state at the last undo point
+  LabelImageWrapper *seg = m_IRISImageData->GetSegmentation();
+  m_UndoManager.Clear();
+  m_UndoManager.SetReferenceImage(
+    seg->GetVoxelPointer(), seg->GetImage()->GetBufferedRegion());
+  seg->ClearDirtyRegions();
+}
+
 void
 IRISApplication
 ::ClearUndoPoints()
@@ -583,35 +798,27 @@ IRISApplication
   // it to the image
   UndoManagerType::Delta *delta = m_UndoManager.GetDeltaForUndo();
 
-  LabelImageWrapper *imUndo = m_IRISImageData->GetUndoImage();
   LabelImageWrapper *imSeg = m_IRISImageData->GetSegmentation();
-  LabelType *dundo = imUndo->GetVoxelPointer();
-  LabelType *dseg = imSeg->GetVoxelPointer();
+  bool untracked = imSeg->HasUntrackedChanges();
 
-  // Applying the delta means adding 
-  for(size_t i = 0; i < delta->GetNumberOfRLEs(); i++)
-    {
-    size_t n = delta->GetRLELength(i);
-    LabelType d = delta->GetRLEValue(i);
-    if(d == 0)
-      {
-      dundo += n;
-      dseg += n;
-      }
-    else
-      {
-      for(size_t j = 0; j < n; j++)
-        {
-        *dundo -= d;
-        *dseg = *dundo;
-        ++dundo; ++dseg;
-        }
-      }
-    }
+  // Applying the delta means subtracting it from the image at the last undo
+  // point and copying the changed voxels into the segmentation image
+  m_UndoManager.ApplyDelta(delta, imSeg->GetVoxelPointer(), false);
 
   // Set modified flags
   imSeg->GetImage()->Modified();
-  imUndo->GetImage()->Modified();
+
+  // The segmentation changed in the regions of the delta. If it also had
+  // changes whose region is unknown, the whole image must stay dirty
+  if(untracked)
+    {
+    imSeg->AddDirtyRegion(imSeg->GetImage()->GetBufferedRegion());
+    }
+  else
+    {
+    for(size_t i = 0; i < delta->GetRegions().size(); i++)
+      imSeg->AddDirtyRegion(delta->GetRegions()[i]);
+    }
 }
 
 
@@ -630,35 +837,27 @@ IRISApplication
   // it to the image
   UndoManagerType::Delta *delta = m_UndoManager.GetDeltaForRedo();
 
-  LabelImageWrapper *imUndo = m_IRISImageData->GetUndoImage();
   LabelImageWrapper *imSeg = m_IRISImageData->GetSegmentation();
-  LabelType *dundo = imUndo->GetVoxelPointer();
-  LabelType *dseg = imSeg->GetVoxelPointer();
+  bool untracked = imSeg->HasUntrackedChanges();
 
-  // Applying the delta means adding 
-  for(size_t i = 0; i < delta->GetNumberOfRLEs(); i++)
-    {
-    size_t n = delta->GetRLELength(i);
-    LabelType d = delta->GetRLEValue(i);
-    if(d == 0)
-      {
-      dundo += n;
-      dseg += n;
-      }
-    else
-      {
-      for(size_t j = 0; j < n; j++)
-        {
-        *dundo += d;
-        *dseg = *dundo;
-        ++dundo; ++dseg;
-        }
-      }
-    }
+  // Applying the delta means adding it to the image at the last undo point
+  // and copying the changed voxels into the segmentation image
+  m_UndoManager.ApplyDelta(delta, imSeg->GetVoxelPointer(), true);
 
   // Set modified flags
   imSeg->GetImage()->Modified();
-  imUndo->GetImage()->Modified();
+
+  // The segmentation changed in the regions of the delta. If it also had
+  // changes whose region is unknown, the whole image must stay dirty
+  if(untracked)
+    {
+    imSeg->AddDirtyRegion(imSeg->GetImage()->GetBufferedRegion());
+    }
+  else
+    {
+    for(size_t i = 0; i < delta->GetRegions().size(); i++)
+      imSeg->AddDirtyRegion(delta->GetRegions()[i]);
+    }
 }
 
 
@@ -761,6 +960,202 @@ IRISApplication
   writer->Update();
 }
 
+// Data shared by the threads encoding a series of rendered slices
+class IRISApplicationSliceSeriesData
+{
+public:
+  // The slices rendered for the current batch, as 8-bit RGB, and the files
+  // they should be written to
+  std::vector<std::vector<unsigned char> > Pixels;
+  std::vector<std::string> Files;
+  unsigned int Width, Height, Count;
+
+  // One PNG writer per thread, and the error reported for each slice
+  std::vector<itk::PNGImageIO::Pointer> IO;
+  std::vector<std::string> Errors;
+
+  void WriteSlice(unsigned int iThread, unsigned int iSlice);
+
+  static ITK_THREAD_RETURN_TYPE ThreadCallback(void *arg);
+};
+
+void
+IRISApplicationSliceSeriesData
+::WriteSlice(unsigned int iThread, unsigned int iSlice)
+{
+  itk::PNGImageIO *io = IO[iThread];
+  io->SetNumberOfDimensions(2);
+  io->SetDimensions(0, Width);
+  io->SetDimensions(1, Height);
+  io->SetComponentType(itk::ImageIOBase::UCHAR);
+  io->SetPixelType(itk::ImageIOBase::RGB);
+  io->SetNumberOfComponents(3);
+
+  itk::ImageIORegion ioRegion(2);
+  ioRegion.SetSize(0, Width);
+  ioRegion.SetSize(1, Height);
+  io->SetIORegion(ioRegion);
+
+  io->SetFileName(Files[iSlice].c_str());
+  try
+    {
+    io->Write(&Pixels[iSlice][0]);
+    }
+  catch(itk::ExceptionObject &exc)
+    {
+    Errors[iSlice] = exc.GetDescription();
+    }
+}
+
+ITK_THREAD_RETURN_TYPE
+IRISApplicationSliceSeriesData
+::ThreadCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info = 
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  IRISApplicationSliceSeriesData *td = 
+    static_cast<IRISApplicationSliceSeriesData *>(info->UserData);
+
+  // Slices are dealt out to the threads in turn
+  for(unsigned int i = info->ThreadID; i < td->Count; i += info->NumberOfThreads)
+    td->WriteSlice(info->ThreadID, i);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+void
+IRISApplication
+::ExportSliceSeries(AnatomicalDirection iSliceAnat, const char *dir,
+                    CommandType *progressCommand)
+  throw(itk::ExceptionObject)
+{
+  static const char *prefix[3] = {"axial", "sagittal", "coronal"};
+
+  ImageWrapperBase *main = m_CurrentImageData->GetMain();
+  LabelImageWrapper *seg = m_CurrentImageData->IsSegmentationLoaded()
+    ? m_CurrentImageData->GetSegmentation() : NULL;
+
+  // The display slice showing this direction, and the image axis it moves along
+  size_t iDisplay = GetDisplayWindowForAnatomicalDirection(iSliceAnat);
+  size_t iImageDir = GetImageDirectionForAnatomicalDirection(iSliceAnat);
+  Vector3ui xSize = m_CurrentImageData->GetVolumeExtents();
+  Vector3ui xCrossOld = GetCursorPosition(), xCross = xCrossOld;
+  unsigned char segAlpha = m_GlobalState->GetSegmentationAlpha();
+
+  // The filenames start with the directory name
+  std::string path = dir;
+  if(path.length() && path[path.length() - 1] != '/' 
+    && path[path.length() - 1] != '\\')
+    path += "/";
+
+  // Set up the threads. A batch of slices is rendered on this thread, since
+  // the image wrapper pipelines can not be shared, and the batch is then 
+  // encoded on all threads
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  unsigned int nThreads = threader->GetNumberOfThreads();
+  unsigned int nBatch = 2 * nThreads;
+
+  IRISApplicationSliceSeriesData td;
+  td.Pixels.resize(nBatch);
+  td.Files.resize(nBatch);
+  td.Errors.resize(nBatch);
+  for(unsigned int t = 0; t < nThreads; t++)
+    td.IO.push_back(itk::PNGImageIO::New());
+
+  threader->SetSingleMethod(
+    IRISApplicationSliceSeriesData::ThreadCallback, &td);
+
+  // Progress is reported after each batch
+  AllPurposeProgressAccumulator::Pointer progress;
+  if(progressCommand)
+    {
+    progress = AllPurposeProgressAccumulator::New();
+    progress->AddObserver(itk::ProgressEvent(), progressCommand);
+    progress->UpdateProgress(0.0f);
+    }
+
+  try
+    {
+    for(unsigned int iFirst = 0; iFirst < xSize[iImageDir]; iFirst += nBatch)
+      {
+      td.Count = std::min(nBatch, xSize[iImageDir] - iFirst);
+      for(unsigned int j = 0; j < td.Count; j++)
+        {
+        // Move the slice and bring the display slices up to date
+        xCross[iImageDir] = iFirst + j;
+        SetCursorPosition(xCross);
+
+        ImageWrapperBase::DisplaySlicePointer sMain = 
+          main->GetDisplaySlice(iDisplay);
+        sMain->Update();
+
+        ImageWrapperBase::DisplaySlicePointer sSeg = NULL;
+        if(seg)
+          {
+          sSeg = seg->GetDisplaySlice(iDisplay);
+          sSeg->Update();
+          }
+
+        // Compose the slices the way the slice windows blend their textures,
+        // flipping them since the display slices have the origin at the bottom
+        td.Width = sMain->GetBufferedRegion().GetSize(0);
+        td.Height = sMain->GetBufferedRegion().GetSize(1);
+        std::vector<unsigned char> &pix = td.Pixels[j];
+        pix.resize(3 * td.Width * td.Height);
+
+        const ImageWrapperBase::DisplayPixelType *pMain = 
+          sMain->GetBufferPointer();
+        const ImageWrapperBase::DisplayPixelType *pSeg = 
+          sSeg ? sSeg->GetBufferPointer() : NULL;
+        for(unsigned int y = 0; y < td.Height; y++)
+          {
+          unsigned char *out = &pix[3 * td.Width * (td.Height - 1 - y)];
+          for(unsigned int x = 0; x < td.Width; x++, pMain++, out += 3)
+            {
+            for(unsigned int c = 0; c < 3; c++)
+              out[c] = (*pMain)[c];
+            if(pSeg)
+              {
+              unsigned int a = (*pSeg)[3] * segAlpha / 255;
+              for(unsigned int c = 0; c < 3; c++)
+                out[c] = (unsigned char)
+                  ((out[c] * (255 - a) + (*pSeg)[c] * a) / 255);
+              pSeg++;
+              }
+            }
+          }
+
+        char fn[32];
+        sprintf(fn, "%s%04d.png", prefix[iSliceAnat], iFirst + j + 1);
+        td.Files[j] = path + fn;
+        td.Errors[j].clear();
+        }
+
+      // Encode and write the batch
+      threader->SingleMethodExecute();
+      for(unsigned int j = 0; j < td.Count; j++)
+        {
+        if(td.Errors[j].length())
+          throw itk::ExceptionObject(__FILE__, __LINE__, 
+            (std::string("Unable to write ") + td.Files[j] + ": " 
+             + td.Errors[j]).c_str());
+        }
+
+      if(progress)
+        progress->UpdateProgress(
+          (iFirst + td.Count) * 1.0f / xSize[iImageDir]);
+      }
+    }
+  catch(...)
+    {
+    SetCursorPosition(xCrossOld);
+    throw;
+    }
+
+  // Put the cursor back where it was
+  SetCursorPosition(xCrossOld);
+}
+
 void 
 IRISApplication
 ::ExportSegmentationStatistics(const char *file)  throw(itk::ExceptionObject)
@@ -909,24 +1304,29 @@ IRISApplication
   LabelImageWrapper::ImagePointer imgLabel = 
     m_CurrentImageData->GetSegmentation()->GetImage();
 
-  // Get the number of voxels
-  size_t nvoxels = 0;
+  // Find the voxels that have the label that is being replaced
+  LabelRegionCalculator calc;
+  calc.Compute(imgLabel);
+  size_t nvoxels = calc.GetCount(drawover);
+  if(nvoxels == 0 || drawing == drawover)
+    return nvoxels;
 
-  // Update the segmentation
+  // Update the segmentation within the bounding box of the label
+  LabelImageWrapper::ImageType::RegionType box = 
+    calc.GetBoundingBox(drawover);
   typedef itk::ImageRegionIterator<
     LabelImageWrapper::ImageType> IteratorType;
-  for(IteratorType it(imgLabel, imgLabel->GetBufferedRegion());  
-    !it.IsAtEnd(); ++it)
+  for(IteratorType it(imgLabel, box); !it.IsAtEnd(); ++it)
     {
     if(it.Get() == drawover)
       {
       it.Set(drawing);
-      ++nvoxels;
       }
     }
 
   // Register that the image has been updated
   imgLabel->Modified();
+  m_CurrentImageData->GetSegmentation()->AddDirtyRegion(box);
 
   return nvoxels;
 }
@@ -981,6 +1381,8 @@ IRISApplication
   
   // Register that the image has been updated
   imgLabel->Modified();
+  m_CurrentImageData->GetSegmentation()->AddDirtyRegion(
+    imgLabel->GetBufferedRegion());
 }
 
 int 
@@ -1188,7 +1590,8 @@ IRISApplication
 
 IRISApplication::MainImageType
 IRISApplication
-::UpdateIRISMainImage(GuidedNativeImageIO *io, MainImageType force_type)
+::UpdateIRISMainImage(GuidedNativeImageIO *io, MainImageType force_type,
+                      CommandType *previewCommand)
   {
   // This has to happen in 'pure' IRIS mode
   assert(m_SNAPImageData == NULL);
@@ -1206,6 +1609,52 @@ IRISApplication
   ImageCoordinateGeometry icg(
     io->GetNativeImage()->GetDirection().GetVnlMatrix(), m_DisplayToAnatomyRAI, size);
 
+  // For large grey images, give the caller a coarse version of the image to
+  // display while the full resolution image is being processed. This is 
+  // only done when no main image is loaded, so that if loading the full
+  // image fails, unloading the preview restores the previous state
+  bool isPreviewLoaded = false;
+  if(type == MAIN_SCALAR && previewCommand && !m_IRISImageData->IsMainLoaded())
+    {
+    GuidedNativeImageIO preview;
+    if(io->CreatePreview(preview, MAX_PREVIEW_VOXELS))
+      {
+      UpdateIRISMainImage(&preview, MAIN_SCALAR);
+      isPreviewLoaded = true;
+      previewCommand->Execute((itk::Object *) 0, itk::ProgressEvent());
+      }
+    }
+
+  try
+    {
+    UpdateIRISMainImageData(io, type, icg);
+    }
+  catch(...)
+    {
+    if(isPreviewLoaded)
+      m_IRISImageData->UnloadMainImage();
+    throw;
+    }
+
+  // Update the crosshairs position
+  Vector3ui cursor = size;
+  cursor /= 2;
+  m_IRISImageData->SetCrosshairs(cursor);
+
+  // TODO: Unify this!
+  m_GlobalState->SetCrosshairsPosition(cursor);
+
+  // Reset the UNDO manager
+  ResetUndoState();
+
+  return type;
+}
+
+void
+IRISApplication
+::UpdateIRISMainImageData(GuidedNativeImageIO *io, MainImageType type,
+                          const ImageCoordinateGeometry &icg)
+{
   // Cast the native image to desired format and pass on to IRISImageData
   if(type == MAIN_SCALAR)
     {
@@ -1238,24 +1687,12 @@ IRISApplication
     io->DeallocateNativeImage();
     }
   else throw itk::ExceptionObject("Unsupported main image type");
-
-  // Update the crosshairs position
-  Vector3ui cursor = size;
-  cursor /= 2;
-  m_IRISImageData->SetCrosshairs(cursor);
-
-  // TODO: Unify this!
-  m_GlobalState->SetCrosshairsPosition(cursor);
-
-  // Reset the UNDO manager
-  m_UndoManager.Clear();
-
-  return type;
 }
 
 IRISApplication::MainImageType 
 IRISApplication
-::LoadMainImage(const char *filename, MainImageType force_type)
+::LoadMainImage(const char *filename, MainImageType force_type,
+                CommandType *previewCommand, CommandType *progressCommand)
 {
   // Load the settings associated with this file
   Registry regFull;
@@ -1266,10 +1703,10 @@ IRISApplication
 
   // Create a native image IO object
   GuidedNativeImageIO io;
-  io.ReadNativeImage(filename, folder);
+  io.ReadNativeImage(filename, folder, progressCommand);
 
   // Detemine the type
-  MainImageType type = UpdateIRISMainImage(&io, force_type);
+  MainImageType type = UpdateIRISMainImage(&io, force_type, previewCommand);
   if(type == MAIN_SCALAR)
     {
     // Save the filename for the UI
@@ -1286,7 +1723,8 @@ IRISApplication
 
 IRISApplication::MainImageType 
 IRISApplication
-::LoadOverlayImage(const char *filename, MainImageType force_type)
+::LoadOverlayImage(const char *filename, MainImageType force_type,
+                   CommandType *progressCommand)
 {
   // Load the settings associated with this file
   Registry regFull;
@@ -1297,7 +1735,7 @@ IRISApplication
 
   // Create a native image IO object
   GuidedNativeImageIO io;
-  io.ReadNativeImage(filename, folder);
+  io.ReadNativeImage(filename, folder, progressCommand);
 
   // Detemine the type
   return AddIRISOverlayImage(&io, force_type);
@@ -1343,7 +1781,7 @@ IRISApplication
 
 void 
 IRISApplication
-::LoadLabelImageFile(const char *filename)
+::LoadLabelImageFile(const char *filename, CommandType *progressCommand)
 {
   // Load the settings associated with this file
   Registry regFull;
@@ -1355,7 +1793,7 @@ IRISApplication
 
   // Read the image in native format
   GuidedNativeImageIO io;
-  io.ReadNativeImage(filename, regGrey);
+  io.ReadNativeImage(filename, regGrey, progressCommand);
 
   // Set the image as the current grayscale image
   UpdateIRISSegmentationImage(&io);
@@ -50,6 +50,7 @@ class IRISImageData;
 class SNAPImageData;
 class MeshExportSettings;
 class GuidedNativeImageIO;
+class ImageCoordinateGeometry;
 namespace itk {
   template <class TPixel, unsigned int VDimension> class OrientedImage;
 }
@@ -128,9 +129,17 @@ public:
    * RGB image data into IRISImageData. The parameter is the GuidedNativeImageIO,
    * which holds an image in native format. The second parameter specified whether
    * to force RGB or grey image, or to determine image type based on the data.
+   *
+   * If a preview command is given and a large grey image is being loaded, a 
+   * subsampled copy of the image is loaded first and the command is invoked,
+   * so that the caller can display it while the full resolution image is 
+   * being cast and its intensity range computed. The preview is only shown
+   * when no main image is loaded, and it is unloaded again if the full 
+   * resolution image can not be loaded.
    */
   MainImageType UpdateIRISMainImage(
-    GuidedNativeImageIO *nativeIO, MainImageType force_type);
+    GuidedNativeImageIO *nativeIO, MainImageType force_type,
+    CommandType *previewCommand = NULL);
 
   /**
    * Add an overlay image into IRIS. This method is called to load either grey or
@@ -168,7 +177,9 @@ public:
   
   /**
    * Initialize SNAP Image data using region of interest extents, and a new
-   * voxel size.
+   * voxel size. The progress command observes each of the filters involved,
+   * and may cancel the operation by aborting the filter that invokes it. In 
+   * that case itk::ProcessAborted is thrown and no SNAP data is created.
    */
   void InitializeSNAPImageData(const SNAPSegmentationROISettings &roi,
                                CommandType *progressCommand = NULL);
@@ -230,6 +241,17 @@ public:
    */
   void ExportSlice(AnatomicalDirection iSliceAnatomy, const char *file);
 
+  /**
+   * Export all the slices along an anatomical direction as PNG files named
+   * axial0001.png, axial0002.png, etc. in the given directory. The slices 
+   * are composed in software from the display slices of the main image and
+   * the segmentation, one pixel per voxel, without going through OpenGL, and
+   * are encoded on multiple threads. The cursor is restored when done.
+   */
+  void ExportSliceSeries(AnatomicalDirection iSliceAnatomy, const char *dir,
+                         CommandType *progressCommand = NULL)
+    throw(itk::ExceptionObject);
+
   /** Export voxel statistis to a file */
   void ExportSegmentationStatistics(const char *file) 
     throw(itk::ExceptionObject);
@@ -271,11 +293,15 @@ public:
   /**
    * Load the main image from file. You can either specify that the main
    * image is of a given type (grey vs. rgb) or you can let the program 
-   * decide dynamically, based on the number of components in the file
+   * decide dynamically, based on the number of components in the file.
+   * The progress command observes the reading of the file
    */
-  MainImageType LoadMainImage(const char *filename, MainImageType force_type);
+  MainImageType LoadMainImage(const char *filename, MainImageType force_type,
+                              CommandType *previewCommand = NULL,
+                              CommandType *progressCommand = NULL);
 
-  MainImageType LoadOverlayImage(const char *filename, MainImageType force_type);
+  MainImageType LoadOverlayImage(const char *filename, MainImageType force_type,
+                                 CommandType *progressCommand = NULL);
 
   /**
    * This is the most high-level method to load a segmentation image. The
@@ -286,7 +312,8 @@ public:
    * in the ImageIOWizardLogic class!
    *
    */
-  void LoadLabelImageFile(const char *filename);
+  void LoadLabelImageFile(const char *filename, 
+                          CommandType *progressCommand = NULL);
 
   /**
    * Store the current state as an undo point, allowing the user to revert
@@ -343,8 +370,16 @@ private:
   // there is a lot of stuff here that is ambiguous in this way. The manager
   // stores 'deltas', i.e., differences between states of the segmentation
   // image. These deltas are compressed, allowing us to store a bunch of 
-  // undo steps with little cost in performance or memory
+  // undo steps with little cost in performance or memory. The manager also
+  // keeps a compressed copy of the segmentation at the last undo point.
   
   UndoManagerType m_UndoManager;
+
+  // Make the current segmentation the undo point and clear the undo history
+  void ResetUndoState();
+
+  // Cast the native image to the main image type and pass it to IRISImageData
+  void UpdateIRISMainImageData(GuidedNativeImageIO *io, MainImageType type,
+                               const ImageCoordinateGeometry &icg);
 };
 
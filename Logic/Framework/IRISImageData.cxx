@@ -35,50 +35,5 @@
 // ITK Includes
 #include "IRISImageData.h"
 
-void
-IRISImageData
-::SetSegmentationImage(LabelImageType *newLabelImage)
-{
-  // Set the new segmentation image
-  GenericImageData::SetSegmentationImage(newLabelImage);
-  
-  // Update the undo wrapper to match
-  LabelImageWrapper::Iterator itUndo = m_UndoWrapper.GetImageIterator();
-  LabelImageWrapper::ConstIterator itSeg = m_LabelWrapper.GetImageConstIterator();
-
-  while(!itUndo.IsAtEnd())
-    {
-    itUndo.Set(itSeg.Get());
-    ++itUndo;
-    ++itSeg;
-    }
-}
-
-void
-IRISImageData
-::SetGreyImage(GreyImageType *newGreyImage,
-                const ImageCoordinateGeometry &newGeometry,
-                const GreyTypeToNativeFunctor &native)
-{
-  GenericImageData::SetGreyImage(
-    newGreyImage, newGeometry, native);
-  m_UndoWrapper.InitializeToWrapper(&m_LabelWrapper, (LabelType) 0);
-}
-
-void
-IRISImageData
-::SetRGBImage(RGBImageType *newRGBImage,
-              const ImageCoordinateGeometry &newGeometry)
-{
-  GenericImageData::SetRGBImage(newRGBImage, newGeometry);
-  m_UndoWrapper.InitializeToWrapper(&m_LabelWrapper, (LabelType) 0);
-}
-
-void
-IRISImageData
-::UnloadMainImage()
-{
-  m_UndoWrapper.Reset();
-  GenericImageData::UnloadMainImage();
-}
-
+// The segmentation image at the last undo point is not stored here, but in
+// compressed form by the undo manager (see IRISApplication::StoreUndoPoint)
@@ -49,45 +49,6 @@ public:
   IRISImageData(IRISApplication *parent)
     : GenericImageData(parent) {}
   virtual ~IRISImageData() {};
-
-  /**
-   * Access the segmentation image (read only access allowed 
-   * to preserve state)
-   */
-  LabelImageWrapper* GetUndoImage() {
-    assert(m_MainImageWrapper->IsInitialized() && m_UndoWrapper.IsInitialized());
-    return &m_UndoWrapper;
-  }
-
-  /**
-   * We override the parent's SetSegmentationImage in order to initialize the
-   * undo wrapper to match.
-   */
-  void SetSegmentationImage(LabelImageType *newLabelImage);
-
-  void SetGreyImage(
-    GreyImageType *newGreyImage,
-    const ImageCoordinateGeometry &newGeometry,
-    const GreyTypeToNativeFunctor &native);
-
-  void SetRGBImage(RGBImageType *newRGBImage,
-                   const ImageCoordinateGeometry &newGeometry);
-
-  virtual void UnloadMainImage();
-
-protected:
-
-  // Starting with SNAP 1.6, the IRISImageData object will store a second
-  // copy of the segmentation image for the purpose of implementing fast 
-  // undo functionality. This image is used to support situations where we
-  // want to allow multiple updates to the segmentation image between saving
-  // 'undo points'. This is necessary for paintbrush operation, since it would
-  // be too expensive to store an undo point for every movement of the paintbrush
-  // (and it would be difficult for the user too). So this UndoWrapper stores the
-  // segmentation image _at the last undo point_. See IRISApplication::StoreUndoPoint
-  // for details.
-  LabelImageWrapper m_UndoWrapper;
-
 };
 
 #endif
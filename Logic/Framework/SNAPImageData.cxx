@@ -449,7 +449,58 @@ SNAPImageData
   assert(m_LevelSetDriver);
 
   // Pass through to the level set driver
-  m_LevelSetDriver->Run(nIterations);
+  if(m_LevelSetDriver->IsWorkerActive())
+    m_LevelSetDriver->PostCommand(SNAPLevelSetDriver3d::WORKER_STEP, nIterations);
+  else
+    m_LevelSetDriver->Run(nIterations);
+}
+
+void 
+SNAPImageData
+::StartSegmentationWorker()
+{
+  // Should be in level set mode
+  assert(m_LevelSetDriver);
+
+  // The snake wrapper shows the worker's snapshot from now on
+  m_LevelSetDriver->StartWorker();
+  m_SnakeWrapper.SetImage(m_LevelSetDriver->GetSnapshot());
+}
+
+void 
+SNAPImageData
+::StopSegmentationWorker()
+{
+  // Should be in level set mode
+  assert(m_LevelSetDriver);
+
+  // The snake wrapper keeps showing the snapshot, which is now final
+  if(m_LevelSetDriver->IsWorkerActive())
+    m_LevelSetDriver->StopWorker(true);
+}
+
+void 
+SNAPImageData
+::PlaySegmentation(unsigned int nIterations)
+{
+  assert(m_LevelSetDriver && m_LevelSetDriver->IsWorkerActive());
+  m_LevelSetDriver->PostCommand(SNAPLevelSetDriver3d::WORKER_PLAY, nIterations);
+}
+
+void 
+SNAPImageData
+::PauseSegmentation()
+{
+  assert(m_LevelSetDriver && m_LevelSetDriver->IsWorkerActive());
+  m_LevelSetDriver->PostCommand(SNAPLevelSetDriver3d::WORKER_PAUSE);
+}
+
+bool 
+SNAPImageData
+::UpdateSegmentationSnapshot()
+{
+  assert(m_LevelSetDriver && m_LevelSetDriver->IsWorkerActive());
+  return m_LevelSetDriver->UpdateSnapshot();
 }
 
 void 
@@ -460,6 +511,12 @@ SNAPImageData
   assert(m_LevelSetDriver);
 
   // Pass through to the level set driver
+  if(m_LevelSetDriver->IsWorkerActive())
+    {
+    m_LevelSetDriver->PostCommand(SNAPLevelSetDriver3d::WORKER_RESTART);
+    return;
+    }
+
   m_LevelSetDriver->Restart();
 
   // Update the image pointed to by the snake wrapper
@@ -473,6 +530,11 @@ SNAPImageData
   // Should be in level set mode
   assert(m_LevelSetDriver);
 
+  // Stop the worker before the driver goes away. The level set is being 
+  // discarded or has already been brought up to date, so the filter does
+  // not need to run again
+  m_LevelSetDriver->StopWorker(false);
+
   // Delete the level set driver and all the problems that go along with it
   delete m_LevelSetDriver; m_LevelSetDriver = NULL;
 }
@@ -485,13 +547,18 @@ SNAPImageData
   assert(m_LevelSetDriver);
 
   // Pass through to the level set driver
-  m_LevelSetDriver->SetSnakeParameters(parameters);
+  if(m_LevelSetDriver->IsWorkerActive())
+    m_LevelSetDriver->PostParameters(parameters);
+  else
+    m_LevelSetDriver->SetSnakeParameters(parameters);
 }
 
 unsigned int 
 SNAPImageData::
 GetElapsedSegmentationIterations() const
 {
+  if(m_LevelSetDriver->IsWorkerActive())
+    return m_LevelSetDriver->GetSnapshotIterations();
   return m_LevelSetDriver->GetElapsedIterations();
 }
 
@@ -500,6 +567,8 @@ SNAPImageData
 ::GetLevelSetImage()
 {
   assert(m_LevelSetDriver);
+  if(m_LevelSetDriver->IsWorkerActive())
+    return m_LevelSetDriver->GetSnapshot();
   return m_LevelSetDriver->GetCurrentState();
 }
 
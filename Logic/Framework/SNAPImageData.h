@@ -171,6 +171,34 @@ public:
   /** Get the number of elapsed iterations */
   unsigned int GetElapsedSegmentationIterations() const;
 
+  /** 
+   * Move the segmentation to a worker thread. After this call, 
+   * RunSegmentation, RestartSegmentation and SetSegmentationParameters post 
+   * commands to the worker and return right away, and the snake image only
+   * changes in UpdateSegmentationSnapshot(). The worker is stopped when the
+   * segmentation is terminated.
+   */
+  void StartSegmentationWorker();
+
+  /**
+   * Stop the worker thread, if there is one, and bring the snake image fully
+   * up to date. This must be called before the final snake image is read.
+   */
+  void StopSegmentationWorker();
+
+  /** Keep running the segmentation on the worker, nIterations at a time */
+  void PlaySegmentation(unsigned int nIterations);
+
+  /** Pause the segmentation running on the worker */
+  void PauseSegmentation();
+
+  /** 
+   * Bring the snake image up to date with the latest state published by the
+   * worker. Returns true if the snake image has changed. Throws an 
+   * IRISException if the evolution has failed on the worker. 
+   */
+  bool UpdateSegmentationSnapshot();
+
   /** Release the resources associated with the level set segmentation.  This 
    * method must be called once the segmentation pipeline has terminated, or 
    * else it would create a nasty crash */
@@ -34,20 +34,45 @@
 =========================================================================*/
 #include <vector>
 #include <list>
+#include <cstdio>
+#include "itkMultiThreader.h"
+#include "itkImageRegion.h"
 
 
 /**
  * \class UndoDataManager
  * \brief Manages data (delta updates) for undo/redo in itk-snap
+ *
+ * The manager keeps the image at the last undo point (the reference image)
+ * and a list of deltas between successive undo points. The reference image
+ * is stored as independently RLE compressed blocks of voxels, and the deltas
+ * are stored as variable-length encoded runs. Deltas that do not fit into 
+ * the memory budget can be moved to a temporary file. The pixel type must 
+ * be an unsigned integral type.
  */
 template<typename TPixel> class UndoDataManager
 {
 public:
+  typedef UndoDataManager<TPixel> Self;
+
+  /** Regions of the image covered by a delta */
+  typedef itk::ImageRegion<3> RegionType;
+  typedef std::vector<RegionType> RegionList;
+
+  /** Run length encoding: pairs of length and value */
+  typedef std::pair<size_t, TPixel> RLEPair;
+  typedef std::vector<RLEPair> RLEArray;
+
+  /** Compact storage for encoded data */
+  typedef std::vector<unsigned char> ByteArray;
 
   /**
    * The Delta class represents a difference between two images used in
-   * the Undo system. It only supports linear traversal of images and
-   * stores differences in an RLE (run length encoding) format.
+   * the Undo system. It only covers a list of regions of the image, which
+   * are traversed linearly one after the other, and stores differences in
+   * an RLE (run length encoding) format. Once the encoding is finished, the
+   * runs are packed into a byte array, with each length and value written
+   * as a variable-length integer.
    */
   class Delta 
     {
@@ -55,6 +80,9 @@ public:
       Delta()
         {
         m_CurrentLength = 0;
+        m_NumberOfRuns = 0;
+        m_DataSize = 0;
+        m_FileOffset = -1;
         m_UniqueID = m_UniqueIDCounter++;
         }
       
@@ -77,37 +105,116 @@ public:
           }
         }
 
+      /** Encode a run of identical values at once */
+      void EncodeRun(const TPixel &value, size_t length)
+        {
+        if(length == 0)
+          return;
+
+        if(m_CurrentLength > 0 && value == m_LastValue)
+          {
+          m_CurrentLength += length;
+          }
+        else
+          {
+          if(m_CurrentLength > 0)
+            m_Array.push_back(std::make_pair(m_CurrentLength, m_LastValue));
+          m_CurrentLength = length;
+          m_LastValue = value;
+          }
+        }
+
+      /** 
+       * Append the runs of another delta, whose encoding has been finished,
+       * to this delta. Runs with equal values at the seam are merged
+       */
+      void Append(const Delta &other)
+        {
+        RLEArray runs;
+        other.DecodeRuns(runs);
+        for(size_t i = 0; i < runs.size(); i++)
+          EncodeRun(runs[i].second, runs[i].first);
+        }
+
+      /** Pack the runs into the compact representation */
       void FinishEncoding()
         {
         if(m_CurrentLength > 0)
           m_Array.push_back(std::make_pair(m_CurrentLength, m_LastValue));
+        m_CurrentLength = 0;
+
+        m_Data.clear();
+        for(size_t i = 0; i < m_Array.size(); i++)
+          {
+          WriteVarint(m_Data, m_Array[i].first);
+          WriteVarint(m_Data, (size_t) m_Array[i].second);
+          }
+        ByteArray(m_Data).swap(m_Data);
+
+        m_NumberOfRuns = m_Array.size();
+        m_DataSize = m_Data.size();
+        RLEArray().swap(m_Array);
+        }
+
+      /** Unpack the runs. The data must be in memory */
+      void DecodeRuns(RLEArray &runs) const
+        {
+        runs.resize(m_NumberOfRuns);
+        const unsigned char *p = m_DataSize ? &m_Data[0] : NULL;
+        for(size_t i = 0; i < m_NumberOfRuns; i++)
+          {
+          runs[i].first = ReadVarint(p);
+          runs[i].second = (TPixel) ReadVarint(p);
+          }
         }
 
-      size_t GetNumberOfRLEs()
-        { return m_Array.size(); }
+      size_t GetNumberOfRLEs() const
+        { return m_NumberOfRuns; }
 
-      TPixel GetRLEValue(size_t i)
-        { return m_Array[i].second; }
+      /** The number of bytes taken up by the encoded runs */
+      size_t GetDataSize() const
+        { return m_DataSize; }
 
-      size_t GetRLELength(size_t i)
-        { return m_Array[i].first; }
+      /** Whether the encoded runs are in memory or only in the spill file */
+      bool IsInMemory() const
+        { return m_Data.size() == m_DataSize; }
 
       unsigned long GetUniqueID() const
         { return m_UniqueID; }
 
+      const RegionList &GetRegions() const
+        { return m_Regions; }
+
+      void SetRegions(const RegionList &regions)
+        { m_Regions = regions; }
+
     protected:
-      typedef std::pair<size_t, TPixel> RLEPair;
-      typedef std::vector<RLEPair> RLEArray;
+      friend class UndoDataManager<TPixel>;
+
+      // Runs collected during encoding
       RLEArray m_Array;
       size_t m_CurrentLength;
       TPixel m_LastValue;
 
+      // The packed runs, and their position in the spill file (or -1)
+      ByteArray m_Data;
+      size_t m_DataSize, m_NumberOfRuns;
+      long m_FileOffset;
+
+      // The regions of the image that the runs cover
+      RegionList m_Regions;
+
       // Each delta is assigned a unique ID at creation
       unsigned long m_UniqueID;
       static unsigned long m_UniqueIDCounter;
     };
 
+  /**
+   * Create a manager that keeps at least nMinDeltas deltas, and otherwise
+   * keeps the total size of the deltas under nMaxTotalSize bytes
+   */
   UndoDataManager(size_t nMinDeltas, size_t nMaxTotalSize);
+  ~UndoDataManager();
 
   void AppendDelta(Delta *delta);
   void Clear();
@@ -131,6 +238,65 @@ public:
   typedef std::list<unsigned long> StateDescriptor;
   StateDescriptor GetState() const;
 
+  /**
+   * Set the amount of memory (in bytes) that the deltas may take up before 
+   * the older ones are moved to a temporary file. Zero (the default) keeps
+   * all the deltas in memory.
+   */
+  void SetSpillThreshold(size_t nBytes)
+    { m_SpillThreshold = nBytes; }
+
+  size_t GetSpillThreshold() const
+    { return m_SpillThreshold; }
+
+  /**
+   * Set the reference image, i.e., the state of the image at the last undo
+   * point, from an image buffer spanning bufferedRegion. 
+   */
+  void SetReferenceImage(const TPixel *image, const RegionType &bufferedRegion);
+
+  /**
+   * Compute the delta between the current image and the reference image
+   * (current - reference) over a list of regions, and update the reference
+   * image in these regions. The image buffer must match the reference 
+   * image. The voxels are split into contiguous blocks that are encoded in
+   * parallel, and blocks of voxels that have not changed are skipped using
+   * a fast memory comparison. The returned delta is allocated with new and
+   * its encoding is finished.
+   */
+  Delta *EncodeDelta(const TPixel *current, const RegionList &regions);
+
+  /**
+   * Apply a delta to the reference image and copy the modified voxels into
+   * the current image. If forward is true, the delta is added (redo), 
+   * otherwise it is subtracted (undo). The runs are applied in parallel.
+   */
+  void ApplyDelta(Delta *delta, TPixel *current, bool forward);
+
+  /** Write an integer as a sequence of 7-bit groups */
+  static void WriteVarint(ByteArray &data, size_t x)
+    {
+    while(x >= 0x80)
+      {
+      data.push_back((unsigned char)(x | 0x80));
+      x >>= 7;
+      }
+    data.push_back((unsigned char) x);
+    }
+
+  /** Read an integer written by WriteVarint and advance the pointer */
+  static size_t ReadVarint(const unsigned char *&p)
+    {
+    size_t x = 0;
+    for(unsigned int shift = 0; ; shift += 7)
+      {
+      unsigned char c = *p++;
+      x |= ((size_t)(c & 0x7f)) << shift;
+      if(!(c & 0x80))
+        return x;
+      }
+    }
+
 private:
   typedef std::list<Delta *> DList;
   typedef typename DList::iterator DIterator;
@@ -138,4 +304,95 @@ private:
   DList m_DeltaList;
   DIterator m_Position;
   size_t m_TotalSize, m_MinDeltas, m_MaxTotalSize;
+
+  // Spilling of old deltas to a temporary file. The live size counts the
+  // bytes in the file that belong to deltas that have not been deleted
+  FILE *m_SpillFile;
+  size_t m_SpillFileSize, m_SpillFileLiveSize, m_SpillThreshold;
+
+  // Move old deltas to the spill file until the rest fit into memory
+  void SpillDeltas();
+
+  // Read a spilled delta back into memory
+  void LoadDelta(Delta *delta);
+
+  // Rewrite the spill file without the data of deleted deltas
+  void CompactSpillFile();
+
+  // The reference image, as blocks of voxels that are compressed separately
+  enum { REFERENCE_BLOCK_SIZE = 0x4000 };
+  std::vector<ByteArray> m_Reference;
+  RegionType m_ReferenceRegion;
+  size_t m_ReferenceSize;
+
+  // Compress a block of the reference image from an array of voxels
+  void EncodeReferenceBlock(size_t iBlock, const TPixel *values);
+
+  // Decompress a block of the reference image
+  void DecodeReferenceBlock(size_t iBlock, TPixel *values) const;
+
+  // Decompress n voxels of the reference image starting at offset
+  void ReadReference(size_t offset, size_t n, TPixel *values) const;
+
+  // A contiguous range of voxels in the image buffer, and its position in
+  // the sequence of voxels covered by a delta
+  struct Span
+    {
+    size_t ImageOffset, StreamOffset, Length;
+    };
+  typedef std::vector<Span> SpanList;
+
+  static bool SpanImageOffsetLess(const Span &a, const Span &b)
+    { return a.ImageOffset < b.ImageOffset; }
+
+  // Break up a list of regions into spans, merging adjacent spans
+  void ComputeSpans(const RegionList &regions, SpanList &spans) const;
+
+  // Find the blocks of the reference image touched by a list of spans
+  static void ComputeBlocks(const SpanList &spans, std::vector<size_t> &blocks);
+
+  // Find the span that contains a position in the sequence of voxels
+  static size_t FindSpan(const SpanList &spans, size_t pos);
+
+  // The operations performed by threads
+  enum ThreadOperation 
+    {
+    INIT_REFERENCE, READ_REFERENCE, WRITE_REFERENCE, ENCODE_DELTA, APPLY_DELTA
+    };
+
+  // Data shared by the threads
+  struct ThreadData
+    {
+    Self *Manager;
+    ThreadOperation Operation;
+    size_t NumberOfItems;
+    const TPixel *Image;
+    TPixel *Target;
+    TPixel *Stream;
+    const SpanList *Spans;
+    const std::vector<size_t> *Blocks;
+    std::vector<Delta> *BlockDeltas;
+    const RLEArray *Runs;
+    const std::vector<size_t> *RunOffsets;
+    bool Forward;
+    };
+
+  // Split the items (voxels or blocks) between threads and run the operation
+  void RunThreaded(ThreadData &td);
+  static ITK_THREAD_RETURN_TYPE ThreadCallback(void *arg);
+
+  // The operations, each applied to a range of items
+  void ThreadedInitReference(ThreadData *td, size_t iStart, size_t iEnd);
+  void ThreadedReadReference(ThreadData *td, size_t iStart, size_t iEnd);
+  void ThreadedWriteReference(ThreadData *td, size_t iStart, size_t iEnd);
+  void ThreadedEncodeDelta(ThreadData *td, unsigned int iThread,
+                           size_t iStart, size_t iEnd);
+  void ThreadedApplyDelta(ThreadData *td, size_t iStart, size_t iEnd);
+
+  // Compute the number of threads to use for n items of work
+  static unsigned int GetNumberOfThreads(size_t n, size_t nMinPerThread);
+
+  // Not implemented
+  UndoDataManager(const Self &);
+  void operator=(const Self &);
 };
@@ -32,6 +32,9 @@
   PURPOSE.  See the above copyright notices for more information. 
 
 =========================================================================*/
+#include <algorithm>
+#include <cstring>
+#include "IRISException.h"
 
 template<typename TPixel>
 unsigned long 
@@ -45,6 +48,19 @@ UndoDataManager<TPixel>
   this->m_MaxTotalSize = nMaxTotalSize;
   this->m_TotalSize = 0;
   m_Position = m_DeltaList.begin();
+
+  m_SpillFile = NULL;
+  m_SpillFileSize = 0;
+  m_SpillFileLiveSize = 0;
+  m_SpillThreshold = 0;
+  m_ReferenceSize = 0;
+}
+
+template<typename TPixel>
+UndoDataManager<TPixel>
+::~UndoDataManager()
+{
+  Clear();
 }
 
 template<typename TPixel>
@@ -60,6 +76,15 @@ UndoDataManager<TPixel>
     m_Position = m_DeltaList.erase(m_Position);
     }
   m_TotalSize = 0;
+
+  // The temporary file is deleted when it is closed
+  if(m_SpillFile)
+    {
+    fclose(m_SpillFile);
+    m_SpillFile = NULL;
+    m_SpillFileSize = 0;
+    m_SpillFileLiveSize = 0;
+    }
 }
 
 template<typename TPixel>
@@ -72,7 +97,9 @@ UndoDataManager<TPixel>
   // to the end. So that's the loop that we do
   while(m_Position != m_DeltaList.end())
     {
-    m_TotalSize -= (*m_Position)->GetNumberOfRLEs();
+    m_TotalSize -= (*m_Position)->GetDataSize();
+    if((*m_Position)->m_FileOffset >= 0)
+      m_SpillFileLiveSize -= (*m_Position)->GetDataSize();
     delete *m_Position;
     m_Position = m_DeltaList.erase(m_Position);
     }
@@ -80,9 +107,11 @@ UndoDataManager<TPixel>
   // Check whether we need to prune from the back
   DIterator itHead = m_DeltaList.begin();
   while(m_DeltaList.size() > m_MinDeltas 
-    && m_TotalSize + delta->GetNumberOfRLEs() > m_MaxTotalSize)
+    && m_TotalSize + delta->GetDataSize() > m_MaxTotalSize)
     {
-    m_TotalSize -= (*itHead)->GetNumberOfRLEs();
+    m_TotalSize -= (*itHead)->GetDataSize();
+    if((*itHead)->m_FileOffset >= 0)
+      m_SpillFileLiveSize -= (*itHead)->GetDataSize();
     delete *itHead;
     itHead = m_DeltaList.erase(itHead);
     }
@@ -91,7 +120,15 @@ UndoDataManager<TPixel>
   // the current delta to it;
   m_DeltaList.push_back(delta);
   m_Position = m_DeltaList.end();
-  m_TotalSize += delta->GetNumberOfRLEs();
+  m_TotalSize += delta->GetDataSize();
+
+  // The pruned deltas leave holes in the spill file, get rid of them once
+  // they take up more space than the spilled deltas that are still around
+  if(m_SpillFileSize - m_SpillFileLiveSize > m_SpillFileLiveSize)
+    CompactSpillFile();
+
+  // Move old deltas out of memory
+  SpillDeltas();
 }
 
 template<typename TPixel>
@@ -113,8 +150,13 @@ UndoDataManager<TPixel>
   // Move the position one delta to the beginning
   m_Position--;
 
+  // Make sure the delta is in memory
+  Delta *del = *m_Position;
+  LoadDelta(del);
+  SpillDeltas();
+
   // Return the current delta
-  return *m_Position;
+  return del;
 }
 
 template<typename TPixel>
@@ -139,6 +181,10 @@ UndoDataManager<TPixel>
   // Move the position one delta to the end
   m_Position++;
 
+  // Make sure the delta is in memory
+  LoadDelta(del);
+  SpillDeltas();
+
   // Return the current delta
   return del;
 }
@@ -156,3 +202,661 @@ UndoDataManager<TPixel>
     }
   return sd;
 }
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::SpillDeltas()
+{
+  if(m_SpillThreshold == 0)
+    return;
+
+  // Measure the memory taken up by the deltas
+  size_t nInMemory = 0;
+  for(DIterator it = m_DeltaList.begin(); it != m_DeltaList.end(); ++it)
+    if((*it)->IsInMemory())
+      nInMemory += (*it)->GetDataSize();
+
+  // Move the oldest deltas out of memory, but keep the two deltas on either
+  // side of the current position, since they are needed first
+  for(DIterator it = m_DeltaList.begin(); 
+    it != m_DeltaList.end() && nInMemory > m_SpillThreshold; ++it)
+    {
+    Delta *del = *it;
+    DIterator itNext = it; ++itNext;
+    if(it == m_Position || itNext == m_Position)
+      continue;
+    if(!del->IsInMemory() || del->GetDataSize() == 0)
+      continue;
+
+    // A delta that was loaded back from the file is still there
+    if(del->m_FileOffset < 0)
+      {
+      if(!m_SpillFile)
+        m_SpillFile = tmpfile();
+
+      // If the file can not be written, the deltas just stay in memory
+      if(!m_SpillFile || fseek(m_SpillFile, 0, SEEK_END) != 0)
+        return;
+
+      long offset = ftell(m_SpillFile);
+      if(offset < 0 || fwrite(&del->m_Data[0], 1, del->GetDataSize(), 
+          m_SpillFile) != del->GetDataSize())
+        return;
+
+      del->m_FileOffset = offset;
+      m_SpillFileSize += del->GetDataSize();
+      m_SpillFileLiveSize += del->GetDataSize();
+      }
+
+    ByteArray().swap(del->m_Data);
+    nInMemory -= del->GetDataSize();
+    }
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::LoadDelta(Delta *delta)
+{
+  if(delta->IsInMemory())
+    return;
+
+  delta->m_Data.resize(delta->GetDataSize());
+  if(fseek(m_SpillFile, delta->m_FileOffset, SEEK_SET) != 0 ||
+    fread(&delta->m_Data[0], 1, delta->GetDataSize(), m_SpillFile) 
+      != delta->GetDataSize())
+    {
+    delta->m_Data.clear();
+    throw IRISExceptionIO("Unable to read undo data from the temporary file");
+    }
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::CompactSpillFile()
+{
+  FILE *fNew = tmpfile();
+  if(!fNew)
+    return;
+
+  // Copy the data of the deltas that are still around, one at a time. The
+  // new offsets only take effect once all the data has been copied
+  std::vector<long> offsets;
+  size_t nNewSize = 0;
+  bool ok = true;
+  for(DIterator it = m_DeltaList.begin(); ok && it != m_DeltaList.end(); ++it)
+    {
+    Delta *del = *it;
+    if(del->m_FileOffset < 0)
+      continue;
+
+    bool wasInMemory = del->IsInMemory();
+    LoadDelta(del);
+
+    long offset = ftell(fNew);
+    ok = offset >= 0 && fwrite(&del->m_Data[0], 1, del->GetDataSize(), fNew) 
+      == del->GetDataSize();
+    offsets.push_back(offset);
+    nNewSize += del->GetDataSize();
+
+    if(!wasInMemory)
+      ByteArray().swap(del->m_Data);
+    }
+
+  // On failure, keep using the old file
+  if(!ok)
+    {
+    fclose(fNew);
+    return;
+    }
+
+  size_t k = 0;
+  for(DIterator it = m_DeltaList.begin(); it != m_DeltaList.end(); ++it)
+    if((*it)->m_FileOffset >= 0)
+      (*it)->m_FileOffset = offsets[k++];
+
+  fclose(m_SpillFile);
+  m_SpillFile = fNew;
+  m_SpillFileSize = nNewSize;
+  m_SpillFileLiveSize = nNewSize;
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::EncodeReferenceBlock(size_t iBlock, const TPixel *values)
+{
+  size_t iStart = iBlock * REFERENCE_BLOCK_SIZE;
+  size_t n = std::min((size_t) REFERENCE_BLOCK_SIZE, m_ReferenceSize - iStart);
+
+  ByteArray data;
+  for(size_t i = 0; i < n; )
+    {
+    size_t j = i + 1;
+    while(j < n && values[j] == values[i])
+      j++;
+    WriteVarint(data, j - i);
+    WriteVarint(data, (size_t) values[i]);
+    i = j;
+    }
+
+  // Copying trims the excess capacity
+  ByteArray(data).swap(m_Reference[iBlock]);
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::DecodeReferenceBlock(size_t iBlock, TPixel *values) const
+{
+  size_t iStart = iBlock * REFERENCE_BLOCK_SIZE;
+  size_t n = std::min((size_t) REFERENCE_BLOCK_SIZE, m_ReferenceSize - iStart);
+
+  const unsigned char *p = &m_Reference[iBlock][0];
+  for(size_t i = 0; i < n; )
+    {
+    size_t len = ReadVarint(p);
+    TPixel value = (TPixel) ReadVarint(p);
+    std::fill(values + i, values + i + len, value);
+    i += len;
+    }
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::ReadReference(size_t offset, size_t n, TPixel *values) const
+{
+  while(n > 0)
+    {
+    // The part of the range that falls into the current block
+    size_t iBlock = offset / REFERENCE_BLOCK_SIZE;
+    size_t iFirst = offset - iBlock * REFERENCE_BLOCK_SIZE;
+    size_t iLast = std::min(iFirst + n, (size_t) REFERENCE_BLOCK_SIZE);
+
+    // Walk the runs of the block, skipping those before the range
+    const unsigned char *p = &m_Reference[iBlock][0];
+    for(size_t pos = 0; pos < iLast; )
+      {
+      size_t len = ReadVarint(p);
+      TPixel value = (TPixel) ReadVarint(p);
+      size_t a = std::max(pos, iFirst), b = std::min(pos + len, iLast);
+      if(a < b)
+        {
+        std::fill(values, values + (b - a), value);
+        values += b - a;
+        }
+      pos += len;
+      }
+
+    offset += iLast - iFirst;
+    n -= iLast - iFirst;
+    }
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::SetReferenceImage(const TPixel *image, const RegionType &bufferedRegion)
+{
+  m_ReferenceRegion = bufferedRegion;
+  m_ReferenceSize = bufferedRegion.GetNumberOfPixels();
+
+  size_t nBlocks = 
+    (m_ReferenceSize + REFERENCE_BLOCK_SIZE - 1) / REFERENCE_BLOCK_SIZE;
+  std::vector<ByteArray>(nBlocks).swap(m_Reference);
+
+  // Compress the blocks in parallel
+  ThreadData td;
+  td.Manager = this;
+  td.Operation = INIT_REFERENCE;
+  td.NumberOfItems = nBlocks;
+  td.Image = image;
+  RunThreaded(td);
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::ComputeSpans(const RegionList &regions, SpanList &spans) const
+{
+  // The strides of the image buffer
+  size_t nx = m_ReferenceRegion.GetSize(0);
+  size_t nxy = nx * m_ReferenceRegion.GetSize(1);
+
+  // Each line of each region is a span. Lines that follow each other in
+  // memory are joined right away
+  SpanList lines;
+  for(size_t i = 0; i < regions.size(); i++)
+    {
+    const RegionType &r = regions[i];
+    if(r.GetNumberOfPixels() == 0)
+      continue;
+
+    // Position of the region relative to the buffer
+    size_t x0 = r.GetIndex(0) - m_ReferenceRegion.GetIndex(0);
+    size_t y0 = r.GetIndex(1) - m_ReferenceRegion.GetIndex(1);
+    size_t z0 = r.GetIndex(2) - m_ReferenceRegion.GetIndex(2);
+
+    for(size_t z = z0; z < z0 + r.GetSize(2); z++)
+      {
+      for(size_t y = y0; y < y0 + r.GetSize(1); y++)
+        {
+        Span line;
+        line.ImageOffset = z * nxy + y * nx + x0;
+        line.StreamOffset = 0;
+        line.Length = r.GetSize(0);
+        if(lines.size() && 
+          lines.back().ImageOffset + lines.back().Length == line.ImageOffset)
+          lines.back().Length += line.Length;
+        else
+          lines.push_back(line);
+        }
+      }
+    }
+
+  // The regions may overlap, but every voxel must be visited only once, 
+  // because blocks of voxels are encoded concurrently. So the lines are 
+  // sorted in memory order and overlapping lines are merged
+  std::sort(lines.begin(), lines.end(), &Self::SpanImageOffsetLess);
+
+  spans.clear();
+  for(size_t i = 0; i < lines.size(); i++)
+    {
+    const Span &line = lines[i];
+    if(spans.size() && 
+      spans.back().ImageOffset + spans.back().Length >= line.ImageOffset)
+      {
+      size_t end = std::max(
+        spans.back().ImageOffset + spans.back().Length,
+        line.ImageOffset + line.Length);
+      spans.back().Length = end - spans.back().ImageOffset;
+      }
+    else
+      {
+      spans.push_back(line);
+      }
+    }
+
+  // Assign the position of each span in the sequence of covered voxels
+  size_t pos = 0;
+  for(size_t i = 0; i < spans.size(); i++)
+    {
+    spans[i].StreamOffset = pos;
+    pos += spans[i].Length;
+    }
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::ComputeBlocks(const SpanList &spans, std::vector<size_t> &blocks)
+{
+  // The spans are in memory order, so the blocks come out sorted
+  blocks.clear();
+  for(size_t i = 0; i < spans.size(); i++)
+    {
+    size_t b0 = spans[i].ImageOffset / REFERENCE_BLOCK_SIZE;
+    size_t b1 = (spans[i].ImageOffset + spans[i].Length - 1) 
+      / REFERENCE_BLOCK_SIZE;
+    for(size_t b = b0; b <= b1; b++)
+      if(blocks.empty() || blocks.back() < b)
+        blocks.push_back(b);
+    }
+}
+
+template<typename TPixel>
+size_t
+UndoDataManager<TPixel>
+::FindSpan(const SpanList &spans, size_t pos)
+{
+  // Binary search for the last span that starts at or before pos
+  size_t lo = 0, hi = spans.size();
+  while(hi - lo > 1)
+    {
+    size_t mid = (lo + hi) / 2;
+    if(spans[mid].StreamOffset <= pos)
+      lo = mid;
+    else
+      hi = mid;
+    }
+  return lo;
+}
+
+template<typename TPixel>
+unsigned int
+UndoDataManager<TPixel>
+::GetNumberOfThreads(size_t n, size_t nMinPerThread)
+{
+  // Don't bother with threads for small jobs: each thread should get enough
+  // work to make up for the cost of starting it
+  size_t nThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  nThreads = std::min(nThreads, n / nMinPerThread);
+  return (unsigned int) std::max(nThreads, (size_t) 1);
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::RunThreaded(ThreadData &td)
+{
+  // Operations on blocks of the reference image get fewer items per thread
+  bool onBlocks = 
+    td.Operation == INIT_REFERENCE || td.Operation == WRITE_REFERENCE;
+  unsigned int nThreads = 
+    GetNumberOfThreads(td.NumberOfItems, onBlocks ? 4 : 0x10000);
+
+  if(td.Operation == ENCODE_DELTA)
+    td.BlockDeltas->resize(nThreads);
+
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads(nThreads);
+  threader->SetSingleMethod(&Self::ThreadCallback, &td);
+  threader->SingleMethodExecute();
+}
+
+template<typename TPixel>
+ITK_THREAD_RETURN_TYPE
+UndoDataManager<TPixel>
+::ThreadCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info = 
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  ThreadData *td = static_cast<ThreadData *>(info->UserData);
+
+  // Get the range of items handled by this thread
+  size_t nThreads = info->NumberOfThreads, iThread = info->ThreadID;
+  size_t iStart = (td->NumberOfItems * iThread) / nThreads;
+  size_t iEnd = (td->NumberOfItems * (iThread + 1)) / nThreads;
+
+  Self *self = td->Manager;
+  switch(td->Operation)
+    {
+    case INIT_REFERENCE: 
+      self->ThreadedInitReference(td, iStart, iEnd); 
+      break;
+    case READ_REFERENCE: 
+      self->ThreadedReadReference(td, iStart, iEnd); 
+      break;
+    case WRITE_REFERENCE: 
+      self->ThreadedWriteReference(td, iStart, iEnd); 
+      break;
+    case ENCODE_DELTA: 
+      self->ThreadedEncodeDelta(td, iThread, iStart, iEnd); 
+      break;
+    case APPLY_DELTA: 
+      self->ThreadedApplyDelta(td, iStart, iEnd); 
+      break;
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::ThreadedInitReference(ThreadData *td, size_t iStart, size_t iEnd)
+{
+  for(size_t b = iStart; b < iEnd; b++)
+    EncodeReferenceBlock(b, td->Image + b * REFERENCE_BLOCK_SIZE);
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::ThreadedReadReference(ThreadData *td, size_t iStart, size_t iEnd)
+{
+  // Decompress the reference image into the stream, span by span
+  const SpanList &spans = *td->Spans;
+  for(size_t k = FindSpan(spans, iStart), pos = iStart; pos < iEnd; k++)
+    {
+    const Span &span = spans[k];
+    size_t pEnd = std::min(iEnd, span.StreamOffset + span.Length);
+    ReadReference(span.ImageOffset + (pos - span.StreamOffset), pEnd - pos,
+                  td->Stream + pos);
+    pos = pEnd;
+    }
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::ThreadedWriteReference(ThreadData *td, size_t iStart, size_t iEnd)
+{
+  // Each block of the reference image that the spans touch is decompressed,
+  // overwritten with the stream and compressed again
+  const SpanList &spans = *td->Spans;
+  std::vector<TPixel> values(REFERENCE_BLOCK_SIZE);
+  for(size_t i = iStart; i < iEnd; i++)
+    {
+    size_t iBlock = (*td->Blocks)[i];
+    size_t bStart = iBlock * REFERENCE_BLOCK_SIZE;
+    size_t bEnd = std::min(bStart + REFERENCE_BLOCK_SIZE, m_ReferenceSize);
+    DecodeReferenceBlock(iBlock, &values[0]);
+
+    // Find the first span that ends inside of the block
+    size_t lo = 0, hi = spans.size();
+    while(lo < hi)
+      {
+      size_t mid = (lo + hi) / 2;
+      if(spans[mid].ImageOffset + spans[mid].Length <= bStart)
+        lo = mid + 1;
+      else
+        hi = mid;
+      }
+
+    for(size_t k = lo; k < spans.size() && spans[k].ImageOffset < bEnd; k++)
+      {
+      const Span &span = spans[k];
+      size_t a = std::max(span.ImageOffset, bStart);
+      size_t b = std::min(span.ImageOffset + span.Length, bEnd);
+      const TPixel *src = td->Stream + span.StreamOffset + (a - span.ImageOffset);
+      std::copy(src, src + (b - a), values.begin() + (a - bStart));
+      }
+
+    EncodeReferenceBlock(iBlock, &values[0]);
+    }
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::ThreadedEncodeDelta(ThreadData *td, unsigned int iThread,
+                      size_t iStart, size_t iEnd)
+{
+  const TPixel *current = td->Image;
+  TPixel *reference = td->Stream;
+  Delta &delta = (*td->BlockDeltas)[iThread];
+
+  // Most of the image is unchanged between undo points. Such voxels are
+  // found by comparing whole blocks of memory, which is much faster than 
+  // encoding the differences voxel by voxel. The stream of reference values
+  // is updated to the current values.
+  const size_t nBlock = 64;
+  const SpanList &spans = *td->Spans;
+  for(size_t k = FindSpan(spans, iStart), pos = iStart; pos < iEnd; k++)
+    {
+    // The part of the span that belongs to this thread
+    const Span &span = spans[k];
+    size_t pEnd = std::min(iEnd, span.StreamOffset + span.Length);
+    size_t iImage = span.ImageOffset + (pos - span.StreamOffset);
+
+    for(; pos < pEnd; pos += nBlock, iImage += nBlock)
+      {
+      size_t n = std::min(nBlock, pEnd - pos);
+      const TPixel *pCur = current + iImage;
+      TPixel *pRef = reference + pos;
+      if(memcmp(pCur, pRef, n * sizeof(TPixel)) == 0)
+        {
+        delta.EncodeRun(TPixel(0), n);
+        }
+      else
+        {
+        for(size_t j = 0; j < n; j++)
+          {
+          TPixel vSrc = pCur[j], vDst = pRef[j];
+          delta.Encode(vSrc - vDst);
+          pRef[j] = vSrc;
+          }
+        }
+      }
+    pos = pEnd;
+    }
+
+  delta.FinishEncoding();
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::ThreadedApplyDelta(ThreadData *td, size_t iStart, size_t iEnd)
+{
+  // Find the run that contains the first voxel of the range
+  const std::vector<size_t> &offsets = *td->RunOffsets;
+  const RLEArray &runs = *td->Runs;
+  size_t k = (std::upper_bound(offsets.begin(), offsets.end(), iStart)
+    - offsets.begin()) - 1;
+
+  // The runs are visited in order, so the span only moves forward
+  const SpanList &spans = *td->Spans;
+  size_t iSpan = FindSpan(spans, iStart);
+
+  for(; k < runs.size() && offsets[k] < iEnd; k++)
+    {
+    // Runs with zero difference are skipped altogether
+    TPixel d = runs[k].second;
+    if(d == 0)
+      continue;
+
+    // Apply the part of the run that belongs to this thread, span by span
+    size_t pos = std::max(offsets[k], iStart);
+    size_t pRunEnd = std::min(offsets[k+1], iEnd);
+    while(pos < pRunEnd)
+      {
+      while(spans[iSpan].StreamOffset + spans[iSpan].Length <= pos)
+        iSpan++;
+
+      const Span &span = spans[iSpan];
+      size_t pEnd = std::min(pRunEnd, span.StreamOffset + span.Length);
+      TPixel *pRef = td->Stream + pos;
+      TPixel *pTrg = td->Target + span.ImageOffset + (pos - span.StreamOffset);
+      size_t n = pEnd - pos;
+
+      if(td->Forward)
+        {
+        for(size_t j = 0; j < n; j++)
+          {
+          pRef[j] += d;
+          pTrg[j] = pRef[j];
+          }
+        }
+      else
+        {
+        for(size_t j = 0; j < n; j++)
+          {
+          pRef[j] -= d;
+          pTrg[j] = pRef[j];
+          }
+        }
+      pos = pEnd;
+      }
+    }
+}
+
+template<typename TPixel>
+typename UndoDataManager<TPixel>::Delta *
+UndoDataManager<TPixel>
+::EncodeDelta(const TPixel *current, const RegionList &regions)
+{
+  // Find the parts of the image buffer covered by the regions
+  SpanList spans;
+  ComputeSpans(regions, spans);
+  size_t n = spans.size() ? spans.back().StreamOffset + spans.back().Length : 0;
+
+  // Find the blocks of the reference image that the spans touch
+  std::vector<size_t> blocks;
+  ComputeBlocks(spans, blocks);
+
+  // The reference values in the regions, decompressed
+  std::vector<TPixel> stream(n);
+  std::vector<Delta> blockDeltas;
+
+  ThreadData td;
+  td.Manager = this;
+  td.Image = current;
+  td.Stream = n ? &stream[0] : NULL;
+  td.Spans = &spans;
+  td.Blocks = &blocks;
+  td.BlockDeltas = &blockDeltas;
+
+  td.Operation = READ_REFERENCE;
+  td.NumberOfItems = n;
+  RunThreaded(td);
+
+  // Each thread encodes its own range into a separate delta
+  td.Operation = ENCODE_DELTA;
+  td.NumberOfItems = n;
+  RunThreaded(td);
+
+  // The stream now holds the current values, which become the reference
+  td.Operation = WRITE_REFERENCE;
+  td.NumberOfItems = blocks.size();
+  RunThreaded(td);
+
+  // Stitch the deltas together
+  Delta *delta = new Delta();
+  for(size_t i = 0; i < blockDeltas.size(); i++)
+    delta->Append(blockDeltas[i]);
+  delta->FinishEncoding();
+  delta->SetRegions(regions);
+
+  return delta;
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>
+::ApplyDelta(Delta *delta, TPixel *current, bool forward)
+{
+  // Find the parts of the image buffer covered by the delta
+  SpanList spans;
+  ComputeSpans(delta->GetRegions(), spans);
+  size_t n = spans.size() ? spans.back().StreamOffset + spans.back().Length : 0;
+
+  // Find the blocks of the reference image that the spans touch
+  std::vector<size_t> blocks;
+  ComputeBlocks(spans, blocks);
+
+  // Compute the position of each run in the sequence of covered voxels
+  RLEArray runs;
+  delta->DecodeRuns(runs);
+  std::vector<size_t> offsets(runs.size() + 1, 0);
+  for(size_t i = 0; i < runs.size(); i++)
+    offsets[i+1] = offsets[i] + runs[i].first;
+
+  std::vector<TPixel> stream(n);
+
+  ThreadData td;
+  td.Manager = this;
+  td.Target = current;
+  td.Stream = n ? &stream[0] : NULL;
+  td.Spans = &spans;
+  td.Blocks = &blocks;
+  td.Runs = &runs;
+  td.RunOffsets = &offsets;
+  td.Forward = forward;
+
+  td.Operation = READ_REFERENCE;
+  td.NumberOfItems = n;
+  RunThreaded(td);
+
+  td.Operation = APPLY_DELTA;
+  td.NumberOfItems = n;
+  RunThreaded(td);
+
+  td.Operation = WRITE_REFERENCE;
+  td.NumberOfItems = blocks.size();
+  RunThreaded(td);
+}
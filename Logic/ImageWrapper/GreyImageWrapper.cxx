@@ -139,8 +139,10 @@ void GreyImageWrapper
     m_IntensityFunctor.SetInputRange(iMin, iMax);
     }
     
-  // Set the active range of the cache
+  // Set the active range of the cache, and rebuild it now rather than on 
+  // the first lookup made while a slice is being mapped
   m_IntensityMapCache->SetEvaluationRange(iMin,iMax);
+  m_IntensityMapCache->ComputeCache();
 
   // Dirty the intensity filters
   for(unsigned int i=0;i<3;i++)
@@ -58,11 +58,26 @@
 #include "itkImageIOFactory.h"
 #include "itkGDCMSeriesFileNames.h"
 #include "itkImageToVectorImageFilter.h"
+#include "itkImportImageContainer.h"
+#include <limits>
+#include <algorithm>
+#include <fstream>
 #include "itkImageFileReader.h"
 
 #include "itkMinimumMaximumImageCalculator.h"
 #include "itkShiftScaleImageFilter.h"
 #include "itkNumericTraits.h"
+#include "itkByteSwapper.h"
+#include "itkMultiThreader.h"
+#include "itkSimpleFastMutexLock.h"
+#include "AllPurposeProgressAccumulator.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 using namespace std;
@@ -118,6 +133,7 @@ GuidedNativeImageIO
   m_NativeFileName = "";
   m_NativeByteOrder = itk::ImageIOBase::OrderNotApplicable;
   m_NativeSizeInBytes = 0;
+  m_DataOffset = -1;
 }
 
 GuidedNativeImageIO::FileFormat 
@@ -164,6 +180,7 @@ GuidedNativeImageIO
   
   // Set the header size
   rawIO->SetHeaderSize(folder["HeaderSize"][0]);
+  m_DataOffset = folder["HeaderSize"][0];
 
   // Read the dimensions and other stuff from the registry
   Vector3i dims = folder["Dimensions"][Vector3i(0)];
@@ -201,6 +218,7 @@ GuidedNativeImageIO
 {
   // Get the format specified in the folder
   m_FileFormat = GetFileFormat(folder);
+  m_DataOffset = -1;
 
   // Choose the approach based on the file format
   switch(m_FileFormat)
@@ -262,7 +280,8 @@ GuidedNativeImageIO
 
 void
 GuidedNativeImageIO
-::ReadNativeImage(const char *FileName, Registry &folder)
+::ReadNativeImage(const char *FileName, Registry &folder,
+                  itk::Command *progressCommand)
 {
   // Create the header corresponding to the current image type
   CreateImageIO(FileName, folder, true);
@@ -305,21 +324,27 @@ GuidedNativeImageIO
     {
     m_IOBase->SetFileName(FileName);
     m_IOBase->ReadImageInformation();
+
+    // Uncompressed VoxBo files can be used in place
+    itk::VoxBoCUBImageIO *cubIO = 
+      dynamic_cast<itk::VoxBoCUBImageIO *>(m_IOBase.GetPointer());
+    if(cubIO)
+      m_DataOffset = cubIO->GetDataOffset();
     }
 
   // Based on the component type, read image in native mode
   switch(m_IOBase->GetComponentType()) 
     {
-    case itk::ImageIOBase::UCHAR:  DoReadNative<unsigned char>(FileName, folder);  break;
-    case itk::ImageIOBase::CHAR:   DoReadNative<signed char>(FileName, folder);    break;
-    case itk::ImageIOBase::USHORT: DoReadNative<unsigned short>(FileName, folder); break;
-    case itk::ImageIOBase::SHORT:  DoReadNative<signed short>(FileName, folder);   break;
-    case itk::ImageIOBase::UINT:   DoReadNative<unsigned int>(FileName, folder);   break;
-    case itk::ImageIOBase::INT:    DoReadNative<signed int>(FileName, folder);     break;
-    case itk::ImageIOBase::ULONG:  DoReadNative<unsigned long>(FileName, folder);  break;
-    case itk::ImageIOBase::LONG:   DoReadNative<signed long>(FileName, folder);    break;
-    case itk::ImageIOBase::FLOAT:  DoReadNative<float>(FileName, folder);          break;
-    case itk::ImageIOBase::DOUBLE: DoReadNative<double>(FileName, folder);         break;
+    case itk::ImageIOBase::UCHAR:  DoReadNative<unsigned char>(FileName, folder, progressCommand);    break;
+    case itk::ImageIOBase::CHAR:   DoReadNative<signed char>(FileName, folder, progressCommand);      break;
+    case itk::ImageIOBase::USHORT: DoReadNative<unsigned short>(FileName, folder, progressCommand);   break;
+    case itk::ImageIOBase::SHORT:  DoReadNative<signed short>(FileName, folder, progressCommand);     break;
+    case itk::ImageIOBase::UINT:   DoReadNative<unsigned int>(FileName, folder, progressCommand);     break;
+    case itk::ImageIOBase::INT:    DoReadNative<signed int>(FileName, folder, progressCommand);       break;
+    case itk::ImageIOBase::ULONG:  DoReadNative<unsigned long>(FileName, folder, progressCommand);    break;
+    case itk::ImageIOBase::LONG:   DoReadNative<signed long>(FileName, folder, progressCommand);      break;
+    case itk::ImageIOBase::FLOAT:  DoReadNative<float>(FileName, folder, progressCommand);            break;
+    case itk::ImageIOBase::DOUBLE: DoReadNative<double>(FileName, folder, progressCommand);           break;
     default: 
       throw itk::ExceptionObject("Unknown Pixel Type when reading image");
     }
@@ -337,13 +362,20 @@ GuidedNativeImageIO
 template<class TScalar>
 void
 GuidedNativeImageIO
-::DoReadNative(const char *FileName, Registry &folder)
+::DoReadNative(const char *FileName, Registry &folder,
+               itk::Command *progressCommand)
 {
   // Define the image type of interest
   typedef itk::VectorImage<TScalar, 3> NativeImageType;
 
-  // There is a special handler for the DICOM case!
-  if(m_FileFormat == FORMAT_DICOM && m_DICOMFiles.size() > 1)
+  // There is a special handler for the DICOM case! The slices are read in
+  // parallel when possible, and otherwise by the series reader
+  bool isSeries = (m_FileFormat == FORMAT_DICOM && m_DICOMFiles.size() > 1);
+  if(isSeries && DoReadDICOMSeries<TScalar>(progressCommand))
+    {
+    // The native image has been filled in
+    }
+  else if(isSeries)
     {
     // It seems that ITK can't yet read DICOM into a VectorImage. 
     typedef itk::OrientedImage<TScalar, 3> GreyImageType;
@@ -432,12 +464,16 @@ GuidedNativeImageIO
     m_NativeImage = image;
     */
 
-    typedef itk::ImageFileReader<NativeImageType> ReaderType;
-    typename ReaderType::Pointer reader = ReaderType::New();
-    reader->SetFileName(FileName);
-    reader->SetImageIO(m_IOBase);
-    reader->Update();
-    m_NativeImage = reader->GetOutput();
+    // Raw and VoxBo files may be mapped into memory rather than read
+    if(!DoMapNative<TScalar>(FileName))
+      {
+      typedef itk::ImageFileReader<NativeImageType> ReaderType;
+      typename ReaderType::Pointer reader = ReaderType::New();
+      reader->SetFileName(FileName);
+      reader->SetImageIO(m_IOBase);
+      reader->Update();
+      m_NativeImage = reader->GetOutput();
+      }
     }   
 
   // Disconnect the image from the readers, allowing them to be deleted
@@ -467,6 +503,580 @@ GuidedNativeImageIO
     }
 }
 
+// Data shared by the threads reading the slices of a DICOM series
+class DICOMSeriesThreadData
+{
+public:
+  // The slice files, and an IO object for each thread
+  const std::vector<std::string> *Files;
+  std::vector<itk::ImageIOBase::Pointer> IO;
+
+  // The expected slice layout, and the buffer of the volume
+  itk::ImageIOBase::IOComponentType ComponentType;
+  size_t Components, Width, Height, SliceBytes;
+  char *Buffer;
+
+  // The next slice to read, and the number of slices read
+  size_t NextSlice, SlicesDone;
+  bool Failed;
+
+  // Progress, reported on the calling thread only
+  AllPurposeProgressAccumulator *Progress;
+
+  itk::SimpleFastMutexLock Mutex;
+
+  // GDCM 1.x keeps its dictionaries and parser state in globals, and is not
+  // safe to call from several threads at once. All calls into GDCMImageIO 
+  // hold this lock, so only the reading of the files from disk is parallel
+  itk::SimpleFastMutexLock GDCMMutex;
+
+  // Get the next slice to read. Returns false when there are none left
+  bool GetNextSlice(size_t &slice)
+    {
+    Mutex.Lock();
+    bool ok = NextSlice < Files->size() && !Failed;
+    if(ok)
+      slice = NextSlice++;
+    Mutex.Unlock();
+    return ok;
+    }
+
+  // Read a slice into its place in the volume
+  bool ReadSlice(itk::ImageIOBase *io, size_t slice);
+  bool ReadSliceWithGDCM(itk::ImageIOBase *io, size_t slice);
+
+  // Read a slice file through once, so that it is in the system's file 
+  // cache by the time GDCM parses it
+  void PrefetchSlice(size_t slice);
+
+  static ITK_THREAD_RETURN_TYPE ThreadCallback(void *arg);
+};
+
+void
+DICOMSeriesThreadData
+::PrefetchSlice(size_t slice)
+{
+  std::ifstream fin((*Files)[slice].c_str(), std::ios::in | std::ios::binary);
+  char chunk[65536];
+  while(fin.read(chunk, sizeof(chunk)))
+    {}
+}
+
+bool
+DICOMSeriesThreadData
+::ReadSlice(itk::ImageIOBase *io, size_t slice)
+{
+  PrefetchSlice(slice);
+
+  // GDCM is only entered by one thread at a time
+  GDCMMutex.Lock();
+  bool ok = false;
+  try
+    {
+    ok = ReadSliceWithGDCM(io, slice);
+    }
+  catch(...)
+    {
+    GDCMMutex.Unlock();
+    throw;
+    }
+  GDCMMutex.Unlock();
+  return ok;
+}
+
+bool
+DICOMSeriesThreadData
+::ReadSliceWithGDCM(itk::ImageIOBase *io, size_t slice)
+{
+  io->SetFileName((*Files)[slice].c_str());
+  io->ReadImageInformation();
+
+  // The slice must have the layout of the first slice
+  if(io->GetComponentType() != ComponentType || 
+    io->GetNumberOfComponents() != Components ||
+    io->GetNumberOfDimensions() != 3 || io->GetDimensions(0) != Width || 
+    io->GetDimensions(1) != Height || io->GetDimensions(2) != 1)
+    return false;
+
+  itk::ImageIORegion ioRegion(3);
+  for(unsigned int d = 0; d < 3; d++)
+    {
+    ioRegion.SetIndex(d, 0);
+    ioRegion.SetSize(d, io->GetDimensions(d));
+    }
+  io->SetIORegion(ioRegion);
+  io->Read(Buffer + slice * SliceBytes);
+  return true;
+}
+
+ITK_THREAD_RETURN_TYPE
+DICOMSeriesThreadData
+::ThreadCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info = 
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  DICOMSeriesThreadData *td = 
+    static_cast<DICOMSeriesThreadData *>(info->UserData);
+  itk::ImageIOBase *io = td->IO[info->ThreadID];
+
+  size_t slice;
+  while(td->GetNextSlice(slice))
+    {
+    bool ok = false;
+    try 
+      {
+      ok = td->ReadSlice(io, slice);
+      }
+    catch(...)
+      {
+      ok = false;
+      }
+
+    td->Mutex.Lock();
+    if(!ok)
+      td->Failed = true;
+    size_t done = ++td->SlicesDone;
+    td->Mutex.Unlock();
+
+    if(info->ThreadID == 0 && td->Progress)
+      td->Progress->UpdateProgress(done * 1.0f / td->Files->size());
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template<class TScalar>
+bool
+GuidedNativeImageIO
+::DoReadDICOMSeries(itk::Command *progressCommand)
+{
+  typedef itk::VectorImage<TScalar, 3> NativeImageType;
+
+  // The first slice has been read by ReadImageInformation. Its geometry 
+  // determines the geometry of the volume
+  IOBase *first = m_IOBase;
+  size_t nSlices = m_DICOMFiles.size();
+  if(first->GetNumberOfDimensions() != 3 || first->GetDimensions(2) != 1)
+    return false;
+
+  // Read the position of the last slice to find the spacing between slices
+  itk::ImageIOBase::Pointer last = itk::GDCMImageIO::New();
+  last->SetFileName(m_DICOMFiles.back().c_str());
+  last->ReadImageInformation();
+
+  typename NativeImageType::SizeType dim;
+  typename NativeImageType::PointType org;
+  typename NativeImageType::SpacingType spc;
+  typename NativeImageType::DirectionType dir;
+  dir.SetIdentity();
+  for(unsigned int i = 0; i < 2; i++)
+    {
+    spc[i] = first->GetSpacing(i);
+    dim[i] = first->GetDimensions(i);
+    for(unsigned int j = 0; j < 3; j++)
+      dir(j,i) = first->GetDirection(i)[j];
+    }
+  dim[2] = nSlices;
+
+  // The slice normal is the cross product of the row and column directions
+  dir(0,2) = dir(1,0) * dir(2,1) - dir(2,0) * dir(1,1);
+  dir(1,2) = dir(2,0) * dir(0,1) - dir(0,0) * dir(2,1);
+  dir(2,2) = dir(0,0) * dir(1,1) - dir(1,0) * dir(0,1);
+
+  // The spacing is the distance between the first and last slices along the
+  // normal, divided by the number of gaps, as in itk::ImageSeriesReader. A
+  // negative spacing is regularized by the caller
+  double dz = 0.0;
+  for(unsigned int j = 0; j < 3; j++)
+    {
+    org[j] = first->GetOrigin(j);
+    dz += dir(j,2) * (last->GetOrigin(j) - first->GetOrigin(j));
+    }
+  spc[2] = (dz != 0.0) ? dz / (nSlices - 1) : 1.0;
+
+  // Allocate the volume
+  typename NativeImageType::Pointer image = NativeImageType::New();
+  typename NativeImageType::RegionType region;
+  typename NativeImageType::IndexType index = {{0, 0, 0}};
+  region.SetIndex(index);
+  region.SetSize(dim);
+  image->SetRegions(region);
+  image->SetSpacing(spc);
+  image->SetOrigin(org);
+  image->SetDirection(dir);
+  image->SetVectorLength(first->GetNumberOfComponents());
+  image->SetMetaDataDictionary(first->GetMetaDataDictionary());
+  image->Allocate();
+
+  // Set up the threads, each with its own IO object
+  itk::MultiThreader::Pointer mt = itk::MultiThreader::New();
+  int nThreads = std::min(mt->GetNumberOfThreads(), (int) nSlices);
+  mt->SetNumberOfThreads(nThreads);
+
+  DICOMSeriesThreadData td;
+  td.Files = &m_DICOMFiles;
+  for(int t = 0; t < nThreads; t++)
+    td.IO.push_back(itk::GDCMImageIO::New().GetPointer());
+  td.ComponentType = first->GetComponentType();
+  td.Components = first->GetNumberOfComponents();
+  td.Width = dim[0];
+  td.Height = dim[1];
+  td.SliceBytes = dim[0] * dim[1] * td.Components * sizeof(TScalar);
+  td.Buffer = reinterpret_cast<char *>(image->GetBufferPointer());
+  td.NextSlice = 0;
+  td.SlicesDone = 0;
+  td.Failed = false;
+
+  AllPurposeProgressAccumulator::Pointer progress;
+  td.Progress = NULL;
+  if(progressCommand)
+    {
+    progress = AllPurposeProgressAccumulator::New();
+    progress->AddObserver(itk::ProgressEvent(), progressCommand);
+    td.Progress = progress;
+    }
+
+  mt->SetSingleMethod(DICOMSeriesThreadData::ThreadCallback, &td);
+  mt->SingleMethodExecute();
+
+  if(td.Failed)
+    return false;
+
+  m_NativeImage = image;
+  return true;
+}
+
+/**
+ * A pixel container whose buffer is a private, copy-on-write memory mapping
+ * of a file. The file is unmapped when the container is deleted.
+ */
+template<typename TPixel>
+class MappedFilePixelContainer 
+  : public itk::ImportImageContainer<unsigned long, TPixel>
+{
+public:
+  typedef MappedFilePixelContainer Self;
+  typedef itk::ImportImageContainer<unsigned long, TPixel> Superclass;
+  typedef itk::SmartPointer<Self> Pointer;
+  typedef itk::SmartPointer<const Self> ConstPointer;
+  itkNewMacro(Self);
+
+  /** 
+   * Map n elements stored at the given offset in the file. Returns false if
+   * the file is too short or can not be mapped.
+   */
+  bool MapFile(const char *fname, size_t offset, unsigned long n);
+
+  /** Copy the data into memory of our own and unmap the file */
+  void CopyOutOfFile();
+
+protected:
+  MappedFilePixelContainer()
+    { m_Mapping = NULL; m_MappingSize = 0; }
+
+  ~MappedFilePixelContainer();
+
+private:
+  void *m_Mapping;
+  size_t m_MappingSize;
+};
+
+template<typename TPixel>
+bool
+MappedFilePixelContainer<TPixel>
+::MapFile(const char *fname, size_t offset, unsigned long n)
+{
+#ifdef _WIN32
+  return false;
+#else
+  int fd = open(fname, O_RDONLY);
+  if(fd < 0)
+    return false;
+
+  // The file must contain all of the data
+  struct stat st;
+  size_t size = offset + n * sizeof(TPixel);
+  if(fstat(fd, &st) != 0 || (size_t) st.st_size < size || n == 0)
+    {
+    close(fd);
+    return false;
+    }
+
+  // Map the file from the beginning, since the offset of the data is not
+  // page aligned. The mapping is private, so the changes made to the image 
+  // are never written back to the file
+  void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED)
+    return false;
+
+  m_Mapping = mapping;
+  m_MappingSize = size;
+  this->SetImportPointer(
+    reinterpret_cast<TPixel *>(static_cast<char *>(mapping) + offset), n, false);
+  return true;
+#endif
+}
+
+template<typename TPixel>
+void
+MappedFilePixelContainer<TPixel>
+::CopyOutOfFile()
+{
+  if(!m_Mapping)
+    return;
+
+  unsigned long n = this->Size();
+  TPixel *copy = new TPixel[n];
+  std::copy(this->GetImportPointer(), this->GetImportPointer() + n, copy);
+  this->SetImportPointer(copy, n, true);
+
+#ifndef _WIN32
+  munmap(m_Mapping, m_MappingSize);
+#endif
+  m_Mapping = NULL;
+  m_MappingSize = 0;
+}
+
+template<typename TPixel>
+MappedFilePixelContainer<TPixel>
+::~MappedFilePixelContainer()
+{
+#ifndef _WIN32
+  if(m_Mapping)
+    munmap(m_Mapping, m_MappingSize);
+#endif
+}
+
+/**
+ * A pixel container that uses the buffer of another pixel container, which 
+ * it keeps alive, without copying it. This lets the output of the cast 
+ * adapters use the native image buffer directly when the native pixels 
+ * already have the bit patterns of the output pixels.
+ */
+template<typename TPixel>
+class SharedNativeBufferContainer 
+  : public itk::ImportImageContainer<unsigned long, TPixel>
+{
+public:
+  typedef SharedNativeBufferContainer Self;
+  typedef itk::ImportImageContainer<unsigned long, TPixel> Superclass;
+  typedef itk::SmartPointer<Self> Pointer;
+  typedef itk::SmartPointer<const Self> ConstPointer;
+  itkNewMacro(Self);
+
+  /** Set the container that holds the buffer, and whether it is a mapping */
+  void SetOwner(itk::Object *owner, bool mapped)
+    { m_Owner = owner; m_OwnerMapped = mapped; }
+
+  bool IsOwnerMapped() const
+    { return m_OwnerMapped; }
+
+  /** Copy the buffer into memory of our own and let go of the owner */
+  void CopyOutOfOwner()
+    {
+    unsigned long n = this->Size();
+    TPixel *copy = new TPixel[n];
+    std::copy(this->GetImportPointer(), this->GetImportPointer() + n, copy);
+    this->SetImportPointer(copy, n, true);
+    m_Owner = NULL;
+    m_OwnerMapped = false;
+    }
+
+protected:
+  SharedNativeBufferContainer() 
+    { m_OwnerMapped = false; }
+
+private:
+  itk::Object::Pointer m_Owner;
+  bool m_OwnerMapped;
+};
+
+/**
+ * Make sure that the buffer of an image is not a mapping of a file, copying
+ * it out if it is. This is done before an image is saved, since the file 
+ * written may be the one that is mapped: opening it for writing truncates 
+ * it, and reading the pages of the mapping past the new end of the file 
+ * raises SIGBUS.
+ */
+template<typename TPixel>
+static void CopyOutOfFileMapping(itk::Image<TPixel,3> *image)
+{
+  typedef MappedFilePixelContainer<TPixel> MappedType;
+  typedef SharedNativeBufferContainer<TPixel> SharedType;
+  typename itk::Image<TPixel,3>::PixelContainer *container = 
+    image->GetPixelContainer();
+
+  if(MappedType *mapped = dynamic_cast<MappedType *>(container))
+    mapped->CopyOutOfFile();
+  else if(SharedType *shared = dynamic_cast<SharedType *>(container))
+    {
+    if(shared->IsOwnerMapped())
+      shared->CopyOutOfOwner();
+    }
+}
+
+template<class TScalar>
+bool
+GuidedNativeImageIO
+::DoMapNative(const char *FileName)
+{
+  typedef itk::VectorImage<TScalar, 3> NativeImageType;
+  typedef MappedFilePixelContainer<TScalar> ContainerType;
+
+  // Only uncompressed data that does not have to be byte swapped or 
+  // converted can be used in place
+  if(m_DataOffset < 0 || m_IOBase->GetNumberOfDimensions() != 3)
+    return false;
+
+  if(sizeof(TScalar) > 1)
+    {
+    bool big = itk::ByteSwapper<TScalar>::SystemIsBigEndian();
+    if(m_IOBase->GetByteOrder() != 
+      (big ? itk::ImageIOBase::BigEndian : itk::ImageIOBase::LittleEndian))
+      return false;
+    }
+
+  // Initialize the direction and spacing, etc
+  typename NativeImageType::Pointer image = NativeImageType::New();
+  typename NativeImageType::SizeType dim;
+  typename NativeImageType::PointType org;
+  typename NativeImageType::SpacingType spc;
+  typename NativeImageType::DirectionType dir;
+  for(unsigned int i = 0; i < 3; i++)
+    {
+    spc[i] = m_IOBase->GetSpacing(i);
+    org[i] = m_IOBase->GetOrigin(i);
+    for(size_t j = 0; j < 3; j++)
+      dir(j,i) = m_IOBase->GetDirection(i)[j];
+    dim[i] = m_IOBase->GetDimensions(i);
+    }
+
+  image->SetSpacing(spc);
+  image->SetOrigin(org);
+  image->SetDirection(dir);
+  image->SetMetaDataDictionary(m_IOBase->GetMetaDataDictionary());
+
+  typename NativeImageType::RegionType region;
+  typename NativeImageType::IndexType index = {{0, 0, 0}};
+  region.SetIndex(index);
+  region.SetSize(dim);
+  image->SetRegions(region);
+  image->SetVectorLength(m_IOBase->GetNumberOfComponents());
+
+  // Map the file
+  typename ContainerType::Pointer container = ContainerType::New();
+  unsigned long n = 
+    region.GetNumberOfPixels() * m_IOBase->GetNumberOfComponents();
+  if(!container->MapFile(FileName, (size_t) m_DataOffset, n))
+    return false;
+
+  image->SetPixelContainer(container);
+  m_NativeImage = image;
+  return true;
+}
+
+bool
+GuidedNativeImageIO
+::CreatePreview(GuidedNativeImageIO &preview, size_t maxVoxels) const
+{
+  if(!IsNativeImageLoaded() || maxVoxels == 0)
+    return false;
+
+  // Find the smallest subsampling factor that makes the preview small enough
+  itk::Size<3> size = m_NativeImage->GetBufferedRegion().GetSize();
+  unsigned int k = 1;
+  while(true)
+    {
+    size_t n = 1;
+    for(unsigned int d = 0; d < 3; d++)
+      n *= (size[d] + k - 1) / k;
+    if(n <= maxVoxels)
+      break;
+    k++;
+    }
+
+  if(k == 1)
+    return false;
+
+  // Subsample the image in its native type
+  switch(m_NativeType) 
+    {
+    case itk::ImageIOBase::UCHAR:  DoCreatePreview<unsigned char>(preview, k);   break;
+    case itk::ImageIOBase::CHAR:   DoCreatePreview<signed char>(preview, k);     break;
+    case itk::ImageIOBase::USHORT: DoCreatePreview<unsigned short>(preview, k);  break;
+    case itk::ImageIOBase::SHORT:  DoCreatePreview<signed short>(preview, k);    break;
+    case itk::ImageIOBase::UINT:   DoCreatePreview<unsigned int>(preview, k);    break;
+    case itk::ImageIOBase::INT:    DoCreatePreview<signed int>(preview, k);      break;
+    case itk::ImageIOBase::ULONG:  DoCreatePreview<unsigned long>(preview, k);   break;
+    case itk::ImageIOBase::LONG:   DoCreatePreview<signed long>(preview, k);     break;
+    case itk::ImageIOBase::FLOAT:  DoCreatePreview<float>(preview, k);           break;
+    case itk::ImageIOBase::DOUBLE: DoCreatePreview<double>(preview, k);          break;
+    default: 
+      return false;
+    }
+
+  // The preview describes the same file
+  preview.m_NativeType = m_NativeType;
+  preview.m_NativeComponents = m_NativeComponents;
+  preview.m_NativeTypeString = m_NativeTypeString;
+  preview.m_NativeFileName = m_NativeFileName;
+  preview.m_NativeByteOrder = m_NativeByteOrder;
+  preview.m_NativeSizeInBytes = m_NativeSizeInBytes;
+  preview.m_FileFormat = m_FileFormat;
+  return true;
+}
+
+template<class TScalar>
+void
+GuidedNativeImageIO
+::DoCreatePreview(GuidedNativeImageIO &preview, unsigned int k) const
+{
+  typedef itk::VectorImage<TScalar, 3> NativeImageType;
+  NativeImageType *native = static_cast<NativeImageType *>(
+    m_NativeImage.GetPointer());
+
+  // The preview samples voxels 0, k, 2k, ... so it has the same origin and
+  // k times the spacing of the native image
+  itk::Size<3> size = native->GetBufferedRegion().GetSize(), psize;
+  typename NativeImageType::SpacingType spacing = native->GetSpacing();
+  for(unsigned int d = 0; d < 3; d++)
+    {
+    psize[d] = (size[d] + k - 1) / k;
+    spacing[d] *= k;
+    }
+
+  typename NativeImageType::Pointer image = NativeImageType::New();
+  typename NativeImageType::RegionType region;
+  region.SetSize(psize);
+  image->SetRegions(region);
+  image->SetSpacing(spacing);
+  image->SetOrigin(native->GetOrigin());
+  image->SetDirection(native->GetDirection());
+  image->SetMetaDataDictionary(native->GetMetaDataDictionary());
+  image->SetVectorLength(native->GetNumberOfComponentsPerPixel());
+  image->Allocate();
+
+  // Copy the sampled voxels. Only the rows and slices that are sampled are
+  // touched, which matters when the native image is mapped from a file
+  size_t nc = native->GetNumberOfComponentsPerPixel();
+  const TScalar *src = native->GetBufferPointer();
+  TScalar *dst = image->GetBufferPointer();
+  for(size_t z = 0; z < psize[2]; z++)
+    {
+    for(size_t y = 0; y < psize[1]; y++)
+      {
+      const TScalar *row = src + 
+        ((z * k * size[1] + y * k) * size[0]) * nc;
+      for(size_t x = 0; x < psize[0]; x++)
+        for(size_t c = 0; c < nc; c++)
+          *dst++ = row[x * k * nc + c];
+      }
+    }
+
+  preview.m_NativeImage = image;
+}
+
 /*
 template<typename TPixel>
 std::string
@@ -493,6 +1103,9 @@ GuidedNativeImageIO
   // Create an Image IO based on the folder
   CreateImageIO(FileName, folder, false);
 
+  // The image may still be reading from the file that is about to be written
+  CopyOutOfFileMapping(image);
+
   // Save the image
   typedef itk::ImageFileWriter< itk::Image<TPixel,3> > WriterType;
   typename WriterType::Pointer writer = WriterType::New();
@@ -514,6 +1127,47 @@ GuidedNativeImageIO
  * ADAPTER OBJECTS TO CAST NATIVE IMAGE TO GIVEN IMAGE
  ****************************************************************************/
 
+/**
+ * Check whether the native pixels can be reinterpreted as output pixels,
+ * which is the case for integers of the same size: a cast between them does
+ * not change the bits.
+ */
+template<typename TPixel, typename TNative>
+static bool IsSameSizeInteger()
+{
+  return std::numeric_limits<TPixel>::is_integer
+    && std::numeric_limits<TNative>::is_integer
+    && sizeof(TPixel) == sizeof(TNative);
+}
+
+/**
+ * Check whether the buffer of a native image is a memory mapping of the 
+ * file it was read from. An image that shares such a buffer is copied out
+ * of the mapping before it is saved, see CopyOutOfFileMapping().
+ */
+template<typename TNative>
+static bool IsMappedFromFile(itk::VectorImage<TNative, 3> *input)
+{
+  return dynamic_cast<MappedFilePixelContainer<TNative> *>(
+    input->GetPixelContainer()) != NULL;
+}
+
+/** Make the output image use the buffer of a single-component native image */
+template<typename TOutputImage, typename TNative>
+static void ShareNativeBuffer(
+  TOutputImage *output, itk::VectorImage<TNative, 3> *input)
+{
+  typedef typename TOutputImage::PixelType PixelType;
+  typedef SharedNativeBufferContainer<PixelType> ContainerType;
+  typename ContainerType::Pointer container = ContainerType::New();
+  container->SetOwner(input->GetPixelContainer(), IsMappedFromFile(input));
+  container->SetImportPointer(
+    reinterpret_cast<PixelType *>(input->GetBufferPointer()),
+    input->GetPixelContainer()->Size(), false);
+  output->SetPixelContainer(container);
+}
+
+
 template<typename TPixel>
 typename RescaleNativeImageToScalar<TPixel>::OutputImageType *
 RescaleNativeImageToScalar<TPixel>::operator()(GuidedNativeImageIO *nativeIO)
@@ -574,9 +1228,6 @@ RescaleNativeImageToScalar<TPixel>
     return;
     }
 
-  // Otherwise, allocate the buffer in the output image
-  m_Output->Allocate();
-
   // We must compute the range of the input data
   size_t nvoxels = input->GetBufferedRegion().GetNumberOfPixels();
   size_t ncomp = input->GetNumberOfComponentsPerPixel();
@@ -663,6 +1314,22 @@ RescaleNativeImageToScalar<TPixel>
       }
     }
 
+  // When the native values already fit into the output type, and the types
+  // have the same size (e.g., unsigned short data read as short), the native
+  // buffer is used as is, without allocating a second copy of the image
+  if(scale == 1.0 && shift == 0.0 && ncomp == 1 &&
+    IsSameSizeInteger<TPixel,TNative>() && 
+    1.0 * omin <= imin && 1.0 * omax >= imax)
+    {
+    ShareNativeBuffer(m_Output.GetPointer(), input.GetPointer());
+    m_NativeScale = 1.0;
+    m_NativeShift = 0.0;
+    return;
+    }
+
+  // Otherwise, allocate the buffer in the output image
+  m_Output->Allocate();
+
   // Map the values from input vector image to output image. Not using
   // iterators to increase speed and avoid unnecessary constructors
   TNative *bn = input->GetBufferPointer();
@@ -753,8 +1420,12 @@ CastNativeImageBase<TPixel,TCastFunctor>
   m_Output->CopyInformation(native);
   m_Output->SetRegions(native->GetBufferedRegion());
 
+  // The segmentation is cast through here, and it is edited and saved back
+  // to the file it came from. So a file mapping is always copied out
+  bool mapped = IsMappedFromFile(input.GetPointer());
+
   // Special case: native image is the same as target image
-  if(typeid(TPixel) == typeid(TNative))
+  if(typeid(TPixel) == typeid(TNative) && !mapped)
     {
     typename OutputImageType::PixelContainer *inbuff = 
       dynamic_cast<typename OutputImageType::PixelContainer *>(input->GetPixelContainer());
@@ -763,6 +1434,15 @@ CastNativeImageBase<TPixel,TCastFunctor>
     return;
     }
 
+  // Casting between integers of the same size does not change the bits, so
+  // the native buffer can be used as is
+  if(functor.GetNumberOfDimensions() == 1 && !mapped &&
+    IsSameSizeInteger<TPixel,TNative>())
+    {
+    ShareNativeBuffer(m_Output.GetPointer(), input.GetPointer());
+    return;
+    }
+
   // Otherwise, allocate the buffer in the output image
   m_Output->Allocate();
 
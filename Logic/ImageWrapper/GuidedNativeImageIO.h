@@ -44,6 +44,7 @@ namespace itk
 {
   template<class TPixel, unsigned int VDim> class Image;
   class ImageIOBase;
+  class Command;
 }
 
 
@@ -99,9 +100,11 @@ public:
    * such as header size and image dimensions. The image is read in native
    * format and stored inside of this object. In order to cast the image to 
    * the format of interest, the user must cast the image to one of the 
-   * desired formats.
+   * desired formats. The optional command observes the progress of reading
+   * DICOM series, with an itk::ProcessObject as the caller.
    */
-  void ReadNativeImage(const char *FileName, Registry &folder);
+  void ReadNativeImage(const char *FileName, Registry &folder,
+                       itk::Command *progressCommand = NULL);
 
   /**
    * Get the number of components in the native image read by ReadNativeImage.
@@ -142,6 +145,15 @@ public:
   bool IsNativeImageLoaded() const
     { return m_NativeImage.IsNotNull(); }
 
+  /**
+   * Create a coarse preview of the native image in another IO object, by 
+   * taking every k-th voxel along each axis, with k chosen so that the 
+   * preview has at most maxVoxels voxels. The preview covers the same 
+   * physical extent. Returns false, leaving the other object alone, if the
+   * native image is already small enough.
+   */
+  bool CreatePreview(GuidedNativeImageIO &preview, size_t maxVoxels) const;
+
   /**
    * Discard the native image. Use this once you've cast the native image to 
    * the format of interest.
@@ -194,7 +206,32 @@ private:
   template <typename TRaw> void CreateRawImageIO(Registry &folder);
 
   /** Templated function that reads a scalar image in its native datatype */
-  template <typename TScalar> void DoReadNative(const char *fname, Registry &folder);
+  template <typename TScalar> void DoReadNative(
+    const char *fname, Registry &folder, itk::Command *progressCommand);
+
+  /** 
+   * Templated function that maps an uncompressed file into memory instead of
+   * reading it, so that the pages are only read when they are accessed and
+   * are shared with other processes that map the same file. Returns false if
+   * the file can not be mapped, in which case it should be read normally.
+   * The cast adapters copy the data out of the mapping, so that only the 
+   * images that are never saved back to their file keep using it.
+   */
+  template <typename TScalar> bool DoMapNative(const char *fname);
+
+  /**
+   * Templated function that reads the slices of a DICOM series directly 
+   * into the native image. The slice files are read from disk in parallel, 
+   * but GDCM, which is not thread-safe, parses and decodes them one at a 
+   * time. Returns false if the slices can not be
+   * stacked this way (e.g., they differ in size or pixel type), in which 
+   * case the series should be read by itk::ImageSeriesReader.
+   */
+  template <typename TScalar> bool DoReadDICOMSeries(itk::Command *progress);
+
+  /** Templated function that subsamples the native image for a preview */
+  template <typename TScalar> 
+    void DoCreatePreview(GuidedNativeImageIO &preview, unsigned int k) const;
 
   /** 
    * This is a vector image in native format. It stores the data read from the
@@ -216,6 +253,10 @@ private:
   // The file format
   FileFormat m_FileFormat;
 
+  // Offset of the image data in the file when the file is uncompressed and
+  // its data can be used in place, or -1
+  long m_DataOffset;
+
   // List of filenames for DICOM
   std::vector<std::string> m_DICOMFiles;
 
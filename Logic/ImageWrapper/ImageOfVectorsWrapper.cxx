@@ -84,11 +84,14 @@ ImageOfVectorsWrapper::DisplayPixelType
 ImageOfVectorsWrapper::IntensityFunctor
 ::operator()(const VectorType &x) const
 {
-  // Create a new pixel
+  // Create a new pixel. The vector components, which are expected to be
+  // normalized, are mapped from [-1,1] to [0,255]
   DisplayPixelType pixel;
-  pixel[0] = x[0];
-  pixel[1] = x[1];
-  pixel[2] = x[2];
+  for(unsigned int i = 0; i < 3; i++)
+    {
+    float v = x[i] < -1.0f ? -1.0f : (x[i] > 1.0f ? 1.0f : x[i]);
+    pixel[i] = (unsigned char)(127.5f * (v + 1.0f) + 0.5f);
+    }
   if (x[0] != 0 || x[1] != 0 || x[2] != 0)
     pixel[3] = 255;
   else
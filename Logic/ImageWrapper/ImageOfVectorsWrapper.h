@@ -37,6 +37,10 @@ typedef itk::VectorImage<float,3>::PixelType VectorType;
  * \class ImageOfVectorsWrapper
  * \brief Image wrapper for Vector images in SNAP
  *
+ * The display slice holds the first three vector components mapped from
+ * [-1,1] to [0,255], with zero alpha where the vector is zero. The slice
+ * texture decodes these to draw the vector overlay.
+ *
  * \sa ImageWrapper
  */
 class ImageOfVectorsWrapper : public VectorImageWrapper<VectorType>
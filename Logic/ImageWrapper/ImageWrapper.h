@@ -61,8 +61,9 @@ class ImageWrapperBase
 {
 public:
 
-  // Definition for the display slice type
-  typedef itk::RGBAPixel<float> DisplayPixelType;
+  // Definition for the display slice type. Display slices are 8-bit RGBA, 
+  // which is the format in which they are uploaded as textures
+  typedef itk::RGBAPixel<unsigned char> DisplayPixelType;
   typedef itk::Image<DisplayPixelType,2> DisplaySliceType;
   typedef itk::SmartPointer<DisplaySliceType> DisplaySlicePointer;
 
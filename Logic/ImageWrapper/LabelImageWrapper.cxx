@@ -37,6 +37,7 @@
 #include "LabelImageWrapper.h"
 #include "ColorLabel.h"
 #include "ColorLabelTable.h"
+#include <algorithm>
 
 // Create an instance of ImageWrapper of appropriate type
 template class ImageWrapper<LabelType>;
@@ -52,6 +53,14 @@ LabelImageWrapper
     m_RGBAFilter[i]->SetInput(m_Slicer[i]->GetOutput());
   }
 
+  // Count the modifications made to the image
+  m_ModifiedCommand = ModifiedCommandType::New();
+  m_ModifiedCommand->SetCallbackFunction(
+    this, &LabelImageWrapper::OnImageModified);
+  m_ModifiedObserverTag = 0;
+  m_ModificationsSinceReport = 0;
+  m_UntrackedChanges = false;
+
   SetLabelColorTable(NULL);
 }
 
@@ -66,6 +75,18 @@ LabelImageWrapper
     m_RGBAFilter[i]->SetInput(m_Slicer[i]->GetOutput());
   }
 
+  // Count the modifications made to the image
+  m_ModifiedCommand = ModifiedCommandType::New();
+  m_ModifiedCommand->SetCallbackFunction(
+    this, &LabelImageWrapper::OnImageModified);
+  m_ModifiedObserverTag = 0;
+  m_ModificationsSinceReport = 0;
+  m_UntrackedChanges = false;
+
+  // The base constructor does not dispatch to our UpdateImagePointer()
+  if(m_Image)
+    ObserveImage(m_Image);
+
   // Initialize the color table as well
   SetLabelColorTable(source.GetLabelColorTable());
 }
@@ -73,12 +94,45 @@ LabelImageWrapper
 LabelImageWrapper
 ::~LabelImageWrapper()
 {
+  if(m_Image)
+    m_Image->RemoveObserver(m_ModifiedObserverTag);
+
   for (size_t i = 0; i < 3; ++i)
     {
     m_RGBAFilter[i] = NULL;
     }
 }
 
+void
+LabelImageWrapper
+::UpdateImagePointer(ImageType *newImage)
+{
+  if(m_Image)
+    m_Image->RemoveObserver(m_ModifiedObserverTag);
+
+  ScalarImageWrapper<LabelType>::UpdateImagePointer(newImage);
+  ObserveImage(newImage);
+}
+
+void
+LabelImageWrapper
+::ObserveImage(ImageType *image)
+{
+  m_ModifiedObserverTag = 
+    image->AddObserver(itk::ModifiedEvent(), m_ModifiedCommand);
+
+  // A new image is not described by the dirty regions of the old one
+  m_ModificationsSinceReport = 0;
+  m_UntrackedChanges = true;
+}
+
+void
+LabelImageWrapper
+::OnImageModified()
+{
+  m_ModificationsSinceReport++;
+}
+
 ColorLabelTable *
 LabelImageWrapper
 ::GetLabelColorTable() const
@@ -114,6 +168,91 @@ LabelImageWrapper
   return m_RGBAFilter[dim]->GetOutput();
 }
 
+// Compute the bounding box of two regions
+static LabelImageWrapper::RegionType
+BoundingRegion(const LabelImageWrapper::RegionType &r1,
+               const LabelImageWrapper::RegionType &r2)
+{
+  LabelImageWrapper::RegionType r;
+  for(unsigned int d = 0; d < 3; d++)
+    {
+    long lo = std::min(r1.GetIndex(d), r2.GetIndex(d));
+    long hi = std::max(r1.GetIndex(d) + (long) r1.GetSize(d),
+                       r2.GetIndex(d) + (long) r2.GetSize(d));
+    r.SetIndex(d, lo);
+    r.SetSize(d, hi - lo);
+    }
+  return r;
+}
+
+void
+LabelImageWrapper
+::AddDirtyRegion(const RegionType &region)
+{
+  // Keep the list short, since every region costs a pass during undo
+  const size_t nMaxRegions = 16;
+
+  // The caller reports one modification. If the image was modified more
+  // than once since the last report, some change went unreported
+  if(m_ModificationsSinceReport > 1)
+    m_UntrackedChanges = true;
+  m_ModificationsSinceReport = 0;
+
+  // Only the part of the region inside the image matters
+  RegionType r = region;
+  if(!r.Crop(GetImage()->GetBufferedRegion()))
+    return;
+
+  // Nothing to do if the region is already covered
+  for(size_t i = 0; i < m_DirtyRegions.size(); i++)
+    if(m_DirtyRegions[i].IsInside(r))
+      return;
+
+  // Remove the regions that the new region covers
+  RegionList kept;
+  for(size_t i = 0; i < m_DirtyRegions.size(); i++)
+    if(!r.IsInside(m_DirtyRegions[i]))
+      kept.push_back(m_DirtyRegions[i]);
+  m_DirtyRegions.swap(kept);
+
+  if(m_DirtyRegions.size() < nMaxRegions)
+    {
+    m_DirtyRegions.push_back(r);
+    }
+  else
+    {
+    // Merge the new region with the region whose bounding box grows the least
+    size_t iBest = 0, nBest = 0;
+    for(size_t i = 0; i < m_DirtyRegions.size(); i++)
+      {
+      size_t nGrowth = BoundingRegion(m_DirtyRegions[i], r).GetNumberOfPixels()
+        - m_DirtyRegions[i].GetNumberOfPixels();
+      if(i == 0 || nGrowth < nBest)
+        {
+        iBest = i;
+        nBest = nGrowth;
+        }
+      }
+    m_DirtyRegions[iBest] = BoundingRegion(m_DirtyRegions[iBest], r);
+    }
+}
+
+bool
+LabelImageWrapper
+::HasUntrackedChanges() const
+{
+  return m_UntrackedChanges || m_ModificationsSinceReport > 0;
+}
+
+void
+LabelImageWrapper
+::ClearDirtyRegions()
+{
+  m_DirtyRegions.clear();
+  m_ModificationsSinceReport = 0;
+  m_UntrackedChanges = false;
+}
+
 /**
  * This definition is needed to use RGBA pixels for compilation
  */
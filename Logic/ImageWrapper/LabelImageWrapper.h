@@ -38,6 +38,8 @@
 #include "ScalarImageWrapper.h"
 #include "UnaryFunctorCache.h"
 #include "LabelToRGBAFilter.h"
+#include "itkCommand.h"
+#include <vector>
 
 
 
@@ -64,6 +66,10 @@ class LabelImageWrapper : public ScalarImageWrapper<LabelType>
 {
 public:
 
+  // A list of image regions
+  typedef ImageType::RegionType RegionType;
+  typedef std::vector<RegionType> RegionList;
+
   /**
    * Set the table of color labels used to produce color slice images
    */  
@@ -85,6 +91,30 @@ public:
    */
   DisplaySlicePointer GetDisplaySlice(unsigned int dim) const;
 
+  /**
+   * Report that a region of the image has been modified. The regions are 
+   * accumulated as a short list of boxes (overlapping boxes are merged when 
+   * the list grows too long) until ClearDirtyRegions() is called. This lets
+   * the undo system look only at the parts of the image that have changed.
+   * Code that modifies the image should call this after calling Modified().
+   */
+  void AddDirtyRegion(const RegionType &region);
+
+  /** Get the regions modified since the last call to ClearDirtyRegions() */
+  const RegionList &GetDirtyRegions() const
+    { return m_DirtyRegions; }
+
+  /**
+   * Check whether the image has been modified without the change being 
+   * reported through AddDirtyRegion() since the last ClearDirtyRegions(). 
+   * If so, the list of dirty regions is not reliable. Once set, this state
+   * is only reset by ClearDirtyRegions().
+   */
+  bool HasUntrackedChanges() const;
+
+  /** Clear the list of dirty regions */
+  void ClearDirtyRegions();
+
   /** Constructor initializes mapper */
   LabelImageWrapper();
 
@@ -94,6 +124,11 @@ public:
   /** Destructor */
   ~LabelImageWrapper();  
 
+protected:
+
+  /** Watch the new image for modifications that are not reported */
+  virtual void UpdateImagePointer(ImageType *);
+
 private:
   /**
    * Functor used for display caching.  This class keeps a pointer to 
@@ -128,6 +163,20 @@ private:
 
   RGBAFilterPointer m_RGBAFilter[3];
 
+  // The regions modified since the last ClearDirtyRegions()
+  RegionList m_DirtyRegions;
+
+  // Observer that counts calls to Modified() on the image. Every reported
+  // region accounts for one modification; anything beyond that is untracked
+  typedef itk::SimpleMemberCommand<LabelImageWrapper> ModifiedCommandType;
+  ModifiedCommandType::Pointer m_ModifiedCommand;
+  unsigned long m_ModifiedObserverTag;
+  unsigned int m_ModificationsSinceReport;
+  bool m_UntrackedChanges;
+
+  void OnImageModified();
+  void ObserveImage(ImageType *image);
+
   // typedef 
   //  itk::UnaryFunctorImageFilter<LabelSliceType,DisplaySliceType,CacheFunctor>
   //  IntensityFilterType;
@@ -117,7 +117,8 @@ public:
   /**
    * This method is used to perform a deep copy of a region of this image 
    * into another image, potentially resampling the region to use a different
-   * voxel size
+   * voxel size. Only the part of the image that the interpolator needs to 
+   * fill the region is read.
    */
   ImagePointer DeepCopyRegion(const SNAPSegmentationROISettings &roi,
                               itk::Command *progressCommand = NULL) const;
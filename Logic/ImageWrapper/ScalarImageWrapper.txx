@@ -31,6 +31,8 @@
 #include "SNAPSegmentationROISettings.h"
 #include "itkCommand.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 template <class TPixel>
@@ -87,29 +89,18 @@ ScalarImageWrapper<TPixel>
     {
     // Compute the number of voxels in the output
     typedef typename itk::ImageRegion<3> RegionType;
-    typedef typename itk::Size<3> SizeType;
 
-    SizeType vNewSize;
     RegionType vNewROI;
     Vector3d vNewSpacing;
 
     for(unsigned int i = 0; i < 3; i++) 
       {
       double scale = roi.GetVoxelScale()[i];
-      vNewSize.SetElement(i, (unsigned long) (vOldSize[i] / scale));
       vNewROI.SetSize(i,(unsigned long) (roi.GetROI().GetSize(i) / scale));
       vNewROI.SetIndex(i,(long) (roi.GetROI().GetIndex(i) / scale));
       vNewSpacing[i] = scale * vOldSpacing[i];
       }
 
-    // Create a filter for resampling the image
-    typedef itk::ResampleImageFilter<ImageType,ImageType> ResampleFilterType;
-    typename ResampleFilterType::Pointer fltSample = ResampleFilterType::New();
-
-    // Initialize the resampling filter
-    fltSample->SetInput(this->m_Image);
-    fltSample->SetTransform(itk::IdentityTransform<double,3>::New());
-
     // Typedefs for interpolators
     typedef itk::NearestNeighborInterpolateImageFunction<
       ImageType,double> NNInterpolatorType;
@@ -126,28 +117,73 @@ ScalarImageWrapper<TPixel>
       ImageType, VRadius, 
       WindowFunction, Condition, double> SincInterpolatorType;
 
-    // Choose the interpolator
+    // Choose the interpolator, along with the number of voxels around the 
+    // region of interest that it needs to see. The B-spline coefficients are
+    // computed by a recursive filter over the whole input, so it gets a wider
+    // margin, beyond which the effect of the input boundary is negligible
+    typename itk::InterpolateImageFunction<ImageType,double>::Pointer interp;
+    long margin = 1;
     switch(roi.GetInterpolationMethod())
       {
       case SNAPSegmentationROISettings::NEAREST_NEIGHBOR :
-        fltSample->SetInterpolator(NNInterpolatorType::New());
+        interp = NNInterpolatorType::New();
         break;
 
       case SNAPSegmentationROISettings::TRILINEAR : 
-        fltSample->SetInterpolator(LinearInterpolatorType::New());
+        interp = LinearInterpolatorType::New();
         break;
 
       case SNAPSegmentationROISettings::TRICUBIC :
-        fltSample->SetInterpolator(CubicInterpolatorType::New());
+        interp = CubicInterpolatorType::New();
+        margin = 12;
         break;  
 
       case SNAPSegmentationROISettings::SINC_WINDOW_05 :
-        fltSample->SetInterpolator(SincInterpolatorType::New());
+        interp = SincInterpolatorType::New();
+        margin = VRadius + 1;
         break;  
       };
 
-    // Set the image sizes and spacing
-    fltSample->SetSize(vNewSize);
+    // Compute the region of the input image that the interpolator reads in 
+    // order to fill the output region of interest. With the identity 
+    // transform, output voxel j lands on input continuous index j * scale
+    RegionType vSupport;
+    for(unsigned int i = 0; i < 3; i++) 
+      {
+      double scale = roi.GetVoxelScale()[i];
+      long iFirst = vNewROI.GetIndex(i);
+      long iLast = iFirst + (long) vNewROI.GetSize(i) - 1;
+      long lo = (long) floor(iFirst * scale) - margin;
+      long hi = (long) ceil(iLast * scale) + margin;
+      lo = std::max(lo, 0l);
+      hi = std::min(hi, (long) vOldSize[i] - 1);
+      vSupport.SetIndex(i, lo);
+      vSupport.SetSize(i, (unsigned long) std::max(hi - lo + 1, 1l));
+      }
+
+    // Extract the support region. The chopped image keeps the physical 
+    // coordinates of the source, so resampling it gives the same result
+    // as resampling the whole image
+    typename ChopFilterType::Pointer fltSupport = ChopFilterType::New();
+    fltSupport->SetInput(this->m_Image);
+    fltSupport->SetRegionOfInterest(vSupport);
+    if(progressCommand)
+      fltSupport->AddObserver(itk::AnyEvent(),progressCommand);
+    fltSupport->Update();
+
+    // Create a filter for resampling the image
+    typedef itk::ResampleImageFilter<ImageType,ImageType> ResampleFilterType;
+    typename ResampleFilterType::Pointer fltSample = ResampleFilterType::New();
+
+    // Initialize the resampling filter
+    fltSample->SetInput(fltSupport->GetOutput());
+    fltSample->SetTransform(itk::IdentityTransform<double,3>::New());
+    fltSample->SetInterpolator(interp);
+
+    // Set the image sizes and spacing. Only the region of interest of the
+    // resampled grid is produced
+    fltSample->SetOutputStartIndex(vNewROI.GetIndex());
+    fltSample->SetSize(vNewROI.GetSize());
     fltSample->SetOutputSpacing(vNewSpacing.data_block());
     fltSample->SetOutputOrigin(this->m_Image->GetOrigin());
     fltSample->SetOutputDirection(this->m_Image->GetDirection());
@@ -157,7 +193,6 @@ ScalarImageWrapper<TPixel>
       fltSample->AddObserver(itk::AnyEvent(),progressCommand);
 
     // Perform resampling
-    fltSample->GetOutput()->SetRequestedRegion(vNewROI);
     fltSample->Update();  
 
     // Pipe into the chopper
@@ -175,6 +210,10 @@ ScalarImageWrapper<TPixel>
     fltChop->SetRegionOfInterest(roi.GetROI());
     }
 
+  // Set the progress bar
+  if(progressCommand)
+    fltChop->AddObserver(itk::AnyEvent(),progressCommand);
+
   // Update the pipeline
   fltChop->Update();
 
@@ -0,0 +1,192 @@
+/*=========================================================================
+
+  Program:   ITK-SNAP
+  Module:    LevelSetFrontTrackingFilter.h
+  Language:  C++
+  Copyright (c) 2007 Paul A. Yushkevich
+  
+  This file is part of ITK-SNAP 
+
+  ITK-SNAP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information. 
+
+=========================================================================*/
+#ifndef __LevelSetFrontTrackingFilter_h_
+#define __LevelSetFrontTrackingFilter_h_
+
+#include <vector>
+
+/**
+ * \class LevelSetFrontTrackingInterface
+ * \brief A solver independent interface to LevelSetFrontTrackingFilter
+ */
+class LevelSetFrontTrackingInterface
+{
+public:
+  virtual ~LevelSetFrontTrackingInterface() {}
+
+  /** 
+   * When set, the voxels away from the front are not reset to constant 
+   * values after each update. They still have the correct sign, which is
+   * all that the display and the mesh need 
+   */
+  virtual void SetSkipPostProcessing(bool flag) = 0;
+
+  /** Have all voxels been written since the last ClearChangedVoxels()? */
+  virtual bool IsFullyChanged() const = 0;
+
+  /** 
+   * Buffer offsets of the voxels that may have changed since the last call 
+   * to ClearChangedVoxels(), if not all of them have 
+   */
+  virtual const std::vector<unsigned long> &GetChangedVoxels() const = 0;
+
+  /** Start collecting changed voxels anew */
+  virtual void ClearChangedVoxels() = 0;
+};
+
+/**
+ * \class LevelSetFrontTrackingFilter
+ * \brief An extension of the sparse field level set filter that keeps track
+ * of the voxels that may have changed.
+ *
+ * The sparse field solver only changes the values of voxels in its layers, 
+ * so after every iteration the voxels in the layers are recorded. The set 
+ * of voxels recorded since the last ClearChangedVoxels() covers all the 
+ * voxels whose value may have changed, and its size is proportional to the 
+ * size of the front rather than to the size of the image.
+ */
+template <class TFilter>
+class LevelSetFrontTrackingFilter 
+: public TFilter, public LevelSetFrontTrackingInterface
+{
+public:
+  
+  /** Standard class typedefs. */
+  typedef LevelSetFrontTrackingFilter<TFilter> Self;
+  typedef TFilter Superclass;
+  typedef itk::SmartPointer<Self> Pointer;
+  typedef itk::SmartPointer<const Self> ConstPointer;
+
+  /** Run-time type information. */
+  itkTypeMacro(LevelSetFrontTrackingFilter,TFilter);
+
+  /** ITK new macro */
+  itkNewMacro(LevelSetFrontTrackingFilter);
+
+  /** Capture information from the superclass. */
+  typedef typename Superclass::TimeStepType TimeStepType;
+  typedef typename Superclass::LayerType LayerType;
+
+  void SetSkipPostProcessing(bool flag)
+    { m_SkipPostProcessing = flag; }
+
+  bool IsFullyChanged() const
+    { return m_FullyChanged; }
+
+  const std::vector<unsigned long> &GetChangedVoxels() const
+    { return m_Changed; }
+
+  void ClearChangedVoxels()
+  {
+    // Nothing to track before the filter has been initialized
+    if(m_ChangedMask.empty())
+      return;
+
+    for(size_t i = 0; i < m_Changed.size(); i++)
+      m_ChangedMask[m_Changed[i]] = 0;
+    m_Changed.clear();
+    m_FullyChanged = false;
+
+    // The voxels in the layers now may change in the next iteration, even if
+    // they leave the layers in that iteration
+    RecordLayers();
+  }
+
+protected:
+  LevelSetFrontTrackingFilter() 
+    : m_SkipPostProcessing(false), m_FullyChanged(true) {}
+  virtual ~LevelSetFrontTrackingFilter() {}
+
+  /** The whole output is written when the filter is initialized */
+  virtual void Initialize()
+  {
+    Superclass::Initialize();
+    m_ChangedMask.assign(
+      this->GetOutput()->GetBufferedRegion().GetNumberOfPixels(), 0);
+    m_Changed.clear();
+    m_FullyChanged = true;
+  }
+
+  /** Record the voxels in the layers after each iteration */
+  virtual void ApplyUpdate(TimeStepType dt)
+  {
+    Superclass::ApplyUpdate(dt);
+    if(!m_FullyChanged)
+      RecordLayers();
+  }
+
+  /** The superclass visits every voxel here */
+  virtual void PostProcessOutput()
+  {
+    if(!m_SkipPostProcessing)
+      {
+      Superclass::PostProcessOutput();
+      m_FullyChanged = true;
+      }
+  }
+
+  /** Add the voxels in the layers to the changed voxels */
+  void RecordLayers()
+  {
+    for(unsigned int i = 0; i < this->m_Layers.size(); i++)
+      {
+      LayerType *layer = this->m_Layers[i].GetPointer();
+      for(typename LayerType::Iterator it = layer->Begin(); 
+        it != layer->End(); ++it)
+        {
+        unsigned long offset = this->GetOutput()->ComputeOffset(it->m_Value);
+        if(!m_ChangedMask[offset])
+          {
+          m_ChangedMask[offset] = 1;
+          m_Changed.push_back(offset);
+          }
+        }
+      }
+  }
+
+  /** Just a print method */
+  void PrintSelf(std::ostream& os, itk::Indent indent) const
+  {
+    Superclass::PrintSelf(os,indent);
+  }
+
+private:
+  LevelSetFrontTrackingFilter(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+
+  bool m_SkipPostProcessing, m_FullyChanged;
+  std::vector<unsigned long> m_Changed;
+  std::vector<unsigned char> m_ChangedMask;
+};
+
+#endif // __LevelSetFrontTrackingFilter_h_
@@ -39,9 +39,16 @@
 #include "SnakeParameters.h"
 #include "SNAPLevelSetFunction.h"
 // #include "SNAPLevelSetStopAndGoFilter.h"
+#include "itkMultiThreader.h"
+#include "itkMutexLock.h"
+#include "itkConditionVariable.h"
+#include <deque>
+#include <string>
+#include <vector>
 
 template <class TFilter> class LevelSetExtensionFilter;
 class LevelSetExtensionFilterInterface;
+class LevelSetFrontTrackingInterface;
  
 namespace itk {
   template <class TInputImage, class TOutputImage> class ImageToImageFilter;
@@ -115,8 +122,9 @@ public:
                      const SnakeParameters &parms,
                      VectorImageType *externalAdvection = NULL);
 
-  /** Virtual destructor */
-  virtual ~SNAPLevelSetDriver() {}
+  /** Virtual destructor, stops the worker thread if there is one, without
+   * bringing the snapshot up to date */
+  virtual ~SNAPLevelSetDriver();
 
   /** Set snake parameters */
   void SetSnakeParameters(const SnakeParameters &parms);
@@ -138,6 +146,59 @@ public:
 
   /** Clean up the snake's state */
   void CleanUp();
+
+  /** Commands that control the evolution on the worker thread */
+  enum WorkerCommandType {
+    WORKER_PLAY, WORKER_PAUSE, WORKER_STEP, WORKER_RESTART, 
+    WORKER_PARAMETERS, WORKER_QUIT };
+
+  /** 
+   * Start running the level set evolution on a worker thread. From then on
+   * until StopWorker(), the evolution is controlled by posting commands, 
+   * which the worker executes in order between blocks of iterations, and the
+   * state of the level set is read from a snapshot image owned by the 
+   * calling thread. Run, Restart and SetSnakeParameters may not be called
+   * while the worker is active. 
+   */
+  void StartWorker();
+
+  /** 
+   * Stop the worker thread. If updateSnapshot is true, the filter is then
+   * run to bring the level set away from the front up to date, and the
+   * result is copied into the snapshot. Call this before the final level set
+   * is read. Pass false when the level set is about to be discarded
+   */
+  void StopWorker(bool updateSnapshot = true);
+
+  /** Is the worker thread running? */
+  bool IsWorkerActive() const
+    { return m_WorkerThreadId >= 0; }
+
+  /** 
+   * Post a command to the worker. WORKER_PLAY keeps running blocks of 
+   * nIterations until paused, and WORKER_STEP runs a single block 
+   */
+  void PostCommand(WorkerCommandType command, unsigned int nIterations = 0);
+
+  /** Post new snake parameters to the worker */
+  void PostParameters(const SnakeParameters &parms);
+
+  /** 
+   * Copy the latest state published by the worker into the snapshot image.
+   * Returns false if nothing has been published since the last call. If the
+   * evolution failed on the worker since the last call, an IRISException 
+   * describing the failure is thrown after the snapshot is updated. The 
+   * worker stays active and waits for the next command
+   */
+  bool UpdateSnapshot();
+
+  /** Get the snapshot of the level set, for use on the calling thread */
+  FloatImageType *GetSnapshot()
+    { return m_DisplaySnapshot; }
+
+  /** Get the number of iterations at the time of the snapshot */
+  unsigned int GetSnapshotIterations() const
+    { return m_DisplaySnapshotIterations; }
   
 private:
   /** An internal class used to invert an image */
@@ -153,6 +214,10 @@ private:
   /** Level set filter wrapped by this object */
   typename FilterType::Pointer m_LevelSetFilter;
 
+  /** The level set filter viewed as a front tracker, or NULL if the solver
+   * does not track the changed voxels */
+  LevelSetFrontTrackingInterface *m_FrontTracker;
+
   /** Level set function used by the level set filter */
   typename LevelSetFunctionType::Pointer m_LevelSetFunction;
 
@@ -167,6 +232,51 @@ private:
 
   /** Internal routines */
   void DoCreateLevelSetFilter();
+
+  /** A command posted to the worker */
+  struct WorkerCommand 
+    {
+    WorkerCommandType Type;
+    unsigned int Iterations;
+    SnakeParameters Parameters;
+    };
+
+  /** Commands waiting for the worker, guarded by the mutex */
+  std::deque<WorkerCommand> m_WorkerQueue;
+  itk::SimpleMutexLock m_WorkerMutex;
+  itk::ConditionVariable::Pointer m_WorkerCondition;
+
+  /** The thread running the evolution */
+  itk::MultiThreader::Pointer m_WorkerThreader;
+  int m_WorkerThreadId;
+
+  /** The state published by the worker, guarded by the mutex, and the copy
+   * of it that is used by the calling thread */
+  FloatImagePointer m_PublishedSnapshot, m_DisplaySnapshot;
+  unsigned int m_PublishedSnapshotIterations, m_DisplaySnapshotIterations;
+  bool m_SnapshotPending;
+
+  /** The voxels of the published snapshot that have changed since the last
+   * update of the display snapshot, unless all of them have */
+  std::vector<unsigned long> m_SnapshotChanges;
+  bool m_SnapshotFull;
+
+  /** The reason the evolution failed on the worker, guarded by the mutex. 
+   * Empty unless there has been a failure since the last UpdateSnapshot() */
+  std::string m_WorkerError;
+
+  /** Record a failure on the worker thread for the calling thread */
+  void SetWorkerError(const char *message);
+
+  /** Copy the current state of the filter into an image */
+  void CopyState(FloatImageType *target);
+
+  /** Publish the current state for the calling thread */
+  void PublishSnapshot();
+
+  /** The loop executed by the worker */
+  void WorkerLoop();
+  static ITK_THREAD_RETURN_TYPE WorkerThreadCallback(void *arg);
 };
 
 // Type definitions
@@ -43,11 +43,14 @@
 
 #include "SNAPLevelSetDriver.h"
 #include "IRISVectorTypesToITKConversion.h"
+#include "IRISException.h"
 
 #include "itkCommand.h"
 #include "itkNarrowBandLevelSetImageFilter.h"
 #include "itkDenseFiniteDifferenceImageFilter.h"
 #include "LevelSetExtensionFilter.h"
+#include "LevelSetFrontTrackingFilter.h"
+#include <algorithm>
 
 #if defined(USE_ITK36_ITK38_SPARSEFIELD_BUGFIX)
 #include "itkParallelSparseFieldLevelSetImageFilterBugFix.h"
@@ -76,6 +79,13 @@ SNAPLevelSetDriver<VDimension>
                      const SnakeParameters &sparms,
                      VectorImageType *externalAdvection)
 {
+  // There is no worker thread until one is requested
+  m_WorkerThreadId = -1;
+  m_SnapshotPending = false;
+  m_SnapshotFull = true;
+  m_PublishedSnapshotIterations = m_DisplaySnapshotIterations = 0;
+  m_FrontTracker = NULL;
+
   // Create the level set function
   m_LevelSetFunction = LevelSetFunctionType::New();
 
@@ -96,6 +106,15 @@ SNAPLevelSetDriver<VDimension>
   DoCreateLevelSetFilter();
 }
 
+template<unsigned int VDimension>
+SNAPLevelSetDriver<VDimension>
+::~SNAPLevelSetDriver()
+{
+  // The worker may not outlive the filter it is running. The filter is not
+  // run again here, since nobody is going to look at its output
+  StopWorker(false);
+}
+
 template<unsigned int VDimension>
 void 
 SNAPLevelSetDriver<VDimension>
@@ -141,6 +160,7 @@ SNAPLevelSetDriver<VDimension>
   // In this method we have the flexibility to create a level set filter
   // of any ITK solver type.  This way, we can plug in different solvers:
   // NarrowBand, ParallelSparseField, even Dense.  
+  m_FrontTracker = NULL;
   if(m_Parameters.GetSolver() == SnakeParameters::PARALLEL_SPARSE_FIELD_SOLVER)
     {
     // Define an extension to the appropriate filter class
@@ -148,13 +168,20 @@ SNAPLevelSetDriver<VDimension>
     typedef itk::ParallelSparseFieldLevelSetImageFilterBugFix<
       FloatImageType, FloatImageType> LevelSetFilterType;
 #else
-    typedef itk::SparseFieldLevelSetImageFilter<
-      FloatImageType, FloatImageType> LevelSetFilterType;
+    typedef LevelSetFrontTrackingFilter<itk::SparseFieldLevelSetImageFilter<
+      FloatImageType, FloatImageType> > LevelSetFilterType;
 #endif
 
     typedef typename LevelSetFilterType::Pointer LevelSetFilterPointer;
     LevelSetFilterPointer filter = LevelSetFilterType::New();
 
+#if !defined(USE_ITK36_ITK38_SPARSEFIELD_BUGFIX)
+    // The filter reports the voxels it changes, so that the snapshots taken
+    // while it runs do not have to copy the whole image
+    m_FrontTracker = filter.GetPointer();
+    m_FrontTracker->SetSkipPostProcessing(IsWorkerActive());
+#endif
+
     // Cast this specific filter down to the lowest common denominator that is
     // a filter
     m_LevelSetFilter = filter.GetPointer();
@@ -282,6 +309,7 @@ SNAPLevelSetDriver<VDimension>
   // function to free memory
   m_LevelSetFilter = NULL;
   m_LevelSetFunction = NULL;
+  m_FrontTracker = NULL;
 }
 
 template<unsigned int VDimension>
@@ -304,5 +332,329 @@ SNAPLevelSetDriver<VDimension>
     }
 }
 
+template<unsigned int VDimension>
+void
+SNAPLevelSetDriver<VDimension>
+::CopyState(FloatImageType *target)
+{
+  FloatImageType *state = GetCurrentState();
+  std::copy(state->GetBufferPointer(), 
+    state->GetBufferPointer() + state->GetBufferedRegion().GetNumberOfPixels(),
+    target->GetBufferPointer());
+  target->Modified();
+}
+
+template<unsigned int VDimension>
+void
+SNAPLevelSetDriver<VDimension>
+::StartWorker()
+{
+  assert(!IsWorkerActive());
+
+  // Allocate the snapshot images, which have the geometry of the level set
+  FloatImageType *state = GetCurrentState();
+  m_PublishedSnapshot = FloatImageType::New();
+  m_DisplaySnapshot = FloatImageType::New();
+  FloatImageType *snapshots[] = { m_PublishedSnapshot, m_DisplaySnapshot };
+  for(unsigned int i = 0; i < 2; i++)
+    {
+    snapshots[i]->CopyInformation(state);
+    snapshots[i]->SetRegions(state->GetBufferedRegion());
+    snapshots[i]->Allocate();
+    }
+
+  // The initial snapshot is the current state
+  CopyState(m_PublishedSnapshot);
+  CopyState(m_DisplaySnapshot);
+  m_DisplaySnapshotIterations = GetElapsedIterations();
+  m_SnapshotPending = false;
+  m_SnapshotFull = false;
+  m_SnapshotChanges.clear();
+
+  // From now on, only the voxels near the front are written by the filter, 
+  // and the snapshots are updated from the list of changed voxels. Away from
+  // the front the values are stale, but their sign is correct, and that is 
+  // all that is displayed
+  if(m_FrontTracker)
+    {
+    m_FrontTracker->SetSkipPostProcessing(true);
+    m_FrontTracker->ClearChangedVoxels();
+    }
+  m_WorkerQueue.clear();
+
+  // Start the worker, which waits for the first command
+  m_WorkerCondition = itk::ConditionVariable::New();
+  m_WorkerThreader = itk::MultiThreader::New();
+  m_WorkerThreadId = m_WorkerThreader->SpawnThread(
+    &SNAPLevelSetDriver::WorkerThreadCallback, this);
+}
+
+template<unsigned int VDimension>
+void
+SNAPLevelSetDriver<VDimension>
+::StopWorker(bool updateSnapshot)
+{
+  if(!IsWorkerActive())
+    return;
+
+  // Drop the pending commands and ask the worker to quit once it is done with
+  // the current block of iterations
+  m_WorkerMutex.Lock();
+  m_WorkerQueue.clear();
+  WorkerCommand cmd;
+  cmd.Type = WORKER_QUIT;
+  cmd.Iterations = 0;
+  m_WorkerQueue.push_back(cmd);
+  m_WorkerCondition->Signal();
+  m_WorkerMutex.Unlock();
+
+  // Wait for the worker to finish
+  m_WorkerThreader->TerminateThread(m_WorkerThreadId);
+  m_WorkerThreadId = -1;
+  m_SnapshotPending = false;
+
+  // Later runs on the calling thread produce the complete level set again
+  if(m_FrontTracker)
+    m_FrontTracker->SetSkipPostProcessing(false);
+
+  // The filter is idle now, so the snapshot can be taken directly
+  if(updateSnapshot && m_LevelSetFilter)
+    {
+    // Let the filter bring the values away from the front up to date
+    if(m_FrontTracker)
+      {
+      m_LevelSetFilter->Modified();
+      Run(0);
+      }
+    CopyState(m_DisplaySnapshot);
+    m_DisplaySnapshotIterations = GetElapsedIterations();
+    }
+}
+
+template<unsigned int VDimension>
+void
+SNAPLevelSetDriver<VDimension>
+::PostCommand(WorkerCommandType command, unsigned int nIterations)
+{
+  assert(IsWorkerActive());
+
+  WorkerCommand cmd;
+  cmd.Type = command;
+  cmd.Iterations = nIterations;
+
+  m_WorkerMutex.Lock();
+  m_WorkerQueue.push_back(cmd);
+  m_WorkerCondition->Signal();
+  m_WorkerMutex.Unlock();
+}
+
+template<unsigned int VDimension>
+void
+SNAPLevelSetDriver<VDimension>
+::PostParameters(const SnakeParameters &parms)
+{
+  assert(IsWorkerActive());
+
+  WorkerCommand cmd;
+  cmd.Type = WORKER_PARAMETERS;
+  cmd.Iterations = 0;
+  cmd.Parameters = parms;
+
+  m_WorkerMutex.Lock();
+  m_WorkerQueue.push_back(cmd);
+  m_WorkerCondition->Signal();
+  m_WorkerMutex.Unlock();
+}
+
+template<unsigned int VDimension>
+void
+SNAPLevelSetDriver<VDimension>
+::PublishSnapshot()
+{
+  // Called on the worker thread
+  m_WorkerMutex.Lock();
+  if(!m_FrontTracker || m_FrontTracker->IsFullyChanged())
+    {
+    CopyState(m_PublishedSnapshot);
+    m_SnapshotChanges.clear();
+    m_SnapshotFull = true;
+    }
+  else
+    {
+    // Only copy the voxels that the filter may have changed
+    const std::vector<unsigned long> &changed = 
+      m_FrontTracker->GetChangedVoxels();
+    const float *src = GetCurrentState()->GetBufferPointer();
+    float *trg = m_PublishedSnapshot->GetBufferPointer();
+    for(size_t i = 0; i < changed.size(); i++)
+      trg[changed[i]] = src[changed[i]];
+    m_PublishedSnapshot->Modified();
+
+    // The display snapshot may not have seen the previous changes yet
+    if(!m_SnapshotFull)
+      m_SnapshotChanges.insert(
+        m_SnapshotChanges.end(), changed.begin(), changed.end());
+    }
+  m_PublishedSnapshotIterations = GetElapsedIterations();
+  m_SnapshotPending = true;
+  m_WorkerMutex.Unlock();
+
+  // Start collecting the changes for the next snapshot
+  if(m_FrontTracker)
+    m_FrontTracker->ClearChangedVoxels();
+}
+
+template<unsigned int VDimension>
+bool
+SNAPLevelSetDriver<VDimension>
+::UpdateSnapshot()
+{
+  assert(IsWorkerActive());
+
+  bool updated = false;
+  std::string error;
+  m_WorkerMutex.Lock();
+  if(m_SnapshotPending)
+    {
+    const float *src = m_PublishedSnapshot->GetBufferPointer();
+    float *trg = m_DisplaySnapshot->GetBufferPointer();
+    if(m_SnapshotFull)
+      {
+      std::copy(src, 
+        src + m_PublishedSnapshot->GetBufferedRegion().GetNumberOfPixels(),
+        trg);
+      }
+    else
+      {
+      for(size_t i = 0; i < m_SnapshotChanges.size(); i++)
+        trg[m_SnapshotChanges[i]] = src[m_SnapshotChanges[i]];
+      }
+    m_SnapshotChanges.clear();
+    m_SnapshotFull = false;
+    m_DisplaySnapshot->Modified();
+    m_DisplaySnapshotIterations = m_PublishedSnapshotIterations;
+    m_SnapshotPending = false;
+    updated = true;
+    }
+  error.swap(m_WorkerError);
+  m_WorkerMutex.Unlock();
+
+  if(error.size())
+    throw IRISException("Level set evolution failed.\n%s", error.c_str());
+  return updated;
+}
+
+template<unsigned int VDimension>
+void
+SNAPLevelSetDriver<VDimension>
+::SetWorkerError(const char *message)
+{
+  // Called on the worker thread
+  m_WorkerMutex.Lock();
+  m_WorkerError = message;
+  m_WorkerMutex.Unlock();
+}
+
+template<unsigned int VDimension>
+void
+SNAPLevelSetDriver<VDimension>
+::WorkerLoop()
+{
+  bool running = false;
+  unsigned int nBlock = 1;
+  while(true)
+    {
+    // Take the next command. If the evolution is not running, wait for one
+    WorkerCommand cmd;
+    bool haveCommand = false;
+    bool pending;
+    m_WorkerMutex.Lock();
+    while(!running && m_WorkerQueue.empty())
+      m_WorkerCondition->Wait(&m_WorkerMutex);
+    if(!m_WorkerQueue.empty())
+      {
+      cmd = m_WorkerQueue.front();
+      m_WorkerQueue.pop_front();
+      haveCommand = true;
+      }
+    pending = m_SnapshotPending;
+    m_WorkerMutex.Unlock();
+
+    try
+      {
+      if(!haveCommand)
+        {
+        // Run the next block of iterations. The state is only copied once the
+        // previous snapshot has been picked up, so that the worker does not
+        // spend its time making copies nobody looks at
+        Run(nBlock);
+        if(!pending)
+          PublishSnapshot();
+        continue;
+        }
+
+      switch(cmd.Type)
+        {
+        case WORKER_QUIT:
+          return;
+
+        case WORKER_PLAY:
+          running = true;
+          nBlock = std::max(1u, cmd.Iterations);
+          break;
+
+        case WORKER_PAUSE:
+          // Make sure that the last iterations become visible
+          running = false;
+          PublishSnapshot();
+          break;
+
+        case WORKER_STEP:
+          running = false;
+          Run(std::max(1u, cmd.Iterations));
+          PublishSnapshot();
+          break;
+
+        case WORKER_RESTART:
+          running = false;
+          Restart();
+          PublishSnapshot();
+          break;
+
+        case WORKER_PARAMETERS:
+          SetSnakeParameters(cmd.Parameters);
+          break;
+        }
+      }
+    catch(itk::ExceptionObject &exc)
+      {
+      SetWorkerError(exc.GetDescription());
+      running = false;
+      }
+    catch(std::exception &exc)
+      {
+      SetWorkerError(exc.what());
+      running = false;
+      }
+    catch(...)
+      {
+      SetWorkerError("Unknown error");
+      running = false;
+      }
+    }
+}
+
+template<unsigned int VDimension>
+ITK_THREAD_RETURN_TYPE
+SNAPLevelSetDriver<VDimension>
+::WorkerThreadCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info = 
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  SNAPLevelSetDriver *self = static_cast<SNAPLevelSetDriver *>(info->UserData);
+  self->WorkerLoop();
+  return ITK_THREAD_RETURN_VALUE;
+}
+
 #endif
 
@@ -43,6 +43,9 @@
 // #include "itkGradientImageFilter.h"
 
 #include "SNAPAdvectionFieldImageFilter.h"
+#include "itkSimpleFastMutexLock.h"
+#include <vector>
+#include <set>
 
 /**
   \class SNAPLevelSetFunction
@@ -155,6 +158,38 @@ public:
 
   /** Compute speed and advection images from feature image. */
   virtual void CalculateInternalImages();
+
+  /** Whether the speed terms are read from per-voxel records that hold all
+      of them, rather than from separate interpolated images. The records 
+      are computed from g() on demand, in blocks, as the front reaches them,
+      so that no full-size images are computed. This is on by default. The 
+      change takes effect at the next call to CalculateInternalImages() */
+  void SetUseSpeedRecords(bool flag)
+    {
+    m_UseSpeedRecords = flag;
+    }
+
+  bool GetUseSpeedRecords() const
+    {
+    return m_UseSpeedRecords;
+    }
+
+  /** Set the number of blocks of speed records that are kept in memory.
+      Blocks that have not been used recently are discarded between 
+      iterations to stay within this number, but the blocks that the front
+      is in are always kept */
+  void SetMaximumSpeedRecordBlocks(unsigned int n)
+    {
+    m_MaximumSpeedRecordBlocks = n;
+    }
+
+  unsigned int GetMaximumSpeedRecordBlocks() const
+    {
+    return m_MaximumSpeedRecordBlocks;
+    }
+
+  /** Called by the solver before each iteration */
+  virtual void InitializeIteration();
                                                                                 
   /** Local multiplier for the curvature term */
   virtual ScalarValueType CurvatureSpeed(
@@ -254,6 +289,13 @@ public:
       : m_TimeStepFactor * Superclass::ComputeGlobalTimeStep(GlobalData); 
     }
 
+  /** Create the data of a solver thread. Besides the data of the parent 
+      class, it holds the speed record blocks that the thread has used */
+  virtual void *GetGlobalDataPointer() const;
+
+  /** Release the data of a solver thread */
+  virtual void ReleaseGlobalDataPointer(void *GlobalData) const;
+
 protected:
 
   SNAPLevelSetFunction();
@@ -308,6 +350,138 @@ private:
 
   /** The constant time step */
   TimeStepType m_TimeStepFactor;
+
+  /** Position of each speed term in the per-voxel record */
+  enum SpeedRecordField {
+    PROPAGATION_FIELD = 0, CURVATURE_FIELD, LAPLACIAN_FIELD, ADVECTION_FIELD,
+    SPEED_RECORD_SIZE = 8 };
+
+  /** All the speed terms at a voxel, padded so that two records share a
+      cache line and a record never straddles two of them */
+  struct SpeedRecord 
+    {
+    ScalarValueType Value[SPEED_RECORD_SIZE];
+    };
+
+  /** Blocks of records are cubes with sides of 2^SPEED_BLOCK_BITS voxels */
+  enum SpeedRecordBlockLayout {
+    SPEED_BLOCK_BITS = 4, SPEED_BLOCK_MASK = (1 << SPEED_BLOCK_BITS) - 1 };
+
+  /** A block of records, in x-fastest order, and the memory holding them 
+      (with room for the alignment) */
+  struct SpeedRecordBlock
+    {
+    SpeedRecord *Records;
+    std::vector<char> Buffer;
+    unsigned long LastUse;
+    };
+
+  /** The number of blocks each thread remembers */
+  enum SpeedRecordCacheLayout { SPEED_CACHE_SIZE = 64 };
+
+  /** The data of a solver thread. The blocks the thread has looked up in 
+      this iteration are cached, so that most lookups take no lock, and they
+      are listed, so that InitializeIteration() can mark them as used */
+  struct SpeedRecordGlobalData : public GlobalDataStruct
+    {
+    unsigned long CacheIndex[SPEED_CACHE_SIZE];
+    SpeedRecordBlock *CacheBlock[SPEED_CACHE_SIZE];
+    std::vector<unsigned long> Used;
+
+    void ClearCache()
+      {
+      for(unsigned int k = 0; k < SPEED_CACHE_SIZE; k++)
+        CacheBlock[k] = NULL;
+      }
+    };
+
+  /** Whether the records are used, and whether they are in use now */
+  bool m_UseSpeedRecords, m_SpeedRecordsActive;
+
+  /** The table of blocks covering the speed image. Blocks that have not 
+      been computed yet are NULL. While the solver runs, the table is only 
+      read and written under the mutex. Blocks are only removed between 
+      iterations, when no thread is evaluating the function, so the blocks 
+      cached by the threads stay valid until then */
+  SpeedRecordBlock **m_SpeedRecordBlocks;
+  unsigned long m_SpeedRecordBlockTableSize;
+  mutable unsigned int m_NumberOfSpeedRecordBlocks;
+  mutable itk::SimpleFastMutexLock m_SpeedRecordMutex;
+  unsigned int m_MaximumSpeedRecordBlocks;
+
+  /** The current iteration, used to find the least recently used blocks */
+  unsigned long m_SpeedRecordIteration;
+
+  /** The data of the threads, and the blocks used by the threads whose data
+      has been released in this iteration. Both are guarded by the mutex */
+  mutable std::set<SpeedRecordGlobalData *> m_SpeedRecordThreadData;
+  mutable std::vector<unsigned long> m_SpeedRecordReleasedUse;
+
+  /** The region of the speed image covered by the records, and the layout 
+      of the blocks */
+  IndexType m_SpeedRecordIndex;
+  typename ImageType::SizeType m_SpeedRecordSize;
+  unsigned long m_SpeedRecordBlockStride[ImageDimension];
+
+  /** Free all the blocks */
+  void ClearSpeedRecordBlocks();
+
+  /** Mark the listed blocks as used in this iteration, and clear the list */
+  void MarkSpeedRecordBlocksUsed(std::vector<unsigned long> &used);
+
+  /** Find a block in the table, computing it if needed. The use of the block
+      is recorded in the thread data, if there is any */
+  SpeedRecordBlock *LookupSpeedRecordBlock(
+    unsigned long iBlock, SpeedRecordGlobalData *td) const;
+
+  /** Compute the records of a block, from the speed image, and add it to the
+      table. The mutex must be held */
+  SpeedRecordBlock *ComputeSpeedRecordBlock(unsigned long iBlock) const;
+
+  /** Take g() to a power, avoiding pow() for the common powers */
+  static inline ScalarValueType SpeedPower(ScalarValueType g, int exponent)
+    {
+    switch(exponent)
+      {
+      case 0 : return itk::NumericTraits<ScalarValueType>::One;
+      case 1 : return g;
+      case 2 : return g * g;
+      default : return static_cast<ScalarValueType>(vcl_pow(g, exponent));
+      }
+    }
+
+  /** Get the record at a position relative to the corner of the image,
+      using the block cache of the thread if there is one */
+  inline const SpeedRecord &GetSpeedRecord(
+    const long *pos, GlobalDataStruct *gd) const
+    {
+    unsigned long iBlock = 0, iRecord = 0;
+    for(unsigned int i = 0; i < ImageDimension; i++)
+      {
+      iBlock += (pos[i] >> SPEED_BLOCK_BITS) * m_SpeedRecordBlockStride[i];
+      iRecord += (pos[i] & SPEED_BLOCK_MASK) << (SPEED_BLOCK_BITS * i);
+      }
+
+    SpeedRecordGlobalData *td = static_cast<SpeedRecordGlobalData *>(gd);
+    if(!td)
+      return LookupSpeedRecordBlock(iBlock, NULL)->Records[iRecord];
+
+    unsigned int slot = 
+      (iBlock ^ (iBlock >> 6) ^ (iBlock >> 12)) & (SPEED_CACHE_SIZE - 1);
+    if(!td->CacheBlock[slot] || td->CacheIndex[slot] != iBlock)
+      {
+      td->CacheBlock[slot] = LookupSpeedRecordBlock(iBlock, td);
+      td->CacheIndex[slot] = iBlock;
+      }
+    return td->CacheBlock[slot]->Records[iRecord];
+    }
+
+  /** Get the fields [first, first + n) of the records at (idx - offset), 
+      interpolating linearly between voxels if the offset is not zero */
+  void EvaluateSpeedRecord(
+    const IndexType &idx, const FloatOffsetType &offset, 
+    unsigned int first, unsigned int n, ScalarValueType *out,
+    GlobalDataStruct *gd) const;
   
   /** A trivial functor to square the g() image */
   class SquareFunctor
@@ -39,6 +39,7 @@
 #include "itkNumericTraits.h"
 
 #include <map>
+#include <algorithm>
 
 template<class TImageType>
 SNAPLevelSetFunction<TImageType>
@@ -52,6 +53,13 @@ SNAPLevelSetFunction<TImageType>
   m_PropagationSpeedExponent = 0;
   m_LaplacianSmoothingSpeedExponent = 0;
   m_UseExternalAdvectionField = false;
+  m_UseSpeedRecords = true;
+  m_SpeedRecordsActive = false;
+  m_SpeedRecordBlocks = NULL;
+  m_SpeedRecordBlockTableSize = 0;
+  m_NumberOfSpeedRecordBlocks = 0;
+  m_MaximumSpeedRecordBlocks = 2048;
+  m_SpeedRecordIteration = 0;
 
   m_PropagationSpeedInterpolator = ImageInterpolatorType::New();
   m_CurvatureSpeedInterpolator = ImageInterpolatorType::New();
@@ -65,7 +73,7 @@ template<class TImageType>
 SNAPLevelSetFunction<TImageType>
 ::~SNAPLevelSetFunction()
 {
-
+  ClearSpeedRecordBlocks();
 }
 
 template<class TImageType>
@@ -93,6 +101,49 @@ void
 SNAPLevelSetFunction<TImageType>
 ::CalculateInternalImages()
 {
+  // Any records computed so far are out of date
+  ClearSpeedRecordBlocks();
+
+  // With the speed records, nothing is computed up front. The records are
+  // computed from g() when they are first used, a block at a time
+  if(m_UseSpeedRecords)
+    {
+    // Release the images used by the interpolators, if any
+    m_PropagationSpeedImage = NULL;
+    m_CurvatureSpeedImage = NULL;
+    m_LaplacianSmoothingSpeedImage = NULL;
+    m_PropagationSpeedInterpolator->SetInputImage(NULL);
+    m_CurvatureSpeedInterpolator->SetInputImage(NULL);
+    m_LaplacianSmoothingSpeedInterpolator->SetInputImage(NULL);
+    m_AdvectionFieldInterpolator->SetInputImage(NULL);
+    if(!m_UseExternalAdvectionField)
+      {
+      m_AdvectionField = NULL;
+      m_AdvectionFilter->GetOutput()->ReleaseData();
+      }
+
+    // The records cover the buffer of the speed image, which is also the 
+    // buffer of the external advection field
+    typename ImageType::RegionType region = m_SpeedImage->GetBufferedRegion();
+    m_SpeedRecordIndex = region.GetIndex();
+    m_SpeedRecordSize = region.GetSize();
+
+    // Lay out the table of blocks
+    m_SpeedRecordBlockTableSize = 1;
+    for(unsigned int i = 0; i < ImageDimension; i++)
+      {
+      m_SpeedRecordBlockStride[i] = m_SpeedRecordBlockTableSize;
+      m_SpeedRecordBlockTableSize *= 
+        (m_SpeedRecordSize[i] + SPEED_BLOCK_MASK) >> SPEED_BLOCK_BITS;
+      }
+    m_SpeedRecordBlocks = new SpeedRecordBlock *[m_SpeedRecordBlockTableSize];
+    for(unsigned long b = 0; b < m_SpeedRecordBlockTableSize; b++)
+      m_SpeedRecordBlocks[b] = NULL;
+
+    m_SpeedRecordsActive = true;
+    return;
+    }
+
   // Create a map of integers to image pointers.  This map will cache the 
   // different powers of g() that must be computed (hopefully none!)
   typedef std::map<int,ImagePointer> PowerMapType;
@@ -204,18 +255,320 @@ SNAPLevelSetFunction<TImageType>
   m_AdvectionFieldInterpolator->SetInputImage(m_AdvectionField);
 }
 
+template<class TImageType>
+void
+SNAPLevelSetFunction<TImageType>
+::ClearSpeedRecordBlocks()
+{
+  for(unsigned long b = 0; b < m_SpeedRecordBlockTableSize; b++)
+    delete m_SpeedRecordBlocks[b];
+  delete[] m_SpeedRecordBlocks;
+
+  m_SpeedRecordBlocks = NULL;
+  m_SpeedRecordBlockTableSize = 0;
+  m_NumberOfSpeedRecordBlocks = 0;
+  m_SpeedRecordsActive = false;
+
+  // The threads must not hold on to the deleted blocks
+  typename std::set<SpeedRecordGlobalData *>::iterator it;
+  for(it = m_SpeedRecordThreadData.begin(); 
+    it != m_SpeedRecordThreadData.end(); ++it)
+    {
+    (*it)->ClearCache();
+    (*it)->Used.clear();
+    }
+  m_SpeedRecordReleasedUse.clear();
+}
+
+template<class TImageType>
+void *
+SNAPLevelSetFunction<TImageType>
+::GetGlobalDataPointer() const
+{
+  // Start from the data of the parent class
+  GlobalDataStruct *gd = 
+    static_cast<GlobalDataStruct *>(Superclass::GetGlobalDataPointer());
+  SpeedRecordGlobalData *td = new SpeedRecordGlobalData;
+  static_cast<GlobalDataStruct &>(*td) = *gd;
+  Superclass::ReleaseGlobalDataPointer(gd);
+  td->ClearCache();
+
+  m_SpeedRecordMutex.Lock();
+  m_SpeedRecordThreadData.insert(td);
+  m_SpeedRecordMutex.Unlock();
+
+  return static_cast<GlobalDataStruct *>(td);
+}
+
+template<class TImageType>
+void
+SNAPLevelSetFunction<TImageType>
+::ReleaseGlobalDataPointer(void *GlobalData) const
+{
+  // Keep the list of the blocks used by the thread for the next call to
+  // InitializeIteration()
+  SpeedRecordGlobalData *td = static_cast<SpeedRecordGlobalData *>(
+    static_cast<GlobalDataStruct *>(GlobalData));
+
+  m_SpeedRecordMutex.Lock();
+  m_SpeedRecordThreadData.erase(td);
+  m_SpeedRecordReleasedUse.insert(
+    m_SpeedRecordReleasedUse.end(), td->Used.begin(), td->Used.end());
+  m_SpeedRecordMutex.Unlock();
+
+  delete td;
+}
+
+template<class TImageType>
+typename SNAPLevelSetFunction<TImageType>::SpeedRecordBlock *
+SNAPLevelSetFunction<TImageType>
+::LookupSpeedRecordBlock(unsigned long iBlock, SpeedRecordGlobalData *td) const
+{
+  // Blocks are computed one at a time, under the mutex. Without thread data 
+  // the use of the block is recorded right away, since the mutex is held
+  m_SpeedRecordMutex.Lock();
+  SpeedRecordBlock *block = m_SpeedRecordBlocks[iBlock];
+  if(!block)
+    block = ComputeSpeedRecordBlock(iBlock);
+  if(!td)
+    block->LastUse = m_SpeedRecordIteration;
+  m_SpeedRecordMutex.Unlock();
+
+  if(td)
+    td->Used.push_back(iBlock);
+
+  return block;
+}
+
+template<class TImageType>
+typename SNAPLevelSetFunction<TImageType>::SpeedRecordBlock *
+SNAPLevelSetFunction<TImageType>
+::ComputeSpeedRecordBlock(unsigned long iBlock) const
+{
+  // Allocate the records on a cache line boundary
+  const unsigned long nRecords = 1ul << (SPEED_BLOCK_BITS * ImageDimension);
+  const size_t align = 64;
+  SpeedRecordBlock *block = new SpeedRecordBlock;
+  block->Buffer.resize(nRecords * sizeof(SpeedRecord) + align);
+  size_t addr = reinterpret_cast<size_t>(&block->Buffer[0]);
+  block->Records = reinterpret_cast<SpeedRecord *>(
+    &block->Buffer[(align - addr % align) % align]);
+  block->LastUse = m_SpeedRecordIteration;
+
+  // Find the first voxel of the block
+  long corner[ImageDimension];
+  unsigned long rest = iBlock;
+  for(int i = ImageDimension - 1; i >= 0; i--)
+    {
+    corner[i] = (rest / m_SpeedRecordBlockStride[i]) << SPEED_BLOCK_BITS;
+    rest %= m_SpeedRecordBlockStride[i];
+    }
+
+  const typename ImageType::PixelType *g = m_SpeedImage->GetBufferPointer();
+  const typename ImageType::OffsetValueType *stride = 
+    m_SpeedImage->GetOffsetTable();
+  typename ImageType::SpacingType spacing = m_SpeedImage->GetSpacing();
+  const VectorType *adv = m_UseExternalAdvectionField 
+    ? m_AdvectionField->GetBufferPointer() : NULL;
+
+  for(unsigned long r = 0; r < nRecords; r++)
+    {
+    // Records that fall past the edge of the image are never read, but they
+    // are filled from the edge anyway
+    long pos[ImageDimension];
+    typename ImageType::OffsetValueType offset = 0;
+    for(unsigned int i = 0; i < ImageDimension; i++)
+      {
+      long j = corner[i] + ((r >> (SPEED_BLOCK_BITS * i)) & SPEED_BLOCK_MASK);
+      long jMax = static_cast<long>(m_SpeedRecordSize[i]) - 1;
+      pos[i] = j > jMax ? jMax : j;
+      offset += pos[i] * stride[i];
+      }
+
+    ScalarValueType gx = static_cast<ScalarValueType>(g[offset]);
+    ScalarValueType *trg = block->Records[r].Value;
+    trg[PROPAGATION_FIELD] = SpeedPower(gx, m_PropagationSpeedExponent);
+    trg[CURVATURE_FIELD] = SpeedPower(gx, m_CurvatureSpeedExponent);
+    trg[LAPLACIAN_FIELD] = SpeedPower(gx, m_LaplacianSmoothingSpeedExponent);
+
+    if(adv)
+      {
+      for(unsigned int i = 0; i < ImageDimension; i++)
+        trg[ADVECTION_FIELD + i] = static_cast<ScalarValueType>(adv[offset][i]);
+      }
+    else
+      {
+      // The gradient of g() scaled by a power of g(), computed with central
+      // differences and zero flux at the edges, like the advection filter 
+      ScalarValueType ga = SpeedPower(gx, m_AdvectionSpeedExponent);
+      for(unsigned int i = 0; i < ImageDimension; i++)
+        {
+        ScalarValueType gf = pos[i] < (long) m_SpeedRecordSize[i] - 1 
+          ? static_cast<ScalarValueType>(g[offset + stride[i]]) : gx;
+        ScalarValueType gb = pos[i] > 0 
+          ? static_cast<ScalarValueType>(g[offset - stride[i]]) : gx;
+        trg[ADVECTION_FIELD + i] = static_cast<ScalarValueType>(
+          ga * 0.5 * (gf - gb) / spacing[i]);
+        }
+      }
+
+    for(unsigned int i = ADVECTION_FIELD + ImageDimension; 
+      i < SPEED_RECORD_SIZE; i++)
+      trg[i] = itk::NumericTraits<ScalarValueType>::Zero;
+    }
+
+  m_NumberOfSpeedRecordBlocks++;
+  m_SpeedRecordBlocks[iBlock] = block;
+
+  return block;
+}
+
+template<class TImageType>
+void
+SNAPLevelSetFunction<TImageType>
+::MarkSpeedRecordBlocksUsed(std::vector<unsigned long> &used)
+{
+  for(size_t k = 0; k < used.size(); k++)
+    if(m_SpeedRecordBlocks[used[k]])
+      m_SpeedRecordBlocks[used[k]]->LastUse = m_SpeedRecordIteration;
+  used.clear();
+}
+
+template<class TImageType>
+void
+SNAPLevelSetFunction<TImageType>
+::InitializeIteration()
+{
+  Superclass::InitializeIteration();
+
+  // No thread is evaluating the function now. Collect the blocks that the 
+  // threads used in the last iteration, and empty their caches, since the 
+  // blocks may be discarded below
+  if(m_SpeedRecordsActive)
+    {
+    typename std::set<SpeedRecordGlobalData *>::iterator it;
+    for(it = m_SpeedRecordThreadData.begin(); 
+      it != m_SpeedRecordThreadData.end(); ++it)
+      {
+      MarkSpeedRecordBlocksUsed((*it)->Used);
+      (*it)->ClearCache();
+      }
+    MarkSpeedRecordBlocksUsed(m_SpeedRecordReleasedUse);
+    }
+
+  // This is the time to discard
+  // the blocks that have not been used recently. The blocks used in the last
+  // iteration are the ones the front is in, and they are always kept. Some 
+  // room is freed up, so that this does not happen at every iteration
+  if(m_SpeedRecordsActive && 
+    m_NumberOfSpeedRecordBlocks > m_MaximumSpeedRecordBlocks)
+    {
+    typedef std::pair<unsigned long, unsigned long> UseType;
+    std::vector<UseType> used;
+    for(unsigned long b = 0; b < m_SpeedRecordBlockTableSize; b++)
+      if(m_SpeedRecordBlocks[b] && 
+        m_SpeedRecordBlocks[b]->LastUse < m_SpeedRecordIteration)
+        used.push_back(UseType(m_SpeedRecordBlocks[b]->LastUse, b));
+    std::sort(used.begin(), used.end());
+
+    unsigned int target = 
+      m_MaximumSpeedRecordBlocks - m_MaximumSpeedRecordBlocks / 4;
+    for(size_t k = 0; 
+      k < used.size() && m_NumberOfSpeedRecordBlocks > target; k++)
+      {
+      delete m_SpeedRecordBlocks[used[k].second];
+      m_SpeedRecordBlocks[used[k].second] = NULL;
+      m_NumberOfSpeedRecordBlocks--;
+      }
+    }
+
+  m_SpeedRecordIteration++;
+}
+
+template<class TImageType>
+void
+SNAPLevelSetFunction<TImageType>
+::EvaluateSpeedRecord(const IndexType &idx, const FloatOffsetType &offset,
+                      unsigned int first, unsigned int n, 
+                      ScalarValueType *out, GlobalDataStruct *gd) const
+{
+  // At a voxel center there is just one record to read
+  bool integer = true;
+  for(unsigned int i = 0; i < ImageDimension; i++)
+    if(offset[i] != 0.0) 
+      integer = false;
+
+  if(integer)
+    {
+    long pos[ImageDimension];
+    for(unsigned int i = 0; i < ImageDimension; i++)
+      pos[i] = idx[i] - m_SpeedRecordIndex[i];
+    const ScalarValueType *rec = GetSpeedRecord(pos, gd).Value + first;
+    for(unsigned int k = 0; k < n; k++)
+      out[k] = rec[k];
+    return;
+    }
+
+  // Otherwise, find the cell of voxels containing the point and the position
+  // of the point in it
+  long base[ImageDimension];
+  double frac[ImageDimension];
+  for(unsigned int i = 0; i < ImageDimension; i++)
+    {
+    double x = static_cast<double>(idx[i] - m_SpeedRecordIndex[i]) - offset[i];
+    double xFloor = vcl_floor(x);
+    base[i] = static_cast<long>(xFloor);
+    frac[i] = x - xFloor;
+    }
+
+  for(unsigned int k = 0; k < n; k++)
+    out[k] = itk::NumericTraits<ScalarValueType>::Zero;
+
+  // Blend the records at the corners of the cell. Corners outside of the 
+  // image are moved to its edge
+  for(unsigned int c = 0; c < (1u << ImageDimension); c++)
+    {
+    double w = 1.0;
+    long pos[ImageDimension];
+    for(unsigned int i = 0; i < ImageDimension; i++)
+      {
+      unsigned int bit = (c >> i) & 1;
+      w *= bit ? frac[i] : 1.0 - frac[i];
+      long j = base[i] + bit;
+      long jMax = static_cast<long>(m_SpeedRecordSize[i]) - 1;
+      pos[i] = j < 0 ? 0 : (j > jMax ? jMax : j);
+      }
+
+    if(w == 0.0)
+      continue;
+
+    const ScalarValueType *rec = GetSpeedRecord(pos, gd).Value + first;
+    for(unsigned int k = 0; k < n; k++)
+      out[k] += static_cast<ScalarValueType>(w * rec[k]);
+    }
+}
+
 
 template<class TImageType>
 typename SNAPLevelSetFunction<TImageType>::ScalarValueType
 SNAPLevelSetFunction<TImageType>
 ::CurvatureSpeed(const NeighborhoodType &neighborhood, 
                  const FloatOffsetType &offset,
-                 GlobalDataStruct *) const 
+                 GlobalDataStruct *gd) const 
 {
   // If the exponent is zero, there is nothing to return
   if(m_CurvatureSpeedExponent == 0)
     return itk::NumericTraits<ScalarValueType>::One; 
   
+  // Read the term from the records if they are available
+  if(m_SpeedRecordsActive)
+    {
+    ScalarValueType value;
+    EvaluateSpeedRecord(
+      neighborhood.GetIndex(), offset, CURVATURE_FIELD, 1, &value, gd);
+    return value;
+    }
+
   // Otherwise, perform interpolation on the image
   IndexType idx = neighborhood.GetIndex();
   ContinuousIndexType cdx;
@@ -236,13 +589,21 @@ typename SNAPLevelSetFunction<TImageType>::ScalarValueType
 SNAPLevelSetFunction<TImageType>
 ::PropagationSpeed(const NeighborhoodType &neighborhood, 
                    const FloatOffsetType &offset,
-                   GlobalDataStruct *) const 
+                   GlobalDataStruct *gd) const 
 {
   // If the exponent is zero, there is nothing to return
   if(m_PropagationSpeedExponent == 0)
     return itk::NumericTraits<ScalarValueType>::One; 
-
   
+  // Read the term from the records if they are available
+  if(m_SpeedRecordsActive)
+    {
+    ScalarValueType value;
+    EvaluateSpeedRecord(
+      neighborhood.GetIndex(), offset, PROPAGATION_FIELD, 1, &value, gd);
+    return value;
+    }
+
   // Otherwise, perform interpolation on the image
   IndexType idx = neighborhood.GetIndex();
   ContinuousIndexType cdx;
@@ -263,12 +624,21 @@ typename SNAPLevelSetFunction<TImageType>::ScalarValueType
 SNAPLevelSetFunction<TImageType>
 ::LaplacianSmoothingSpeed(const NeighborhoodType &neighborhood, 
                           const FloatOffsetType &offset,
-                          GlobalDataStruct *) const 
+                          GlobalDataStruct *gd) const 
 {
   // If the exponent is zero, there is nothing to return
   if(m_LaplacianSmoothingSpeedExponent == 0)
     return itk::NumericTraits<ScalarValueType>::One; 
   
+  // Read the term from the records if they are available
+  if(m_SpeedRecordsActive)
+    {
+    ScalarValueType value;
+    EvaluateSpeedRecord(
+      neighborhood.GetIndex(), offset, LAPLACIAN_FIELD, 1, &value, gd);
+    return value;
+    }
+
   // Otherwise, perform interpolation on the image
   IndexType idx = neighborhood.GetIndex();
   ContinuousIndexType cdx;
@@ -289,8 +659,20 @@ typename SNAPLevelSetFunction<TImageType>::VectorType
 SNAPLevelSetFunction<TImageType>
 ::AdvectionField(const NeighborhoodType &neighborhood,
                  const FloatOffsetType &offset,
-                 GlobalDataStruct *) const
+                 GlobalDataStruct *gd) const
 {
+  // Read the field from the records if they are available
+  if(m_SpeedRecordsActive)
+    {
+    ScalarValueType value[ImageDimension];
+    EvaluateSpeedRecord(neighborhood.GetIndex(), offset, 
+      ADVECTION_FIELD, ImageDimension, value, gd);
+    VectorType v;
+    for(unsigned int i = 0; i < ImageDimension; i++)
+      v[i] = value[i];
+    return v;
+    }
+
   IndexType idx = neighborhood.GetIndex();
   typedef typename VectorInterpolatorType::ContinuousIndexType VectorContinuousIndexType;
   VectorContinuousIndexType cdx;
@@ -45,9 +45,9 @@
 #include "VTKMeshPipeline.h"
 
 // ITK includes
+#include "itkOrientedImage.h"
 #include "itkRegionOfInterestImageFilter.h"
 #include "itkBinaryThresholdImageFilter.h"
-#include "itkImageRegionConstIteratorWithIndex.h"
 
 using namespace std;
 
@@ -92,64 +92,13 @@ unsigned long
 IRISMeshPipeline
 ::ComputeBoundingBoxes()
 {
-  unsigned int i;
-  unsigned long nTotalVoxels = 0;
+  // Compute the histogram and the bounding boxes in one pass
+  m_LabelRegions.Compute(m_InputImage);
 
-  // Get the dimensions of the image
-  InputImageType::SizeType size = 
-    m_InputImage->GetLargestPossibleRegion().GetSize();
-
-  // These vectors represent the extents of the image.  
-  Vector3l extLower(0l);
-  Vector3l extUpper = 
-    Vector3l(reinterpret_cast<const long *>(size.GetSize())) - Vector3l(1l);
-
-  // For each intensity present in the image, we will compute a bounding
-  // box.  Intialize a list of bounding boxes with 'inverted' boxes
-  Vector3l bbMin[MAX_COLOR_LABELS];
-  Vector3l bbMax[MAX_COLOR_LABELS];
-
-  // Initialize the histogram and bounding boxes
-  for(i=1;i<MAX_COLOR_LABELS;i++)
-    {
-    m_Histogram[i] = 0l;
-    bbMin[i] = extUpper;
-    bbMax[i] = extLower;
-    }
-
-  // Create an iterator for parsing the image
-  typedef itk::ImageRegionConstIteratorWithIndex<InputImageType> InputIterator;
-  InputIterator it(m_InputImage,m_InputImage->GetLargestPossibleRegion());
-
-  // Parse through the image using an iterator and compute the bounding boxes
-  for(it.GoToBegin();!it.IsAtEnd();++it)
-    {
-    // Get the intensity at current pixel
-    LabelType label = it.Value();
-
-    // For non-zero labels, compute the bounding box
-    if(label != 0)
-      {
-      // Increment the histogram
-      m_Histogram[label]++;
-
-      // Get the current image index
-      Vector3l point(it.GetIndex().GetIndex());
-
-      // Update the bounding box extents
-      bbMin[label] = vector_min(bbMin[label],point);
-      bbMax[label] = vector_max(bbMax[label],point);        
-      }
-    }
-
-  // Convert the bounding box to a region
-  for(i=1;i<MAX_COLOR_LABELS;i++)
-    {
-    Vector3l bbSize = Vector3l(1l) + bbMax[i] - bbMin[i];
-    m_BoundingBox[i].SetSize(to_itkSize(bbSize));
-    m_BoundingBox[i].SetIndex(to_itkIndex(bbMin[i]));
-    nTotalVoxels += m_BoundingBox[i].GetNumberOfPixels();
-    }  
+  // Add up the sizes of the boxes of the labels present in the image
+  unsigned long nTotalVoxels = 0;
+  for(unsigned int i=1;i<MAX_COLOR_LABELS;i++)
+    nTotalVoxels += GetVoxelsInBoundingBox(i);
 
   return nTotalVoxels;
 }
@@ -158,7 +107,7 @@ unsigned long
 IRISMeshPipeline
 ::GetVoxelsInBoundingBox(LabelType label) const
 {
-  return m_BoundingBox[label].GetNumberOfPixels();
+  return m_LabelRegions.GetBoundingBox(label).GetNumberOfPixels();
 }
 
 AllPurposeProgressAccumulator *
@@ -176,11 +125,12 @@ IRISMeshPipeline
 ::ComputeMesh(LabelType label, vtkPolyData *outMesh)
 {
   // The label must be present in the image
-  if(m_Histogram[label] == 0)
+  if(m_LabelRegions.GetCount(label) == 0)
     return false;
 
   // TODO: make this more elegant
-  InputImageType::RegionType bbWiderRegion = m_BoundingBox[label];
+  InputImageType::RegionType bbWiderRegion = 
+    m_LabelRegions.GetBoundingBox(label);
   bbWiderRegion.PadByRadius(5);
   bbWiderRegion.Crop(m_InputImage->GetLargestPossibleRegion()); 
 
@@ -209,3 +159,18 @@ IRISMeshPipeline
   m_InputImage = image;
 }
 
+void
+IRISMeshPipeline
+::ShareInput(const IRISMeshPipeline *source)
+{
+  // Wrap the source's pixel buffer in a new image object
+  InputImageType *input = source->m_InputImage;
+  m_InputImage = InputImageType::New();
+  m_InputImage->CopyInformation(input);
+  m_InputImage->SetBufferedRegion(input->GetBufferedRegion());
+  m_InputImage->SetRequestedRegion(input->GetBufferedRegion());
+  m_InputImage->SetPixelContainer(input->GetPixelContainer());
+
+  // The bounding boxes are the same
+  m_LabelRegions = source->m_LabelRegions;
+}
@@ -39,6 +39,7 @@
 #include "itkImageRegion.h"
 #include "itkSmartPointer.h"
 #include "MeshOptions.h"
+#include "LabelRegionCalculator.h"
 
 // Forward reference to itk classes
 namespace itk {
@@ -68,8 +69,17 @@ public:
   /** Set the input segmentation image */
   void SetImage(InputImageType *input);
 
+  /** 
+   * Use the input and the bounding boxes of another pipeline. This allows
+   * several pipelines to compute meshes for different labels concurrently.
+   * The pipeline gets its own image object that wraps the pixel buffer of 
+   * the source's input, so that no two pipelines update the same image
+   */
+  void ShareInput(const IRISMeshPipeline *source);
+
   /** Compute the bounding boxes for different regions.  Prerequisite for 
-   * calling ComputeMesh(). Returns the total number of voxels in all boxes */
+   * calling ComputeMesh(). Returns the total number of voxels in all boxes.
+   * The boxes are computed in a single multithreaded pass over the image */
   unsigned long ComputeBoundingBoxes();
 
   unsigned long GetVoxelsInBoundingBox(LabelType label) const;
@@ -77,10 +87,14 @@ public:
   /** Set the mesh options for this filter */
   void SetMeshOptions(const MeshOptions &options);
 
+  /** Get the histogram, bounding boxes and signatures of the labels */
+  const LabelRegionCalculator &GetLabelRegions() const
+    { return m_LabelRegions; }
+
   /** Can we compute a mesh for this label? */
   bool CanComputeMesh(LabelType label)
   {
-    return m_Histogram[label] > 0l;
+    return m_LabelRegions.GetCount(label) > 0;
   }
 
   /** Compute a mesh for a particular color label.  Returns true if 
@@ -122,11 +136,8 @@ private:
   // standardized range
   ThresholdFilterPointer      m_ThrehsoldFilter;
 
-  // Set of bounding boxes
-  itk::ImageRegion<3>         m_BoundingBox[MAX_COLOR_LABELS];
-
-  // Histogram of the image
-  long                        m_Histogram[MAX_COLOR_LABELS];
+  // Histogram and bounding boxes of the labels in the image
+  LabelRegionCalculator       m_LabelRegions;
 
   // The VTK pipeline
   VTKMeshPipeline *           m_VTKPipeline;
@@ -60,6 +60,9 @@
 #include "itkImageRegionConstIteratorWithIndex.h"
 #include "itkRecursiveGaussianImageFilter.h"
 #include "itkVTKImageExport.h"
+#include "itkCommand.h"
+#include "itkMultiThreader.h"
+#include "itkFastMutexLock.h"
 
 // VTK includes
 #include <vtkCellArray.h>
@@ -77,20 +80,30 @@
 
 // System includes
 #include <cstdlib>
+#include <algorithm>
+#include <string>
 
 using namespace std;
 
 MeshObject
 ::MeshObject() 
 {
-  m_DisplayListNumber = 0;
-  m_DisplayListIndex = 0;
   m_Progress = AllPurposeProgressAccumulator::New();
 }
 
 MeshObject
 ::~MeshObject()
 {
+  ClearCache();
+}
+
+void
+MeshObject
+::ClearCache()
+{
+  for(MeshCache::iterator it = m_Cache.begin(); it != m_Cache.end(); ++it)
+    it->second.Mesh->Delete();
+  m_Cache.clear();
 }
 
 void 
@@ -106,11 +119,7 @@ void
 MeshObject
 ::Reset() 
 {
-  if (m_DisplayListNumber > 0) 
-    {
-    glDeleteLists(m_DisplayListIndex, m_DisplayListNumber);
-    m_DisplayListNumber = 0;
-    }
+  m_PackedMeshes.clear();
   m_Labels.clear();
 }
 
@@ -153,122 +162,401 @@ MeshObject
     {
     // Create a pipeline for mesh generation
     IRISMeshPipeline *meshPipeline = new IRISMeshPipeline();
+    LabelImageWrapper::ImageType *image;
   
     // Initialize the pipeline with the correct image
     if(!m_GlobalState->GetSnakeActive())
       {
       // We are not currently in SNAP.  Use the segmentation image with its
       // different colors
-      meshPipeline->SetImage(
-        m_Driver->GetCurrentImageData()->GetSegmentation()->GetImage());    
-  
+      image = m_Driver->GetCurrentImageData()->GetSegmentation()->GetImage();
       }
     else
       {
       // We are in SNAP.  Use one of SNAP's images
       SNAPImageData *snapData = m_Driver->GetSNAPImageData();
-      meshPipeline->SetImage(snapData->GetSegmentation()->GetImage());
+      image = snapData->GetSegmentation()->GetImage();
       }
+    meshPipeline->SetImage(image);
   
     // Pass the settings on to the pipeline
-    meshPipeline->SetMeshOptions(m_GlobalState->GetMeshOptions());
+    MeshOptions options = m_GlobalState->GetMeshOptions();
+    meshPipeline->SetMeshOptions(options);
   
     // Run the first step in this pipeline
     meshPipeline->ComputeBoundingBoxes();
 
-    // Add the listener to the progress accumulator
-    unsigned long xObserverTag = 
-      m_Progress->AddObserver(itk::ProgressEvent(), command);
-
-    // Initialize the progress meter
+    // Make a list of the labels for which meshes will be computed
+    vector<LabelType> labels;
     for(i = 1; i < MAX_COLOR_LABELS; i++)
       {
       ColorLabel cl = m_Driver->GetColorLabelTable()->GetColorLabel(i);
       if(cl.IsVisibleIn3D() && meshPipeline->CanComputeMesh(i))
-        { 
-        m_Progress->RegisterSource(
-          meshPipeline->GetProgressAccumulator(),
-          1.0 * meshPipeline->GetVoxelsInBoundingBox(i));
-        }
+        labels.push_back((LabelType) i);
       }
 
-    // Compute a list of meshes in the filter
-    for(i = 1; i < MAX_COLOR_LABELS; i++) 
+    // The cached meshes are only valid for the same image geometry and
+    // the same mesh options
+    vector<double> geometry;
+    for(i = 0; i < 3; i++)
       {
-      ColorLabel cl = m_Driver->GetColorLabelTable()->GetColorLabel(i);
-      if(cl.IsVisibleIn3D() && meshPipeline->CanComputeMesh(i))
+      geometry.push_back(image->GetLargestPossibleRegion().GetIndex(i));
+      geometry.push_back(image->GetLargestPossibleRegion().GetSize(i));
+      geometry.push_back(image->GetSpacing()[i]);
+      geometry.push_back(image->GetOrigin()[i]);
+      for(unsigned int j = 0; j < 3; j++)
+        geometry.push_back(image->GetDirection()(i,j));
+      }
+    if(geometry != m_CacheGeometry || options != m_CacheOptions)
+      {
+      ClearCache();
+      m_CacheGeometry = geometry;
+      m_CacheOptions = options;
+      }
+
+    // Drop the meshes of labels that are no longer in the image, and find 
+    // the labels whose voxels changed since their meshes were computed
+    const LabelRegionCalculator &regions = meshPipeline->GetLabelRegions();
+    for(MeshCache::iterator it = m_Cache.begin(); it != m_Cache.end(); )
+      {
+      if(regions.GetCount(it->first) == 0)
         {
-        vtkPolyData *mesh = vtkPolyData::New();
-        meshPipeline->ComputeMesh(i,mesh);
-        m_Meshes.push_back(mesh);
-        m_Labels.push_back(i);
+        it->second.Mesh->Delete();
+        m_Cache.erase(it++);
+        }
+      else ++it;
+      }
 
-        // Advance the progress accumulator
-        m_Progress->StartNextRun(meshPipeline->GetProgressAccumulator());
+    vector<LabelType> dirty;
+    for(i = 0; i < labels.size(); i++)
+      {
+      MeshCache::iterator it = m_Cache.find(labels[i]);
+      if(it == m_Cache.end() 
+        || it->second.Count != regions.GetCount(labels[i])
+        || it->second.Signature != regions.GetSignature(labels[i])
+        || it->second.BoundingBox != regions.GetBoundingBox(labels[i]))
+        {
+        dirty.push_back(labels[i]);
         }
       }
 
-    // Remove all the progress sources
-    m_Progress->UnregisterAllSources();
+    // Add the listener to the progress accumulator
+    unsigned long xObserverTag = 
+      m_Progress->AddObserver(itk::ProgressEvent(), command);
+
+    // Compute the meshes for the labels that changed
+    vector<vtkPolyData *> meshes;
+    try 
+      {
+      ComputeLabelMeshes(meshPipeline, dirty, meshes);
+      }
+    catch(...)
+      {
+      m_Progress->RemoveObserver(xObserverTag);
+      delete meshPipeline;
+      throw;
+      }
 
     // Remove progress observer
     m_Progress->RemoveObserver(xObserverTag);
+
+    // Place the new meshes in the cache
+    for(i = 0; i < dirty.size(); i++)
+      {
+      CachedMesh &cm = m_Cache[dirty[i]];
+      if(cm.Mesh)
+        cm.Mesh->Delete();
+      cm.Mesh = meshes[i];
+      cm.Count = regions.GetCount(dirty[i]);
+      cm.Signature = regions.GetSignature(dirty[i]);
+      cm.BoundingBox = regions.GetBoundingBox(dirty[i]);
+      }
+
+    // Output the meshes in label order. The cache keeps its own reference
+    for(i = 0; i < labels.size(); i++)
+      {
+      vtkPolyData *mesh = m_Cache[labels[i]].Mesh;
+      mesh->Register(NULL);
+      m_Meshes.push_back(mesh);
+      m_Labels.push_back(labels[i]);
+      }
     
     // Deallocate the filter
     delete meshPipeline;
     }
 }
 
-void 
-MeshObject
-::GenerateDisplayLists()
+/**
+ * State shared by the threads that compute the meshes for a list of labels.
+ * Each thread owns a pipeline. The labels are handed out one at a time, 
+ * largest bounding box first, and each mesh is stored at the position of its
+ * label in the list, so that the output does not depend on the scheduling.
+ */
+class MeshObjectThreadData
 {
-  // Generate an array of display lists
-  m_DisplayListNumber = m_Meshes.size();
-  m_DisplayListIndex = glGenLists(m_DisplayListNumber);
-  
-  // Create a display list for each of the objects in the pipeline
-  for(unsigned int dl=0;dl<m_DisplayListNumber;dl++)
+public:
+  // The pipelines, one for each thread
+  vector<IRISMeshPipeline *> Pipelines;
+
+  // The labels, the meshes computed for them, and their progress weights
+  vector<LabelType> Labels;
+  vector<vtkPolyData *> Meshes;
+  vector<double> Weights;
+
+  // The order in which the labels are processed
+  vector<size_t> Schedule;
+  size_t NextJob;
+
+  // Progress, in units of weight. Only the calling thread fires events
+  AllPurposeProgressAccumulator *Progress;
+  double TotalWeight, FinishedWeight, CurrentWeight;
+
+  // Errors caught in the threads
+  bool OutOfMemory;
+  string ErrorMessage;
+
+  itk::SimpleFastMutexLock Mutex;
+
+  // Get the next label to process. Returns false when there are none left
+  bool GetNextJob(size_t &job)
     {
-    // Get the triangle strip information.
-    vtkCellArray *triStrips = m_Meshes[dl]->GetStrips();
+    Mutex.Lock();
+    bool ok = NextJob < Schedule.size() && !OutOfMemory 
+      && ErrorMessage.size() == 0;
+    if(ok)
+      job = Schedule[NextJob++];
+    Mutex.Unlock();
+    return ok;
+    }
 
-    // Get the vertex information.
-    vtkPoints *verts = m_Meshes[dl]->GetPoints();
+  // Report the finished weight plus the given partial weight
+  void ReportProgress(double partial)
+    {
+    Mutex.Lock();
+    double done = FinishedWeight + partial;
+    Mutex.Unlock();
+    Progress->UpdateProgress(
+      TotalWeight > 0.0 ? (float) std::min(1.0, done / TotalWeight) : 1.0f);
+    }
 
-    // Get the normal information.
-    vtkDataArray *norms = m_Meshes[dl]->GetPointData()->GetNormals();
-    
-    // Build display list
-    glNewList(m_DisplayListIndex + dl,GL_COMPILE);
+  // Observer for the progress of the pipeline on the calling thread
+  void OnPipelineProgress(itk::Object *source, const itk::EventObject &)
+    {
+    itk::ProcessObject *po = static_cast<itk::ProcessObject *>(source);
+    ReportProgress(CurrentWeight * po->GetProgress());
+    }
 
-    vtkIdType ntris = 0;
-    vtkIdType npts;
-    vtkIdType *pts;
-    for ( triStrips->InitTraversal(); triStrips->GetNextCell(npts,pts); ) 
+  static ITK_THREAD_RETURN_TYPE ThreadCallback(void *arg);
+};
+
+// Orders the jobs by decreasing weight
+struct MeshObjectJobOrder
+{
+  const vector<double> &Weights;
+  MeshObjectJobOrder(const vector<double> &w) : Weights(w) {}
+  bool operator() (size_t a, size_t b) const
+    { return Weights[a] > Weights[b]; }
+};
+
+ITK_THREAD_RETURN_TYPE
+MeshObjectThreadData
+::ThreadCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info = 
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  MeshObjectThreadData *td = 
+    static_cast<MeshObjectThreadData *>(info->UserData);
+  IRISMeshPipeline *pipeline = td->Pipelines[info->ThreadID];
+  bool caller = (info->ThreadID == 0);
+
+  size_t job;
+  while(td->GetNextJob(job))
+    {
+    if(caller)
+      td->CurrentWeight = td->Weights[job];
+
+    try
       {
-      ntris += npts-2;
-      glBegin( GL_TRIANGLE_STRIP );
-      for (vtkIdType j = 0; j < npts; j++) 
-        {
-        // Some ugly code to ensure VTK version compatibility
-        double vx = verts->GetPoint(pts[j])[0];
-        double vy = verts->GetPoint(pts[j])[1];
-        double vz = verts->GetPoint(pts[j])[2];
-        double nx = norms->GetTuple(pts[j])[0];
-        double ny = norms->GetTuple(pts[j])[1];
-        double nz = norms->GetTuple(pts[j])[2];
-        
-        // Specify normal.
-        glNormal3d(nx, ny, nz);
+      pipeline->ComputeMesh(td->Labels[job], td->Meshes[job]);
+      }
+    catch(std::bad_alloc &)
+      {
+      td->Mutex.Lock();
+      td->OutOfMemory = true;
+      td->Mutex.Unlock();
+      }
+    catch(itk::ExceptionObject &exc)
+      {
+      td->Mutex.Lock();
+      td->ErrorMessage = exc.GetDescription();
+      td->Mutex.Unlock();
+      }
 
-        // Specify vertex.
-        glVertex3d(vx, vy, vz);
-        }
-      glEnd();
+    td->Mutex.Lock();
+    td->FinishedWeight += td->Weights[job];
+    td->Mutex.Unlock();
+
+    if(caller)
+      {
+      td->CurrentWeight = 0.0;
+      td->ReportProgress(0.0);
       }
-    glEndList();    
     }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+void
+MeshObject
+::ComputeLabelMeshes(
+  IRISMeshPipeline *pipeline, const vector<LabelType> &labels,
+  vector<vtkPolyData *> &meshes)
+{
+  size_t i, n = labels.size();
+  meshes.clear();
+  if(n == 0)
+    return;
+
+  // Set up the jobs. The meshes are allocated here rather than in the
+  // threads, so that VTK objects are only created on this thread
+  MeshObjectThreadData td;
+  td.Labels = labels;
+  td.Meshes.resize(n);
+  td.Weights.resize(n);
+  td.Schedule.resize(n);
+  td.TotalWeight = 0.0;
+  for(i = 0; i < n; i++)
+    {
+    td.Meshes[i] = vtkPolyData::New();
+    td.Weights[i] = 1.0 * pipeline->GetVoxelsInBoundingBox(labels[i]);
+    td.Schedule[i] = i;
+    td.TotalWeight += td.Weights[i];
+    }
+  std::stable_sort(td.Schedule.begin(), td.Schedule.end(), 
+    MeshObjectJobOrder(td.Weights));
+  td.NextJob = 0;
+  td.FinishedWeight = td.CurrentWeight = 0.0;
+  td.OutOfMemory = false;
+  td.Progress = m_Progress;
+
+  // Create a pool of pipelines. The first one is the one passed in, and 
+  // it is used by the calling thread
+  unsigned int nThreads = std::min(
+    (size_t) itk::MultiThreader::GetGlobalDefaultNumberOfThreads(), n);
+  td.Pipelines.push_back(pipeline);
+  for(i = 1; i < nThreads; i++)
+    {
+    IRISMeshPipeline *p = new IRISMeshPipeline();
+    p->ShareInput(pipeline);
+    p->SetMeshOptions(m_GlobalState->GetMeshOptions());
+    td.Pipelines.push_back(p);
+    }
+
+  // Progress is reported from the calling thread's pipeline
+  typedef itk::MemberCommand<MeshObjectThreadData> CommandType;
+  CommandType::Pointer cmd = CommandType::New();
+  cmd->SetCallbackFunction(&td, &MeshObjectThreadData::OnPipelineProgress);
+  unsigned long tag = pipeline->GetProgressAccumulator()->AddObserver(
+    itk::ProgressEvent(), cmd);
+
+  // Run the threads
+  m_Progress->UpdateProgress(0.0f);
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads(nThreads);
+  threader->SetSingleMethod(&MeshObjectThreadData::ThreadCallback, &td);
+  threader->SingleMethodExecute();
+
+  // Clean up the pool
+  pipeline->GetProgressAccumulator()->RemoveObserver(tag);
+  for(i = 1; i < td.Pipelines.size(); i++)
+    delete td.Pipelines[i];
+
+  // If one of the threads failed, discard the meshes and pass on the error
+  if(td.OutOfMemory || td.ErrorMessage.size())
+    {
+    for(i = 0; i < n; i++)
+      td.Meshes[i]->Delete();
+    if(td.OutOfMemory)
+      throw vtkstd::bad_alloc();
+    throw itk::ExceptionObject(__FILE__, __LINE__, td.ErrorMessage.c_str());
+    }
+
+  meshes = td.Meshes;
+}
+
+void 
+MeshObject
+::GenerateVertexArrays()
+{
+  // Pack each of the meshes
+  m_PackedMeshes.resize(m_Meshes.size());
+  for(size_t i = 0; i < m_Meshes.size(); i++)
+    PackMesh(m_Meshes[i], m_PackedMeshes[i]);
+}
+
+void
+MeshObject
+::PackMesh(vtkPolyData *mesh, PackedMesh &packed)
+{
+  vtkPoints *verts = mesh->GetPoints();
+  vtkDataArray *norms = mesh->GetPointData()->GetNormals();
+  vtkCellArray *triStrips = mesh->GetStrips();
+
+  // Interleave the normals and the vertices
+  vtkIdType nPoints = verts ? verts->GetNumberOfPoints() : 0;
+  packed.Vertices.resize(6 * nPoints);
+  double x[3], n[3] = {0.0, 0.0, 0.0};
+  for(vtkIdType j = 0; j < nPoints; j++)
+    {
+    float *v = &packed.Vertices[6 * j];
+    verts->GetPoint(j, x);
+    if(norms)
+      norms->GetTuple(j, n);
+    v[0] = (float) n[0]; v[1] = (float) n[1]; v[2] = (float) n[2];
+    v[3] = (float) x[0]; v[4] = (float) x[1]; v[5] = (float) x[2];
+    }
+
+  // Break the triangle strips into triangles. Every other triangle in a 
+  // strip has its first two vertices swapped, as OpenGL does, so that the
+  // triangles keep the orientation they have in the strip
+  vtkIdType ntris = 
+    triStrips->GetNumberOfConnectivityEntries() 
+    - 3 * triStrips->GetNumberOfCells();
+  packed.Indices.clear();
+  packed.Indices.reserve(3 * std::max(ntris, (vtkIdType) 0));
+
+  vtkIdType npts;
+  vtkIdType *pts;
+  for(triStrips->InitTraversal(); triStrips->GetNextCell(npts,pts); ) 
+    {
+    for(vtkIdType j = 0; j + 2 < npts; j++)
+      {
+      vtkIdType a = pts[j], b = pts[j+1], c = pts[j+2];
+      if(a == b || b == c || a == c)
+        continue;
+      if(j & 1) 
+        std::swap(a, b);
+      packed.Indices.push_back((unsigned int) a);
+      packed.Indices.push_back((unsigned int) b);
+      packed.Indices.push_back((unsigned int) c);
+      }
+    }
+}
+
+void
+MeshObject
+::DrawPackedMesh(const PackedMesh &packed)
+{
+  if(packed.Indices.size() == 0)
+    return;
+
+  // Plain vertex arrays are part of OpenGL 1.1, so this works with any
+  // implementation, including software ones
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+  glInterleavedArrays(GL_N3F_V3F, 0, &packed.Vertices[0]);
+  glDrawElements(GL_TRIANGLES, (GLsizei) packed.Indices.size(), 
+    GL_UNSIGNED_INT, &packed.Indices[0]);
+  glPopClientAttrib();
 }
 
 
@@ -311,7 +599,7 @@ MeshObject
 ::GenerateMesh(itk::Command *command)
 {
   GenerateVTKMeshes(command);
-  GenerateDisplayLists();
+  GenerateVertexArrays();
   DiscardVTKMeshes();
 }
 
@@ -514,13 +802,13 @@ MeshObject
     {
     
     // First render all the fully opaque objects
-    for (i=0; i < m_DisplayListNumber; i++) 
+    for (i=0; i < m_PackedMeshes.size(); i++) 
       {
       const ColorLabel &cl = 
         m_Driver->GetColorLabelTable()->GetColorLabel(m_Labels[i]);
       if (cl.IsOpaque() && ApplyColorLabel(cl)) 
       {
-        glCallList(m_DisplayListIndex + i);
+        DrawPackedMesh(m_PackedMeshes[i]);
       }
     }
 
@@ -533,13 +821,13 @@ MeshObject
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);     
     glDepthMask(GL_FALSE); 
     
-    for (i=0; i < m_DisplayListNumber; i++) 
+    for (i=0; i < m_PackedMeshes.size(); i++) 
       {
       const ColorLabel &cl = 
         m_Driver->GetColorLabelTable()->GetColorLabel(m_Labels[i]);
       if (!cl.IsOpaque() && ApplyColorLabel(cl)) 
       {
-        glCallList(m_DisplayListIndex + i); 
+        DrawPackedMesh(m_PackedMeshes[i]); 
       }
     }
 
@@ -548,7 +836,7 @@ MeshObject
 
   // if the snake is active render only the current segmentation
   // added by Konstantin Bobkov
-  else if(m_DisplayListNumber > 0) 
+  else if(m_PackedMeshes.size() > 0) 
   {
     // get current label
     int currentcolor =  m_GlobalState->GetDrawingColorLabel();
@@ -559,7 +847,7 @@ MeshObject
       m_Driver->GetColorLabelTable()->GetColorLabel(currentcolor);
     if (cl.IsOpaque() && ApplyColorLabel(cl)) 
     {
-      glCallList(m_DisplayListIndex);
+      DrawPackedMesh(m_PackedMeshes[0]);
     }
 
     // now check if the segmentation is translucent 
@@ -572,7 +860,7 @@ MeshObject
 
     if (!cl.IsOpaque() && ApplyColorLabel(cl)) 
     {
-      glCallList(m_DisplayListIndex);  
+      DrawPackedMesh(m_PackedMeshes[0]);  
     }
 
     glPopAttrib();
@@ -41,6 +41,7 @@ class GlobalState;
 class IRISImageData;
 class ColorLabel;
 class AllPurposeProgressAccumulator;
+class IRISMeshPipeline;
 class vtkPolyData;
 
 namespace itk {
@@ -49,7 +50,10 @@ namespace itk {
 
 #include "SNAPCommon.h"
 #include "AllPurposeProgressAccumulator.h"
+#include "MeshOptions.h"
+#include "itkImageRegion.h"
 #include <vector>
+#include <map>
 
 /**
  * \class MeshObject
@@ -61,24 +65,68 @@ namespace itk {
  */
 class MeshObject  {
 private:
-  // The number of allocated display lists
-  unsigned int m_DisplayListNumber;
+  // A mesh packed for rendering with vertex arrays: interleaved normals 
+  // and vertices in the GL_N3F_V3F layout, and the indices of triangles
+  struct PackedMesh
+    {
+    std::vector<float> Vertices;
+    std::vector<unsigned int> Indices;
+    };
 
-  // The starting display list number
-  unsigned int m_DisplayListIndex;
+  // The meshes packed for rendering
+  std::vector<PackedMesh> m_PackedMeshes;
 
-  // The labels associated with the allocated display lists
+  // The labels associated with the packed meshes
   std::vector<LabelType> m_Labels;
 
   // The VTK meshes (optionally available)
   std::vector<vtkPolyData *> m_Meshes;
 
+  // A mesh computed for a label, along with the voxel count, bounding box
+  // and signature of the label at the time the mesh was computed
+  struct CachedMesh
+    {
+    vtkPolyData *Mesh;
+    unsigned long Count;
+    unsigned long long Signature;
+    itk::ImageRegion<3> BoundingBox;
+    CachedMesh() : Mesh(NULL), Count(0), Signature(0) {}
+    };
+
+  // Meshes of the labels present in the segmentation, reused for labels
+  // whose voxels have not changed since the last update
+  typedef std::map<LabelType, CachedMesh> MeshCache;
+  MeshCache m_Cache;
+
+  // The image geometry and mesh options that the cached meshes are for
+  std::vector<double> m_CacheGeometry;
+  MeshOptions m_CacheOptions;
+
+  // Discard all the cached meshes
+  void ClearCache();
+
   /** 
    * This method applies the settings in a color label if color label 
    * is displayable
    */
   bool ApplyColorLabel(const ColorLabel &label);
 
+  // Pack a VTK mesh for rendering
+  static void PackMesh(vtkPolyData *mesh, PackedMesh &packed);
+
+  // Render a packed mesh
+  static void DrawPackedMesh(const PackedMesh &packed);
+
+  /**
+   * Compute the meshes for a list of labels. The labels are processed
+   * concurrently by a pool of pipelines that share the input and the 
+   * bounding boxes of the given pipeline. The meshes are returned in the 
+   * order of the labels in the list
+   */
+  void ComputeLabelMeshes(
+    IRISMeshPipeline *pipeline, const std::vector<LabelType> &labels,
+    std::vector<vtkPolyData *> &meshes);
+
   // Back pointer to the application object
   IRISApplication *m_Driver;
 
@@ -139,10 +187,11 @@ public:
   void GenerateVTKMeshes(itk::Command *command);
 
   /** 
-   * Convert VTK meshes to display lists. This method is called inside
-   * GenerateMesh. Normally, you would not use this method.
+   * Pack the VTK meshes into vertex and index arrays for rendering. This 
+   * method is called inside GenerateMesh. Normally, you would not use this
+   * method.
    */
-  void GenerateDisplayLists();
+  void GenerateVertexArrays();
 
   /**
    * Discard VTK meshes. This method is called by GenerateMesh intenally.
@@ -69,6 +69,32 @@ MeshOptions
 {
 }
 
+bool
+MeshOptions
+::operator == (const MeshOptions &o) const
+{
+  return
+    m_UseGaussianSmoothing == o.m_UseGaussianSmoothing &&
+    m_UseDecimation == o.m_UseDecimation &&
+    m_UseMeshSmoothing == o.m_UseMeshSmoothing &&
+    m_GaussianStandardDeviation == o.m_GaussianStandardDeviation &&
+    m_GaussianError == o.m_GaussianError &&
+    m_DecimateTargetReduction == o.m_DecimateTargetReduction &&
+    m_DecimateInitialError == o.m_DecimateInitialError &&
+    m_DecimateAspectRatio == o.m_DecimateAspectRatio &&
+    m_DecimateFeatureAngle == o.m_DecimateFeatureAngle &&
+    m_DecimateErrorIncrement == o.m_DecimateErrorIncrement &&
+    m_DecimateMaximumIterations == o.m_DecimateMaximumIterations &&
+    m_DecimatePreserveTopology == o.m_DecimatePreserveTopology &&
+    m_MeshSmoothingRelaxationFactor == o.m_MeshSmoothingRelaxationFactor &&
+    m_MeshSmoothingIterations == o.m_MeshSmoothingIterations &&
+    m_MeshSmoothingConvergence == o.m_MeshSmoothingConvergence &&
+    m_MeshSmoothingFeatureAngle == o.m_MeshSmoothingFeatureAngle &&
+    m_MeshSmoothingFeatureEdgeSmoothing == 
+      o.m_MeshSmoothingFeatureEdgeSmoothing &&
+    m_MeshSmoothingBoundarySmoothing == o.m_MeshSmoothingBoundarySmoothing;
+}
+
 /*
  *$Log: MeshOptions.cxx,v $
  *Revision 1.2  2007/12/30 04:05:15  pyushkevich
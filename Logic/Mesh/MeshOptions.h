@@ -101,6 +101,10 @@ public:
   irisGetMacro(MeshSmoothingBoundarySmoothing,bool);
   irisSetMacro(MeshSmoothingBoundarySmoothing,bool);
 
+  /** Compare two sets of options */
+  bool operator == (const MeshOptions &other) const;
+  bool operator != (const MeshOptions &other) const
+    { return !(*this == other); }
 
 private:
   // Begin render switches
@@ -39,11 +39,12 @@
 #include "itkCastImageFilter.h"
 #include "itkOrientedImage.h"
 #include "itkDiscreteGaussianImageFilter.h"
+#include "itkGaussianOperator.h"
 #include "itkGradientMagnitudeImageFilter.h"
 #include "itkImageAdaptor.h"
 #include "itkMinimumMaximumImageCalculator.h"
 #include "itkProgressAccumulator.h"
-#include "itkRescaleIntensityImageFilter.h"
+#include "itkIntensityWindowingImageFilter.h"
 #include "itkUnaryFunctorImageFilter.h"
 #include "EdgePreprocessingSettings.h"
 
@@ -99,6 +100,15 @@ private:
  * 
  * This functor implements a Gaussian blur, followed by a gradient magnitude
  * operator, followed by a 'contrast enhancement' intensity remapping filter.
+ *
+ * The filter only computes the requested region of the output, reading the
+ * input over that region padded by the support of the Gaussian and gradient
+ * operators. This makes it cheap to preview the speed function on a single
+ * slice. The gradient magnitude is normalized by its range over the whole
+ * image, which is computed once per input image and blur scale, so that a
+ * single-slice preview matches the result of running the filter on the 
+ * whole image. Several filters previewing the same image can share this
+ * range, see SetGradientRangeSource().
  */
 template <typename TInputImage,typename TOutputImage = TInputImage>
 class EdgePreprocessingImageFilter: 
@@ -140,6 +150,21 @@ public:
   /** Assign new edge processing settings */
   void SetEdgePreprocessingSettings(const EdgePreprocessingSettings &settings);
 
+  /** 
+   * Take the range of the gradient magnitude from another filter with the
+   * same input, rather than computing it here. The full-image pass is then
+   * made once for all the filters sharing the source.
+   */
+  void SetGradientRangeSource(Self *source);
+
+  /** 
+   * Get the range of the gradient magnitude of an image blurred with the 
+   * given scale. The range is only recomputed when the image or the scale 
+   * change since the last call.
+   */
+  void ComputeGradientRange(const InputImageType *image, double scale,
+                            RealType &gMin, RealType &gMax);
+
 protected:
 
   EdgePreprocessingImageFilter();
@@ -150,8 +175,9 @@ protected:
   void GenerateData( void );
 
   /** 
-   * This method maps an input region to an output region.  It's necessary to
-   * reflect the way this filter pads the requested region
+   * This method maps an output region to an input region. The requested 
+   * region is padded by the radius of the Gaussian kernel plus one voxel
+   * for the gradient operator.
    */
   void GenerateInputRequestedRegion();
 
@@ -182,8 +208,8 @@ private:
     InternalImageType,InternalImageType>              GradientFilterType;
   typedef typename GradientFilterType::Pointer     GradientFilterPointer;
 
-  /** Intensity rescaling filter */
-  typedef itk::RescaleIntensityImageFilter<
+  /** Intensity rescaling filter, mapping the gradient range to [0 1] */
+  typedef itk::IntensityWindowingImageFilter<
     InternalImageType,InternalImageType>               RescaleFilterType;
   typedef typename RescaleFilterType::Pointer       RescaleFilterPointer;
   
@@ -199,6 +225,14 @@ private:
 
   EdgePreprocessingSettings m_EdgePreprocessingSettings;
 
+  /** Time when the gradient magnitude range was last computed, and the blur
+   * scale it was computed with */
+  itk::TimeStamp            m_GradientRangeTime;
+  double                    m_GradientRangeScale;
+
+  /** Filter from which the gradient magnitude range is taken, if any */
+  Pointer                   m_GradientRangeSource;
+
   /** Progress tracking object */
   AccumulatorPointer        m_ProgressAccumulator;
 };
@@ -60,6 +60,10 @@ EdgePreprocessingImageFilter<TInputImage,TOutputImage>
   m_RescaleFilter->SetOutputMaximum(1.0f);
   m_RescaleFilter->SetInput(m_GradientFilter->GetOutput());
   
+  // The calculator used to find the range of the gradient magnitude
+  m_Calculator = CalculatorType::New();
+  m_GradientRangeScale = -1.0;
+
   // Construct the Remapping filter
   m_RemappingFilter = RemappingFilterType::New();
   m_RemappingFilter->ReleaseDataFlagOn();
@@ -96,11 +100,18 @@ EdgePreprocessingImageFilter<TInputImage,TOutputImage>
   // Pipe in the input image
   m_CastFilter->SetInput(inputImage);
 
-  // Set the variance
-  Vector3f variance(
-    m_EdgePreprocessingSettings.GetGaussianBlurScale() * 
-    m_EdgePreprocessingSettings.GetGaussianBlurScale());
-  m_GaussianFilter->SetVariance(variance.data_block());
+  // Get the range of the gradient magnitude over the whole image, so that
+  // the normalization does not depend on the requested region
+  double scale = m_EdgePreprocessingSettings.GetGaussianBlurScale();
+  RealType gMin, gMax;
+  if(m_GradientRangeSource)
+    m_GradientRangeSource->ComputeGradientRange(inputImage, scale, gMin, gMax);
+  else
+    this->ComputeGradientRange(inputImage, scale, gMin, gMax);
+
+  // Map the range to [0 1]
+  m_RescaleFilter->SetWindowMinimum(gMin);
+  m_RescaleFilter->SetWindowMaximum(gMax > gMin ? gMax : gMin + 1.0f);
 
   // Construct the functor
   FunctorType functor;
@@ -141,6 +152,50 @@ EdgePreprocessingImageFilter<TInputImage,TOutputImage>
     }
 }
 
+template<typename TInputImage,typename TOutputImage>
+void 
+EdgePreprocessingImageFilter<TInputImage,TOutputImage>
+::SetGradientRangeSource(Self *source)
+{
+  if(source == this)
+    source = NULL;
+
+  if(m_GradientRangeSource.GetPointer() != source)
+    {
+    m_GradientRangeSource = source;
+    this->Modified();
+    }
+}
+
+template<typename TInputImage,typename TOutputImage>
+void 
+EdgePreprocessingImageFilter<TInputImage,TOutputImage>
+::ComputeGradientRange(const InputImageType *image, double scale,
+                       RealType &gMin, RealType &gMax)
+{
+  // The full-image pass is only made when the input or the blur scale 
+  // change, so that repeated previews of single slices stay cheap
+  if(image->GetMTime() > m_GradientRangeTime.GetMTime() ||
+     scale != m_GradientRangeScale)
+    {
+    // The variance is set here as well, since the range may be requested
+    // before this filter's own pipeline has seen the new settings
+    Vector3f variance(scale * scale);
+    m_GaussianFilter->SetVariance(variance.data_block());
+
+    m_CastFilter->SetInput(image);
+    m_GradientFilter->UpdateLargestPossibleRegion();
+    m_Calculator->SetImage(m_GradientFilter->GetOutput());
+    m_Calculator->Compute();
+    m_GradientFilter->GetOutput()->ReleaseData();
+    m_GradientRangeTime.Modified();
+    m_GradientRangeScale = scale;
+    }
+
+  gMin = m_Calculator->GetMinimum();
+  gMax = m_Calculator->GetMaximum();
+}
+
 template<typename TInputImage,typename TOutputImage>
 void 
 EdgePreprocessingImageFilter<TInputImage,TOutputImage>
@@ -153,8 +208,34 @@ EdgePreprocessingImageFilter<TInputImage,TOutputImage>
   InputImagePointer  inputPtr = 
     const_cast< TInputImage * >( this->GetInput() );
   OutputImagePointer outputPtr = this->GetOutput();
+  if(!inputPtr || !outputPtr)
+    return;
+
+  // Set the variance. This has to happen here rather than in GenerateData()
+  // because the size of the kernel determines the input requested region
+  Vector3f variance(
+    m_EdgePreprocessingSettings.GetGaussianBlurScale() * 
+    m_EdgePreprocessingSettings.GetGaussianBlurScale());
+  m_GaussianFilter->SetVariance(variance.data_block());
+
+  // Compute the radius of the Gaussian kernel the same way that the Gaussian
+  // filter does it, and add one voxel for the gradient operator
+  typename InputImageType::SizeType radius;
+  for(unsigned int d = 0; d < ImageDimension; d++)
+    {
+    itk::GaussianOperator<RealType, ImageDimension> oper;
+    oper.SetDirection(d);
+    oper.SetVariance(m_GaussianFilter->GetVariance()[d]);
+    oper.SetMaximumError(m_GaussianFilter->GetMaximumError()[d]);
+    oper.SetMaximumKernelWidth(m_GaussianFilter->GetMaximumKernelWidth());
+    oper.CreateDirectional();
+    radius[d] = oper.GetRadius(d) + 1;
+    }
 
-  // Use the largest possible region (hack)
-  inputPtr->SetRequestedRegion(
-    inputPtr->GetLargestPossibleRegion());
+  // Pad the output requested region by the radius and crop it by the 
+  // extents of the input image
+  typename InputImageType::RegionType region = outputPtr->GetRequestedRegion();
+  region.PadByRadius(radius);
+  region.Crop(inputPtr->GetLargestPossibleRegion());
+  inputPtr->SetRequestedRegion(region);
 }
@@ -146,7 +146,10 @@ private:
  * \class SmoothBinaryThresholdFunctor
  * \brief A filter used to perform binary thresholding to produce SNAP speed images.
  * 
- * This filter uses a sigmoid function as a smooth threshold
+ * This filter uses a sigmoid function as a smooth threshold. The filter only
+ * computes the requested region of the output (e.g., a single slice during
+ * preview), but the intensity range of the input that is used to scale the
+ * sigmoid is always taken over the whole input image.
  */
 template <typename TInputImage,typename TOutputImage = TInputImage>
 class SmoothBinaryThresholdImageFilter: 
@@ -209,6 +212,9 @@ private:
   CalculatorPointer         m_Calculator;                                               
   ThresholdSettings         m_ThresholdSettings;
   AccumulatorPointer        m_ProgressAccumulator;
+
+  /** Time when the intensity range of the input was last computed */
+  itk::TimeStamp            m_IntensityRangeTime;
 };
 
 #ifndef ITK_MANUAL_INSTANTIATION
@@ -65,9 +65,15 @@ SmoothBinaryThresholdImageFilter<TInputImage,TOutputImage>
   // Reset the progress
   m_ProgressAccumulator->ResetProgress();
 
-  // Compute the min/max of the image
-  m_Calculator->SetImage(inputImage);
-  m_Calculator->Compute();
+  // Compute the min/max of the whole image. This is only done when the input
+  // changes, so that repeated previews of single slices stay cheap
+  if(inputImage->GetMTime() > m_IntensityRangeTime.GetMTime())
+    {
+    m_Calculator->SetImage(inputImage);
+    m_Calculator->SetRegion(inputImage->GetBufferedRegion());
+    m_Calculator->Compute();
+    m_IntensityRangeTime.Modified();
+    }
   
   // Construct the functor
   FunctorType functor;
@@ -41,6 +41,7 @@
 #include <itkImageSliceConstIteratorWithIndex.h>
 #include <itkImageRegionIteratorWithIndex.h>
 #include <itkImageLinearIteratorWithIndex.h>
+#include <algorithm>
 
 /**
  * \class IRISSlicer
@@ -78,6 +79,7 @@ public:
   typedef typename InputImageType::RegionType  InputImageRegionType; 
   typedef typename OutputImageType::Pointer  OutputImagePointer;
   typedef typename OutputImageType::RegionType  OutputImageRegionType;
+  typedef typename InputImageType::OffsetValueType  OffsetValueType;
   typedef itk::ImageSliceConstIteratorWithIndex<InputImageType>  InputIteratorType;
   typedef itk::ImageRegionIteratorWithIndex<OutputImageType>  SimpleOutputIteratorType;
   typedef itk::ImageLinearIteratorWithIndex<OutputImageType> OutputIteratorType;
@@ -129,10 +131,15 @@ protected:
                               const OutputImageRegionType &srcRegion);
 
   /** 
-   * IRISSlicer is not implemented as a multithreaded filter.
-   * \sa ImageToImageFilter::GenerateData()  
+   * IRISSlicer is a multithreaded filter: the threads split the output slice
+   * into groups of lines. Within each group the copy is performed by a kernel
+   * chosen based on which axis, if any, is contiguous in the input image.
+   * This method assumes that the input buffer spans the whole image along 
+   * the pixel and line axes and that the output is the whole slice.
+   * \sa ImageToImageFilter::ThreadedGenerateData()  
    */
-  virtual void GenerateData();
+  virtual void ThreadedGenerateData(
+    const OutputImageRegionType &outputRegionForThread, int threadId);
 
 private:
   IRISSlicer(const Self&); //purposely not implemented
@@ -156,6 +163,26 @@ private:
   // Whether the pixel direction is reversed
   bool m_PixelTraverseForward;
   
+  // Copy kernel for the case when pixels in a line are adjacent in the input 
+  // image, with VPixelStep equal to 1 (forward) or -1 (backward)
+  template <int VPixelStep>
+  static void CopyContiguousLines(const TPixel *pSource, OffsetValueType sLine, 
+                                  TPixel *pTarget, size_t sTarget,
+                                  size_t nPixel, size_t nLine);
+
+  // Copy kernel for the case when lines are adjacent in the input image, 
+  // i.e., a blocked transpose, with VLineStep equal to 1 or -1
+  template <int VLineStep>
+  static void CopyTransposedLines(const TPixel *pSource, OffsetValueType sPixel, 
+                                  TPixel *pTarget, size_t sTarget,
+                                  size_t nPixel, size_t nLine);
+
+  // Copy kernel for the case when neither axis is contiguous 
+  static void CopyStridedLines(const TPixel *pSource, 
+                               OffsetValueType sPixel, OffsetValueType sLine,
+                               TPixel *pTarget, size_t sTarget,
+                               size_t nPixel, size_t nLine);
+
   // The worker methods in this filter
   // void CopySliceLineForwardPixelForward(InputIteratorType, OutputImageType *);
   // void CopySliceLineForwardPixelBackward(InputIteratorType, OutputImageType *);
@@ -181,36 +181,31 @@ void IRISSlicer<TPixel>
 
 template<class TPixel> 
 void IRISSlicer<TPixel>
-::GenerateData()
+::ThreadedGenerateData(const OutputImageRegionType &outputRegionForThread,
+                       int irisNotUsed(threadId))
 {
   // Here's the input and output
   InputImagePointer  inputPtr = this->GetInput();
   OutputImagePointer  outputPtr = this->GetOutput();
   
-  // Allocate (why is this necessary?)
-  this->AllocateOutputs();
-
   // Get the image dimensions
   typename InputImageType::SizeType szVol = inputPtr->GetBufferedRegion().GetSize();
 
-  // Set the strides in image coordinates
-  Vector3i stride_image(1, szVol[0], szVol[1] * szVol[0]);
+  // Set the strides in image coordinates. Offsets are computed in the image
+  // offset type, since they can exceed the range of int in large volumes
+  OffsetValueType stride_image[3];
+  stride_image[0] = 1;
+  stride_image[1] = szVol[0];
+  stride_image[2] = (OffsetValueType) szVol[1] * szVol[0];
 
   // Determine the strides for the pixel step and line step
-  int sPixel = (m_PixelTraverseForward ? 1 : -1) *
+  OffsetValueType sPixel = (m_PixelTraverseForward ? 1 : -1) *
     stride_image[m_PixelDirectionImageAxis];
-  int sLine = (m_LineTraverseForward ? 1 : -1) *
+  OffsetValueType sLine = (m_LineTraverseForward ? 1 : -1) *
     stride_image[m_LineDirectionImageAxis];
   
-  // We never take full line-strides, because as we iterate, we
-  // take n pixel-strides before needing to worry about changing
-  // the line. Therefore, we compute the step needed to go to the
-  // start of next line after taking n pixel-strides
-  int sRowOfPixels = sPixel * szVol[m_PixelDirectionImageAxis];
-  int sLineDelta = sLine - sRowOfPixels;
-
   // Determine the first voxel that we will traverse
-  Vector3i xStartVoxel;
+  OffsetValueType xStartVoxel[3];
   xStartVoxel[m_PixelDirectionImageAxis] = 
     m_PixelTraverseForward ? 0 : szVol[m_PixelDirectionImageAxis] - 1;
   xStartVoxel[m_LineDirectionImageAxis] = 
@@ -219,29 +214,112 @@ void IRISSlicer<TPixel>
     szVol[m_SliceDirectionImageAxis] == 1 ? 0 : m_SliceIndex;
 
   // Get the offset of the first voxel
-  size_t iStart = dot_product(stride_image, xStartVoxel);
-
-  // Get the size of the output region (whole slice)
-  typename OutputImageType::RegionType rgn = outputPtr->GetBufferedRegion();
-  size_t nPixel = rgn.GetSize()[0], nLine = rgn.GetSize()[1];
+  OffsetValueType iStart = 0;
+  for(unsigned int d = 0; d < 3; d++)
+    iStart += stride_image[d] * xStartVoxel[d];
+
+  // Get the output region (whole slice) and the part of it handled by this
+  // thread. The threads split the slice into groups of lines
+  OutputImageRegionType rgn = outputPtr->GetBufferedRegion();
+  size_t nRowTarget = rgn.GetSize()[0];
+  OffsetValueType ip0 = 
+    outputRegionForThread.GetIndex()[0] - rgn.GetIndex()[0];
+  OffsetValueType il0 = 
+    outputRegionForThread.GetIndex()[1] - rgn.GetIndex()[1];
+  size_t nPixel = outputRegionForThread.GetSize()[0];
+  size_t nLine = outputRegionForThread.GetSize()[1];
+
+  // Get pointers to input and output data for the first pixel in the region
+  const TPixel *pSource = 
+    inputPtr->GetBufferPointer() + iStart + ip0 * sPixel + il0 * sLine;
+  TPixel *pTarget = 
+    outputPtr->GetBufferPointer() + il0 * nRowTarget + ip0;
+
+  // Dispatch to a copy kernel based on which of the axes, if any, is 
+  // contiguous in memory
+  if(sPixel == 1)
+    CopyContiguousLines<1>(pSource, sLine, pTarget, nRowTarget, nPixel, nLine);
+  else if(sPixel == -1)
+    CopyContiguousLines<-1>(pSource, sLine, pTarget, nRowTarget, nPixel, nLine);
+  else if(sLine == 1)
+    CopyTransposedLines<1>(pSource, sPixel, pTarget, nRowTarget, nPixel, nLine);
+  else if(sLine == -1)
+    CopyTransposedLines<-1>(pSource, sPixel, pTarget, nRowTarget, nPixel, nLine);
+  else
+    CopyStridedLines(pSource, sPixel, sLine, pTarget, nRowTarget, nPixel, nLine);
+}
 
-  // Get pointers to input and output data
-  const TPixel *pSource = inputPtr->GetBufferPointer();
-  TPixel *pTarget = outputPtr->GetBufferPointer();
+template<class TPixel> 
+template<int VPixelStep>
+void IRISSlicer<TPixel>
+::CopyContiguousLines(const TPixel *pSource, OffsetValueType sLine, 
+                      TPixel *pTarget, size_t sTarget,
+                      size_t nPixel, size_t nLine)
+{
+  for(size_t il = 0; il < nLine; il++)
+    {
+    if(VPixelStep == 1)
+      {
+      // Lines are contiguous in the source and the target
+      std::copy(pSource, pSource + nPixel, pTarget);
+      }
+    else
+      {
+      // Lines are contiguous but reversed. The unit stride lets the compiler 
+      // vectorize this loop
+      for(size_t ip = 0; ip < nPixel; ip++)
+        pTarget[ip] = *(pSource - (ptrdiff_t) ip);
+      }
+    pSource += sLine;
+    pTarget += sTarget;
+    }
+}
 
-  // Position the source
-  pSource += iStart;
+template<class TPixel> 
+template<int VLineStep>
+void IRISSlicer<TPixel>
+::CopyTransposedLines(const TPixel *pSource, OffsetValueType sPixel, 
+                      TPixel *pTarget, size_t sTarget,
+                      size_t nPixel, size_t nLine)
+{
+  // The pixels in a line are strided in the source, but pixels at the same
+  // position in consecutive lines are adjacent. We copy blocks of lines at a
+  // time, so that each cache line read from the source is fully used
+  const size_t nBlock = 16;
+  for(size_t ib = 0; ib < nLine; ib += nBlock)
+    {
+    size_t nInBlock = std::min(nBlock, nLine - ib);
+    const TPixel *pSrcBlock = pSource + VLineStep * (ptrdiff_t) ib;
+    TPixel *pTrgBlock = pTarget + ib * sTarget;
+    for(size_t ip = 0; ip < nPixel; ip++)
+      {
+      const TPixel *pSrc = pSrcBlock + (ptrdiff_t) ip * sPixel;
+      TPixel *pTrg = pTrgBlock + ip;
+      for(size_t k = 0; k < nInBlock; k++)
+        pTrg[k * sTarget] = pSrc[VLineStep * (ptrdiff_t) k];
+      }
+    }
+}
 
-  // Main loop: copy data from source to target
+template<class TPixel> 
+void IRISSlicer<TPixel>
+::CopyStridedLines(const TPixel *pSource, 
+                   OffsetValueType sPixel, OffsetValueType sLine, 
+                   TPixel *pTarget, size_t sTarget,
+                   size_t nPixel, size_t nLine)
+{
+  // Neither axis is contiguous in the source, so there is no locality to 
+  // exploit; just walk the source with the given strides
   for(size_t il = 0; il < nLine; il++)
     {
+    const TPixel *pSrc = pSource;
     for(size_t ip = 0; ip < nPixel; ip++)
       {
-      *pTarget = *pSource;
-      pTarget++;
-      pSource+=sPixel;
+      pTarget[ip] = *pSrc;
+      pSrc += sPixel;
       }
-    pSource += sLineDelta;
+    pSource += sLine;
+    pTarget += sTarget;
     }
 }
 
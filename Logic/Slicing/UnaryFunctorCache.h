@@ -41,6 +41,8 @@
 #include "SNAPCommon.h"
 #include "itkMacro.h"
 #include "itkProcessObject.h"
+#include "itkMultiThreader.h"
+#include <vector>
 
 // Forward references
 // template <class TInput, class TOutput, class TFunctor> class UnaryFunctorCache;
@@ -54,6 +56,13 @@ template <class TInput, class TOutput, class TFunctor>
  * This object wraps around a Functor and remembers the output values for 
  * the input values that is receives.  Do not use this class with non-integral
  * types and with types like int and long, or you will run out of memory!
+ *
+ * The table is filled in parallel by ComputeCache(), so the functor must be
+ * safe to call from several threads at once. Evaluate() only reads the 
+ * table and does not rebuild it. After changing the functor or the range,
+ * call ComputeCache() from the thread that updates the pipeline, before
+ * any filter that uses the cache is updated. The table must not be rebuilt
+ * while such a filter is running.
  */
 template <class TInput, class TOutput, class TFunctor> 
 class ITK_EXPORT UnaryFunctorCache : public itk::Object
@@ -76,11 +85,10 @@ public:
   itkTypeMacro(UnaryFunctorCache,itk::Object);
 
   /** Evaluate the function using cache lookup */
-  TOutput Evaluate(const TInput &in) 
+  TOutput Evaluate(const TInput &in) const
     {
-    if(m_Modified)
-      this->ComputeCache();
-    return m_Cache[in - m_CacheBegin];
+    assert(!m_Modified);
+    return m_Table[in - m_TableBegin];
     }
 
   /**
@@ -114,7 +122,10 @@ public:
     m_Modified = true;
   }
 
-  /** Compute the cache */
+  /** 
+   * Compute the cache, if it is out of date. This must be called after the
+   * functor or the evaluation range change, before the cache is evaluated
+   */
   void ComputeCache();
 
   /**
@@ -134,9 +145,14 @@ protected:
   TFunctor *m_InputFunctor;
 
   /**
-   * The storage for the cache
+   * The storage for the cache: a table and the input value of its first
+   * element
    */
-  TOutput *m_Cache;
+  std::vector<TOutput> m_Table;
+  TInput m_TableBegin;
+
+  /** Fill part of the table, called from a thread */
+  static ITK_THREAD_RETURN_TYPE ComputeCacheThreadCallback(void *arg);
 
   /**
    * The bounds of the cache
@@ -144,7 +160,7 @@ protected:
   TInput m_CacheBegin;
   
   /** The length of the cache */
-  unsigned int m_CacheLength, m_CacheAllocatedLength;
+  unsigned int m_CacheLength;
   bool m_Modified;
 
 
@@ -33,7 +33,7 @@
 
 =========================================================================*/
 #include "UnaryFunctorCache.h"
-#include "itkSimpleFastMutexLock.h"
+#include <algorithm>
 
 template <class TInput, class TOutput, class TFunctor>
 UnaryFunctorCache<TInput,TOutput,TFunctor>
@@ -41,10 +41,9 @@ UnaryFunctorCache<TInput,TOutput,TFunctor>
 : m_CachingFunctor(this)
 {
   m_InputFunctor = NULL;
-  m_Cache = NULL;
+  m_TableBegin = 0;
   m_CacheBegin = 0;
   m_CacheLength = 0;
-  m_CacheAllocatedLength = 0;
   m_Modified = false;
 }
 
@@ -52,8 +51,29 @@ template <class TInput, class TOutput, class TFunctor>
 UnaryFunctorCache<TInput,TOutput,TFunctor>
 ::~UnaryFunctorCache() 
 {
-  if(m_Cache)
-    delete[] m_Cache;
+}
+
+template <class TInput, class TOutput, class TFunctor>
+ITK_THREAD_RETURN_TYPE
+UnaryFunctorCache<TInput,TOutput,TFunctor>
+::ComputeCacheThreadCallback(void *arg) 
+{
+  itk::MultiThreader::ThreadInfoStruct *info = 
+    static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  Self *self = static_cast<Self *>(info->UserData);
+
+  // The range of the table filled by this thread
+  unsigned int n = self->m_CacheLength;
+  unsigned int iStart = (unsigned int)
+    (((double) n * info->ThreadID) / info->NumberOfThreads);
+  unsigned int iEnd = (unsigned int)
+    (((double) n * (info->ThreadID + 1)) / info->NumberOfThreads);
+
+  int iFunc = self->m_TableBegin + iStart;
+  for(unsigned int iCache = iStart; iCache < iEnd; iCache++)
+    self->m_Table[iCache] = (*self->m_InputFunctor)(iFunc++);
+
+  return ITK_THREAD_RETURN_VALUE;
 }
 
 template <class TInput, class TOutput, class TFunctor>
@@ -61,33 +81,26 @@ void
 UnaryFunctorCache<TInput,TOutput,TFunctor>
 ::ComputeCache() 
 {
-  // Can't have this running in a thread
-  static itk::SimpleFastMutexLock mutex;
-  mutex.Lock();
+  if(!m_Modified)
+    return;
 
   // Functor must be declared and cache length must be non-zero
   assert(m_InputFunctor && m_CacheLength > 0);
 
-  // Allocate the cache, but only if the length changed
-  if(m_CacheAllocatedLength != m_CacheLength)
-    {
-    if(m_Cache) 
-      delete m_Cache;
-    m_Cache = new TOutput[m_CacheLength];
-    m_CacheAllocatedLength = m_CacheLength;
-    }
-    
-  // Compute the cache elements
-  int iFunc = m_CacheBegin;
-  for(unsigned int iCache = 0; iCache < m_CacheLength; iCache++)
-    {
-    m_Cache[iCache] = (*m_InputFunctor)(iFunc++);
-    }
+  // The table is only reallocated if the length changed
+  m_Table.resize(m_CacheLength);
+  m_TableBegin = m_CacheBegin;
 
-  m_Modified = false;
+  // Split the table between threads, if it is large enough to be worth it
+  unsigned int nThreads = std::max(1u, std::min(
+    (unsigned int) itk::MultiThreader::GetGlobalDefaultNumberOfThreads(),
+    m_CacheLength / 0x1000));
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads(nThreads);
+  threader->SetSingleMethod(&Self::ComputeCacheThreadCallback, this);
+  threader->SingleMethodExecute();
 
-  // Back to thread safety
-  mutex.Unlock();
+  m_Modified = false;
 }
 
 template <class TInput, class TOutput, class TFunctor>
@@ -14,6 +14,10 @@
 =========================================================================*/
 #include "SNAPTestDriver.h"
 #include "TestImageWrapper.h"
+#include "TestSlicerSpeed.h"
+#include "TestLevelSetSpeed.h"
+#include "TestSaveInPlace.h"
+#include "TestCUBCompression.h"
 #include "GreyImageWrapper.h"
 #include "LabelImageWrapper.h"
 #include "SpeedImageWrapper.h"
@@ -25,10 +29,12 @@
 
 using namespace std;
 
-const unsigned int SNAPTestDriver::NUMBER_OF_TESTS = 4;
+const unsigned int SNAPTestDriver::NUMBER_OF_TESTS = 8;
 const char *SNAPTestDriver::m_TestNames[] = { "ImageWrapper",
-  "IRISImageData","SNAPImageData","Preprocessing" };
-const bool SNAPTestDriver::m_TestTemplated[] = { true, false, false, false };
+  "IRISImageData","SNAPImageData","Preprocessing","SlicerSpeed",
+  "LevelSetSpeed","SaveInPlace","CUBCompression" };
+const bool SNAPTestDriver::m_TestTemplated[] = 
+  { true, false, false, false, true, false, false, false };
 
 void
 SNAPTestDriver
@@ -65,6 +71,8 @@ SNAPTestDriver::TemplatedTestCreator<TPixel>
     else
       m_Test = NULL;
     }
+  else if(strName == "SlicerSpeed")
+    m_Test = new TestSlicerSpeed<TPixel>();
   else
     m_Test = NULL;
 }
@@ -83,6 +91,13 @@ SNAPTestDriver
 {
   string strName = name;
   TestBase *test = NULL;
+
+  if(strName == "LevelSetSpeed")
+    test = new TestLevelSetSpeed();
+  else if(strName == "SaveInPlace")
+    test = new TestSaveInPlace();
+  else if(strName == "CUBCompression")
+    test = new TestCUBCompression();
  
   return test;
 }
@@ -97,7 +112,7 @@ SNAPTestDriver
   return test;
 }
 
-void
+int
 SNAPTestDriver
 ::Run(int argc, char *argv[])
 {
@@ -113,7 +128,7 @@ SNAPTestDriver
   if(!clap.TryParseCommandLine(argc,argv,parms,false))
     {
     PrintUsage();
-    return;
+    return 1;
     }
 
   // Check if the user wants help
@@ -131,6 +146,7 @@ SNAPTestDriver
       std::cout << "SNAPTests " << name << " options" << std::endl;
       std::cout << "Options: " << std::endl;
       test->PrintUsage();
+      delete test;
       }
       
     else
@@ -155,6 +171,7 @@ SNAPTestDriver
         std::cout << std::setw(20) << std::ios::left << m_TestNames[i];
         std::cout << std::setw(12) << std::ios::left << (m_TestTemplated[i] ? "Yes" : "No");
         std::cout << test->GetDescription() << std::endl;
+        delete test;
         }
       }
     }
@@ -179,19 +196,19 @@ SNAPTestDriver
         test = TemplatedTestCreator<char>(name).GetTest();
       else if(type == "unsigned_char") 
         test = TemplatedTestCreator<unsigned char>(name).GetTest();
-      if(type == "short")      
+      else if(type == "short")      
         test = TemplatedTestCreator<short>(name).GetTest();
       else if(type == "unsigned_short") 
         test = TemplatedTestCreator<unsigned short>(name).GetTest();
-      if(type == "int")      
+      else if(type == "int")      
         test = TemplatedTestCreator<int>(name).GetTest();
       else if(type == "unsigned_int") 
         test = TemplatedTestCreator<unsigned int>(name).GetTest();
-      if(type == "long")      
+      else if(type == "long")      
         test = TemplatedTestCreator<long>(name).GetTest();
       else if(type == "unsigned_long") 
         test = TemplatedTestCreator<unsigned long>(name).GetTest();
-      if(type == "float")      
+      else if(type == "float")      
         test = TemplatedTestCreator<float>(name).GetTest();
       else if(type == "double") 
         test = TemplatedTestCreator<double>(name).GetTest();
@@ -211,6 +228,8 @@ SNAPTestDriver
     // See if a test has been created after all
     if(test) 
       {
+      // The test is deleted once, whether it passes or fails
+      bool passed = false;
       try 
         {
         // Configure the parameters of the test
@@ -222,13 +241,12 @@ SNAPTestDriver
           {
           test->SetCommandLineParameters(testParms);
           test->Run();
+          passed = true;
           }
         else
           {
           test->PrintUsage();
           }
-        
-        delete test;
         }
       catch(TestUsageException)
         {
@@ -242,15 +260,21 @@ SNAPTestDriver
         {
         std::cerr << "Unknowm Exception!" << std::endl;
         }
+
+      delete test;
+      if(!passed)
+        return 1;
       }
     else
       {
       std::cerr << "Could not create test!" << std::endl;
       PrintUsage();
+      return 1;
       }    
     }
   else
     {
     PrintUsage();
     }
+  return 0;
 }
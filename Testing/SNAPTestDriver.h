@@ -24,8 +24,9 @@
 class SNAPTestDriver
 {
 public:
-  /** Run a test as determined by the command line parameters */
-  void Run(int argc, char *argv[]);
+  /** Run a test as determined by the command line parameters. Returns zero
+   * if the test ran and succeeded */
+  int Run(int argc, char *argv[]);
 
 private:
 
@@ -0,0 +1,240 @@
+/*=========================================================================
+
+  Program:   Insight Segmentation & Registration Toolkit
+  Module:    TestCUBCompression.h
+  Language:  C++
+  Copyright (c) 2003 Insight Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+=========================================================================*/
+#ifndef __TestCUBCompression_h_
+#define __TestCUBCompression_h_
+
+#include "TestBase.h"
+#include "itkVoxBoCUBImageIO.h"
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkImageRegionConstIterator.h"
+
+#ifdef SNAP_GZIP_SUPPORT
+#include "itk_zlib.h"
+#endif
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+/**
+ * This class writes an image to a compressed VoxBo CUB file and reads it
+ * back. The file must be made up of several gzip members, each with the
+ * 'SC' extra subfield holding the size of the member, and it must hold the
+ * same bytes as an uncompressed CUB file when it is read by plain zlib. The
+ * image read back must match the image written, and a file with a damaged
+ * member must be rejected.
+ */
+class TestCUBCompression : public TestBase
+{
+public:
+  typedef itk::OrientedImage<short,3> ImageType;
+
+  void PrintUsage();
+  void Run();
+
+  const char *GetTestName()
+  {
+    return "CUBCompression";
+  }
+
+  const char *GetDescription()
+  {
+    return "Round trip through compressed VoxBo CUB files";
+  }
+
+  virtual void ConfigureCommandLineParser(CommandLineArgumentParser &parser)
+  {
+    parser.AddOption("file",1);
+  }
+
+private:
+  typedef std::vector<unsigned char> ByteArray;
+
+  // Fill the image with data that compresses, but not to nothing
+  ImageType::Pointer CreateSyntheticImage();
+
+  // Write and read an image with the VoxBo IO
+  void WriteImage(ImageType *image, const std::string &fname);
+  ImageType::Pointer ReadImage(const std::string &fname);
+
+  // Read a whole file into memory
+  ByteArray ReadBytes(const std::string &fname);
+
+  // Throw an exception unless a condition holds
+  void Check(bool condition, const char *what);
+};
+
+inline void TestCUBCompression
+::PrintUsage()
+{
+  std::cout << "  file FILE : Scratch file prefix (default CUBCompression)"
+    << std::endl;
+}
+
+inline void TestCUBCompression
+::Check(bool condition, const char *what)
+{
+  std::cout << "  " << what << (condition ? "  OK" : "  FAILED") << std::endl;
+  if(!condition)
+    {
+    itk::ExceptionObject exc(__FILE__, __LINE__);
+    exc.SetDescription(what);
+    throw exc;
+    }
+}
+
+inline TestCUBCompression::ImageType::Pointer
+TestCUBCompression
+::CreateSyntheticImage()
+{
+  // A little over six blocks of the codec, so the last one is partial
+  ImageType::SizeType sz;
+  sz[0] = 181; sz[1] = 157; sz[2] = 113;
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions(sz);
+  image->Allocate();
+
+  itk::ImageRegionIteratorWithIndex<ImageType> it(
+    image, image->GetBufferedRegion());
+  unsigned long seed = 12345;
+  for(; !it.IsAtEnd(); ++it)
+    {
+    ImageType::IndexType idx = it.GetIndex();
+    seed = seed * 1103515245 + 12345;
+    it.Set(static_cast<short>(
+      (idx[0] + 2 * idx[1] + 3 * idx[2]) % 400 + ((seed >> 16) & 0x7)));
+    }
+  return image;
+}
+
+inline void TestCUBCompression
+::WriteImage(ImageType *image, const std::string &fname)
+{
+  typedef itk::ImageFileWriter<ImageType> WriterType;
+  WriterType::Pointer writer = WriterType::New();
+  writer->SetImageIO(itk::VoxBoCUBImageIO::New());
+  writer->SetFileName(fname.c_str());
+  writer->SetInput(image);
+  writer->Update();
+}
+
+inline TestCUBCompression::ImageType::Pointer
+TestCUBCompression
+::ReadImage(const std::string &fname)
+{
+  typedef itk::ImageFileReader<ImageType> ReaderType;
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetImageIO(itk::VoxBoCUBImageIO::New());
+  reader->SetFileName(fname.c_str());
+  reader->Update();
+  return reader->GetOutput();
+}
+
+inline TestCUBCompression::ByteArray
+TestCUBCompression
+::ReadBytes(const std::string &fname)
+{
+  std::ifstream fin(fname.c_str(), std::ios::in | std::ios::binary);
+  return ByteArray(std::istreambuf_iterator<char>(fin),
+    std::istreambuf_iterator<char>());
+}
+
+inline void TestCUBCompression
+::Run()
+{
+#ifdef SNAP_GZIP_SUPPORT
+  std::string prefix = m_Command.IsOptionPresent("file") ?
+    m_Command.GetOptionParameter("file") : "CUBCompression";
+  std::string fnPlain = prefix + ".cub", fnGzip = prefix + ".cub.gz";
+
+  ImageType::Pointer image = CreateSyntheticImage();
+  WriteImage(image, fnPlain);
+  WriteImage(image, fnGzip);
+
+  // Walk the members of the compressed file using their extra fields
+  ByteArray gz = ReadBytes(fnGzip);
+  size_t offset = 0, nMembers = 0;
+  bool membersOk = gz.size() > 0;
+  while(membersOk && offset < gz.size())
+    {
+    const unsigned char *p = &gz[offset];
+    membersOk = gz.size() - offset >= 28 &&
+      p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 && (p[3] & 4) &&
+      p[10] == 8 && p[11] == 0 && p[12] == 'S' && p[13] == 'C' &&
+      p[14] == 4 && p[15] == 0;
+    if(membersOk)
+      {
+      size_t size = 0;
+      for(int k = 3; k >= 0; k--)
+        size = (size << 8) | p[16 + k];
+      membersOk = size >= 28 && size <= gz.size() - offset;
+      offset += size;
+      nMembers++;
+      }
+    }
+  Check(membersOk, "members carry their size in the 'SC' subfield");
+  Check(nMembers > 2, "file is split into several members");
+
+  // Plain zlib reads all the members, and must see the uncompressed file
+  ByteArray plain = ReadBytes(fnPlain);
+  ByteArray inflated(plain.size() + 1);
+  gzFile gzf = gzopen(fnGzip.c_str(), "rb");
+  int n = gzf ? gzread(gzf, &inflated[0], (unsigned) inflated.size()) : -1;
+  if(gzf)
+    gzclose(gzf);
+  inflated.resize(n > 0 ? n : 0);
+  Check(inflated == plain, "zlib reads the same bytes as the plain file");
+
+  // The image read back in parallel must match the image written
+  ImageType::Pointer back = ReadImage(fnGzip);
+  bool same = back->GetBufferedRegion() == image->GetBufferedRegion();
+  itk::ImageRegionConstIterator<ImageType> itA(
+    image, image->GetBufferedRegion());
+  itk::ImageRegionConstIterator<ImageType> itB(
+    back, back->GetBufferedRegion());
+  for(; same && !itA.IsAtEnd(); ++itA, ++itB)
+    same = itA.Get() == itB.Get();
+  Check(same, "image read back matches the image written");
+
+  // Damage the data of the last member, which the CRC must catch
+  gz[gz.size() - 12] ^= 0x55;
+  std::ofstream fout(fnGzip.c_str(), std::ios::out | std::ios::binary);
+  fout.write(reinterpret_cast<const char *>(&gz[0]), gz.size());
+  fout.close();
+  bool rejected = false;
+  try
+    {
+    ReadImage(fnGzip);
+    }
+  catch(itk::ExceptionObject &)
+    {
+    rejected = true;
+    }
+  Check(rejected, "damaged member is rejected");
+
+  remove(fnPlain.c_str());
+  remove(fnGzip.c_str());
+
+  // We are finished testing
+  std::cout << "Testing complete" << std::endl;
+#else
+  itk::ExceptionObject exc(__FILE__, __LINE__);
+  exc.SetDescription("SNAP was built without SNAP_GZIP_SUPPORT");
+  throw exc;
+#endif
+}
+
+#endif //__TestCUBCompression_h_
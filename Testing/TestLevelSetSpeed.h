@@ -0,0 +1,245 @@
+/*=========================================================================
+
+  Program:   Insight Segmentation & Registration Toolkit
+  Module:    TestLevelSetSpeed.h
+  Language:  C++
+  Copyright (c) 2003 Insight Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+=========================================================================*/
+#ifndef __TestLevelSetSpeed_h_
+#define __TestLevelSetSpeed_h_
+
+#include "TestBase.h"
+#include "SNAPLevelSetFunction.h"
+#include "itkSparseFieldLevelSetImageFilter.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkCommand.h"
+#include "itkTimeProbe.h"
+
+#include <iomanip>
+
+/**
+ * This class times the sparse field solver with the speed terms of the
+ * level set function read from the per-voxel speed records and from the
+ * interpolated speed images, in iterations per second of wall time. The
+ * first iteration, which also sets up the layers of the solver, is not
+ * timed. Both modes evolve the same front on a synthetic speed image, and
+ * the test fails if the two level sets differ by more than a tolerance. The
+ * front is kept away from the edges of the image, where the two modes
+ * extend the speed image differently.
+ */
+class TestLevelSetSpeed : public TestBase
+{
+public:
+  typedef itk::OrientedImage<float,3> FloatImageType;
+  typedef SNAPLevelSetFunction<FloatImageType> FunctionType;
+  typedef itk::SparseFieldLevelSetImageFilter<
+    FloatImageType,FloatImageType> FilterType;
+
+  void PrintUsage();
+  void Run();
+
+  const char *GetTestName()
+  {
+    return "LevelSetSpeed";
+  }
+
+  const char *GetDescription()
+  {
+    return "Time the level set solver with and without speed records";
+  }
+
+  virtual void ConfigureCommandLineParser(CommandLineArgumentParser &parser)
+  {
+    parser.AddOption("size",1);
+    parser.AddOption("iterations",1);
+    parser.AddOption("tolerance",1);
+  }
+
+private:
+  // Create the speed image and the initial level set, of the given size
+  void CreateSyntheticImages(unsigned int size);
+
+  // Run the solver in one mode, returning the level set and the number of
+  // timed iterations per second
+  FloatImageType::Pointer RunSolver(
+    bool useSpeedRecords, unsigned int nIterations, double &rate);
+
+  // Start the timer after the first iteration
+  void OnIteration();
+
+  FloatImageType::Pointer m_Speed, m_Init;
+  itk::TimeProbe *m_Probe;
+  unsigned int m_TimedIterations;
+};
+
+inline void TestLevelSetSpeed
+::PrintUsage()
+{
+  std::cout << "  size N : Size of the synthetic image (default 64)"
+    << std::endl;
+  std::cout << "  iterations N : Number of solver iterations (default 30)"
+    << std::endl;
+  std::cout << "  tolerance X : Largest allowed difference between the level"
+    << " sets (default 0.01)" << std::endl;
+}
+
+inline void TestLevelSetSpeed
+::CreateSyntheticImages(unsigned int size)
+{
+  FloatImageType::SizeType sz;
+  sz[0] = size; sz[1] = size + 3; sz[2] = size + 5;
+
+  m_Speed = FloatImageType::New();
+  m_Speed->SetRegions(sz);
+  m_Speed->Allocate();
+
+  m_Init = FloatImageType::New();
+  m_Init->SetRegions(sz);
+  m_Init->Allocate();
+
+  // The speed is high inside an ellipsoid and falls off smoothly outside of
+  // it, with some texture to make the advection field vary. The front starts
+  // as a small sphere at the center and grows to the edge of the ellipsoid
+  double c[3], r[3];
+  for(unsigned int i = 0; i < 3; i++)
+    {
+    c[i] = 0.5 * (sz[i] - 1);
+    r[i] = 0.3 * sz[i];
+    }
+
+  itk::ImageRegionIteratorWithIndex<FloatImageType> it(
+    m_Speed, m_Speed->GetBufferedRegion());
+  itk::ImageRegionIteratorWithIndex<FloatImageType> itInit(
+    m_Init, m_Init->GetBufferedRegion());
+  for(; !it.IsAtEnd(); ++it, ++itInit)
+    {
+    FloatImageType::IndexType idx = it.GetIndex();
+    double e = 0.0, d = 0.0;
+    for(unsigned int i = 0; i < 3; i++)
+      {
+      double x = idx[i] - c[i];
+      e += (x * x) / (r[i] * r[i]);
+      d += x * x;
+      }
+    double texture = 0.1 * ((idx[0] * 7 + idx[1] * 13 + idx[2] * 29) % 5);
+    it.Set(static_cast<float>((0.9 + texture) / (1.0 + e * e * e * e)));
+    itInit.Set(static_cast<float>(vcl_sqrt(d) - 0.1 * size));
+    }
+}
+
+inline void TestLevelSetSpeed
+::OnIteration()
+{
+  if(m_TimedIterations++ == 0)
+    m_Probe->Start();
+}
+
+inline TestLevelSetSpeed::FloatImageType::Pointer
+TestLevelSetSpeed
+::RunSolver(bool useSpeedRecords, unsigned int nIterations, double &rate)
+{
+  // Set up the function like the level set driver does for edge snakes
+  FunctionType::Pointer phi = FunctionType::New();
+  phi->SetSpeedImage(m_Speed);
+  phi->SetUseSpeedRecords(useSpeedRecords);
+  phi->SetAdvectionWeight(-0.5);
+  phi->SetAdvectionSpeedExponent(0);
+  phi->SetCurvatureWeight(0.2);
+  phi->SetCurvatureSpeedExponent(2);
+  phi->SetPropagationWeight(1.0);
+  phi->SetPropagationSpeedExponent(1);
+  phi->SetLaplacianSmoothingWeight(0.0);
+  phi->SetLaplacianSmoothingSpeedExponent(0);
+  phi->CalculateInternalImages();
+
+  FunctionType::RadiusType radius;
+  radius.Fill(1);
+  phi->Initialize(radius);
+  phi->SetTimeStepFactor(1.0);
+
+  FilterType::Pointer filter = FilterType::New();
+  filter->SetInput(m_Init);
+  filter->SetDifferenceFunction(phi);
+  filter->SetNumberOfIterations(nIterations);
+  filter->SetNumberOfLayers(3);
+  filter->SetIsoSurfaceValue(0.0f);
+
+  // Time the iterations after the first one, in wall time
+  typedef itk::SimpleMemberCommand<TestLevelSetSpeed> CommandType;
+  CommandType::Pointer cmd = CommandType::New();
+  cmd->SetCallbackFunction(this, &TestLevelSetSpeed::OnIteration);
+  filter->AddObserver(itk::IterationEvent(), cmd);
+
+  itk::TimeProbe probe;
+  m_Probe = &probe;
+  m_TimedIterations = 0;
+  filter->Update();
+  if(m_TimedIterations)
+    probe.Stop();
+
+  double seconds = probe.GetMeanTime();
+  rate = (m_TimedIterations > 1 && seconds > 0)
+    ? (m_TimedIterations - 1) / seconds : 0.0;
+
+  FloatImageType::Pointer result = filter->GetOutput();
+  result->DisconnectPipeline();
+  return result;
+}
+
+inline void TestLevelSetSpeed
+::Run()
+{
+  unsigned int size = m_Command.IsOptionPresent("size") ?
+    atoi(m_Command.GetOptionParameter("size")) : 64;
+  unsigned int nIterations = m_Command.IsOptionPresent("iterations") ?
+    atoi(m_Command.GetOptionParameter("iterations")) : 30;
+  double tolerance = m_Command.IsOptionPresent("tolerance") ?
+    atof(m_Command.GetOptionParameter("tolerance")) : 0.01;
+
+  CreateSyntheticImages(size);
+
+  double rateImages, rateRecords;
+  FloatImageType::Pointer lsImages = RunSolver(false, nIterations, rateImages);
+  FloatImageType::Pointer lsRecords = RunSolver(true, nIterations, rateRecords);
+
+  std::cout << std::setw(24) << "Speed terms"
+    << std::setw(16) << "iterations/sec" << std::endl;
+  std::cout << std::setw(24) << "interpolated images"
+    << std::setw(16) << rateImages << std::endl;
+  std::cout << std::setw(24) << "speed records"
+    << std::setw(16) << rateRecords << std::endl;
+
+  // Compare the two level sets, outside of the timing
+  itk::ImageRegionConstIterator<FloatImageType> itImages(
+    lsImages, lsImages->GetBufferedRegion());
+  itk::ImageRegionConstIterator<FloatImageType> itRecords(
+    lsRecords, lsRecords->GetBufferedRegion());
+  double maxDiff = 0.0;
+  for(; !itImages.IsAtEnd(); ++itImages, ++itRecords)
+    {
+    double diff = vcl_fabs(itImages.Get() - itRecords.Get());
+    if(diff > maxDiff)
+      maxDiff = diff;
+    }
+  std::cout << "Largest difference between the level sets: "
+    << maxDiff << std::endl;
+
+  if(maxDiff > tolerance)
+    {
+    itk::ExceptionObject exc(__FILE__, __LINE__);
+    exc.SetDescription(
+      "Level sets computed with and without speed records differ");
+    throw exc;
+    }
+
+  // We are finished testing
+  std::cout << "Testing complete" << std::endl;
+}
+
+#endif //__TestLevelSetSpeed_h_
@@ -20,6 +20,5 @@ std::ostream &verbose = std::cout;
 int main(int argc, char *argv[]) 
 {
   SNAPTestDriver driver;
-  driver.Run(argc,argv);
-  return 0;
+  return driver.Run(argc,argv);
 }
@@ -0,0 +1,181 @@
+/*=========================================================================
+
+  Program:   Insight Segmentation & Registration Toolkit
+  Module:    TestSaveInPlace.h
+  Language:  C++
+  Copyright (c) 2003 Insight Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+=========================================================================*/
+#ifndef __TestSaveInPlace_h_
+#define __TestSaveInPlace_h_
+
+#include "TestBase.h"
+#include "GuidedNativeImageIO.h"
+#include "Registry.h"
+#include "itkByteSwapper.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+
+/**
+ * This class checks that an image read from an uncompressed raw file, which
+ * is mapped into memory rather than read, can be saved back over the same
+ * file. The grey and the label casts are both tried. The saved file and the
+ * image in memory must both still hold the original data.
+ */
+class TestSaveInPlace : public TestBase
+{
+public:
+  void PrintUsage();
+  void Run();
+
+  const char *GetTestName()
+  {
+    return "SaveInPlace";
+  }
+
+  const char *GetDescription()
+  {
+    return "Save images read from mapped raw files over their source file";
+  }
+
+  virtual void ConfigureCommandLineParser(CommandLineArgumentParser &parser)
+  {
+    parser.AddOption("file",1);
+  }
+
+private:
+  // Write the test data to a raw file
+  void WriteRawFile(const char *fname);
+
+  // Read the raw file, cast it, save it back in place and check the result
+  template<class TPixel, class TCaster>
+    void RunCase(const char *fname, const char *caseName);
+
+  // Check that a buffer holds the test data
+  template<class TPixel>
+    bool CheckData(const TPixel *data);
+
+  // Fill in a registry folder describing the raw file
+  void DescribeRawFile(Registry &folder);
+
+  enum { NX = 67, NY = 45, NZ = 33 };
+  std::vector<GreyType> m_Data;
+};
+
+inline void TestSaveInPlace
+::PrintUsage()
+{
+  std::cout << "  file FILE : Scratch file to use (default SaveInPlace.raw)"
+    << std::endl;
+}
+
+inline void TestSaveInPlace
+::WriteRawFile(const char *fname)
+{
+  // The values fit both the grey and the label type, so neither cast has
+  // to rescale them
+  m_Data.resize(NX * NY * NZ);
+  for(size_t i = 0; i < m_Data.size(); i++)
+    m_Data[i] = static_cast<GreyType>((i * 7919) % 30011);
+
+  std::ofstream fout(fname, std::ios::out | std::ios::binary);
+  fout.write(reinterpret_cast<const char *>(&m_Data[0]),
+    m_Data.size() * sizeof(GreyType));
+  if(!fout.good())
+    {
+    itk::ExceptionObject exc(__FILE__, __LINE__);
+    exc.SetDescription("Could not write the scratch file");
+    throw exc;
+    }
+}
+
+inline void TestSaveInPlace
+::DescribeRawFile(Registry &folder)
+{
+  // The file is in the byte order of this machine, so it can be mapped
+  GuidedNativeImageIO::SetFileFormat(folder, GuidedNativeImageIO::FORMAT_RAW);
+  GuidedNativeImageIO::SetPixelType(folder, GuidedNativeImageIO::PIXELTYPE_SHORT);
+  folder["Raw.HeaderSize"] << 0;
+  folder["Raw.Dimensions"] << Vector3i(NX, NY, NZ);
+  folder["Raw.BigEndian"] <<
+    itk::ByteSwapper<GreyType>::SystemIsBigEndian();
+}
+
+template<class TPixel>
+bool TestSaveInPlace
+::CheckData(const TPixel *data)
+{
+  for(size_t i = 0; i < m_Data.size(); i++)
+    if(static_cast<GreyType>(data[i]) != m_Data[i])
+      return false;
+  return true;
+}
+
+template<class TPixel, class TCaster>
+void TestSaveInPlace
+::RunCase(const char *fname, const char *caseName)
+{
+  WriteRawFile(fname);
+
+  Registry folder;
+  DescribeRawFile(folder);
+
+  // Read the image and cast it the way the application does. The reader 
+  // is let go of, like after loading an image in the application
+  GuidedNativeImageIO *io = new GuidedNativeImageIO();
+  io->ReadNativeImage(fname, folder);
+  TCaster caster;
+  typename TCaster::OutputImageType::Pointer image = caster(io);
+  delete io;
+
+  // Save the image over the file it came from
+  GuidedNativeImageIO ioSave;
+  ioSave.SaveImage(fname, folder, image.GetPointer());
+
+  // The image in memory must be intact, and so must the file
+  bool ok = CheckData(image->GetBufferPointer());
+  if(ok)
+    {
+    GuidedNativeImageIO ioCheck;
+    ioCheck.ReadNativeImage(fname, folder);
+    TCaster caster;
+    typename TCaster::OutputImageType::Pointer check = caster(&ioCheck);
+    ok = CheckData(check->GetBufferPointer());
+    }
+
+  std::cout << std::setw(12) << caseName << (ok ? "  OK" : "  FAILED")
+    << std::endl;
+
+  if(!ok)
+    {
+    itk::ExceptionObject exc(__FILE__, __LINE__);
+    exc.SetDescription("Image saved over its source file does not match");
+    throw exc;
+    }
+}
+
+inline void TestSaveInPlace
+::Run()
+{
+  std::string fname = m_Command.IsOptionPresent("file") ?
+    m_Command.GetOptionParameter("file") : "SaveInPlace.raw";
+
+  RunCase<GreyType, RescaleNativeImageToScalar<GreyType> >(
+    fname.c_str(), "grey");
+  RunCase<LabelType, CastNativeImageToScalar<LabelType> >(
+    fname.c_str(), "label");
+
+  remove(fname.c_str());
+
+  // We are finished testing
+  std::cout << "Testing complete" << std::endl;
+}
+
+#endif //__TestSaveInPlace_h_
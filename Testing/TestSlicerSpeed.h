@@ -0,0 +1,224 @@
+/*=========================================================================
+
+  Program:   Insight Segmentation & Registration Toolkit
+  Module:    TestSlicerSpeed.h
+  Language:  C++
+  Copyright (c) 2003 Insight Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+=========================================================================*/
+#ifndef __TestSlicerSpeed_h_
+#define __TestSlicerSpeed_h_
+
+#include "TestBase.h"
+#include "IRISSlicer.h"
+#include "itkTimeProbe.h"
+#include "itkImageSliceConstIteratorWithIndex.h"
+#include "itkImageRegionIteratorWithIndex.h"
+
+#include <iomanip>
+
+/**
+ * This class times IRISSlicer for each of the six assignments of image
+ * axes to the pixel and line directions of the slice, traversing the axes
+ * forward and backward. The per-slice latency is reported in milliseconds.
+ * Every slice is also compared to a reference slice extracted with an 
+ * image slice iterator, and the test fails on any difference. Instead of
+ * an image file, a synthetic image of a given size can be used.
+ */
+template<class TPixel>
+class TestSlicerSpeed : public TestBaseOneImage<TPixel>
+{
+public:
+  typedef TestBaseOneImage<TPixel> Superclass;
+  typedef IRISSlicer<TPixel> SlicerType;
+
+  void PrintUsage();
+  void Run();
+
+  const char *GetTestName()
+  {
+    return "SlicerSpeed";
+  }
+
+  const char *GetDescription()
+  {
+    return "Time slice extraction for all slice orientations";
+  }
+
+  virtual void ConfigureCommandLineParser(CommandLineArgumentParser &parser)
+  {
+    Superclass::ConfigureCommandLineParser(parser);
+    parser.AddOption("repeat",1);
+    parser.AddOption("size",1);
+  }
+
+private:
+  typedef typename Superclass::ImageType ImageType;
+  typedef typename SlicerType::OutputImageType SliceType;
+
+  // Fill the image with a synthetic pattern, with unequal dimensions
+  void CreateSyntheticImage(unsigned int size);
+
+  // Compare a slice to the reference slice computed with an iterator
+  bool CompareToReference(SlicerType *slicer, SliceType *slice);
+};
+
+template<class TPixel>
+void TestSlicerSpeed<TPixel>
+::PrintUsage()
+{
+  // Run the parent's part of the test
+  Superclass::PrintUsage();
+
+  std::cout << "  repeat N : Number of passes through the slices (default 1)"
+    << std::endl;
+}
+
+template<class TPixel>
+void TestSlicerSpeed<TPixel>
+::CreateSyntheticImage(unsigned int size)
+{
+  typename ImageType::SizeType sz;
+  sz[0] = size; sz[1] = size + 3; sz[2] = size + 5;
+  this->m_Image = ImageType::New();
+  this->m_Image->SetRegions(sz);
+  this->m_Image->Allocate();
+
+  // Every voxel gets a value that depends on all three coordinates
+  itk::ImageRegionIteratorWithIndex<ImageType> it(
+    this->m_Image, this->m_Image->GetBufferedRegion());
+  for(; !it.IsAtEnd(); ++it)
+    {
+    typename ImageType::IndexType idx = it.GetIndex();
+    it.Set(static_cast<TPixel>(
+      (idx[0] * 7 + idx[1] * 131 + idx[2] * 1031) % 127));
+    }
+}
+
+template<class TPixel>
+bool TestSlicerSpeed<TPixel>
+::CompareToReference(SlicerType *slicer, SliceType *slice)
+{
+  unsigned int iPixel = slicer->GetPixelDirectionImageAxis();
+  unsigned int iLine = slicer->GetLineDirectionImageAxis();
+  unsigned int iSlice = slicer->GetSliceDirectionImageAxis();
+  typename ImageType::SizeType sz = 
+    this->m_Image->GetBufferedRegion().GetSize();
+
+  // Walk the voxels of the slice in the image
+  typename ImageType::RegionType region = this->m_Image->GetBufferedRegion();
+  region.SetIndex(iSlice, slicer->GetSliceIndex());
+  region.SetSize(iSlice, 1);
+  itk::ImageSliceConstIteratorWithIndex<ImageType> it(this->m_Image, region);
+  it.SetFirstDirection(iPixel);
+  it.SetSecondDirection(iLine);
+
+  typename SliceType::IndexType origin = slice->GetBufferedRegion().GetIndex();
+  for(it.GoToBegin(); !it.IsAtEnd(); it.NextSlice())
+    {
+    for(; !it.IsAtEndOfSlice(); it.NextLine())
+      {
+      for(; !it.IsAtEndOfLine(); ++it)
+        {
+        // Find where the voxel belongs in the slice
+        typename ImageType::IndexType idx = it.GetIndex();
+        typename SliceType::IndexType pos;
+        pos[0] = origin[0] + (slicer->GetPixelTraverseForward() 
+          ? idx[iPixel] : sz[iPixel] - 1 - idx[iPixel]);
+        pos[1] = origin[1] + (slicer->GetLineTraverseForward() 
+          ? idx[iLine] : sz[iLine] - 1 - idx[iLine]);
+        if(slice->GetPixel(pos) != it.Get())
+          return false;
+        }
+      }
+    }
+  return true;
+}
+
+template<class TPixel>
+void TestSlicerSpeed<TPixel>
+::Run()
+{
+  // Create a synthetic image or run the parent's part of the test (loads 
+  // image)
+  if(this->m_Command.IsOptionPresent("size"))
+    CreateSyntheticImage(atoi(this->m_Command.GetOptionParameter("size")));
+  else
+    Superclass::Run();
+
+  // Get the number of passes
+  unsigned int nRepeat = this->m_Command.IsOptionPresent("repeat") ?
+    atoi(this->m_Command.GetOptionParameter("repeat")) : 1;
+
+  // The six orientations of the slice: pixel axis and line axis
+  const unsigned int axes[6][2] =
+    { {0,1}, {1,0}, {0,2}, {2,0}, {1,2}, {2,1} };
+
+  std::cout << std::setw(8) << "Pixel" << std::setw(8) << "Line";
+  std::cout << std::setw(8) << "Slice" << std::setw(12) << "Direction";
+  std::cout << std::setw(16) << "ms/slice" << std::endl;
+
+  typename SlicerType::Pointer slicer = SlicerType::New();
+  slicer->SetInput(this->m_Image);
+
+  for(unsigned int i = 0; i < 6; i++)
+    {
+    unsigned int iPixel = axes[i][0], iLine = axes[i][1];
+    unsigned int iSlice = 3 - (iPixel + iLine);
+    unsigned int nSlices =
+      this->m_Image->GetBufferedRegion().GetSize()[iSlice];
+
+    slicer->SetPixelDirectionImageAxis(iPixel);
+    slicer->SetLineDirectionImageAxis(iLine);
+    slicer->SetSliceDirectionImageAxis(iSlice);
+
+    // Try each combination of traversal directions
+    for(unsigned int dir = 0; dir < 4; dir++)
+      {
+      slicer->SetPixelTraverseForward((dir & 1) == 0);
+      slicer->SetLineTraverseForward((dir & 2) == 0);
+
+      // Measure wall time, since the slicer is multithreaded
+      itk::TimeProbe probe;
+      probe.Start();
+      for(unsigned int r = 0; r < nRepeat; r++)
+        {
+        for(unsigned int k = 0; k < nSlices; k++)
+          {
+          slicer->SetSliceIndex(k);
+          slicer->Update();
+          }
+        }
+      probe.Stop();
+      double ms = 1000.0 * probe.GetMeanTime() / (nSlices * nRepeat);
+
+      std::cout << std::setw(8) << iPixel << std::setw(8) << iLine;
+      std::cout << std::setw(8) << iSlice;
+      std::cout << std::setw(6) << ((dir & 1) ? "-" : "+");
+      std::cout << std::setw(6) << ((dir & 2) ? "-" : "+");
+      std::cout << std::setw(16) << ms << std::endl;
+
+      // Check every slice against the reference, outside of the timing
+      for(unsigned int k = 0; k < nSlices; k++)
+        {
+        slicer->SetSliceIndex(k);
+        slicer->Update();
+        if(!CompareToReference(slicer, slicer->GetOutput()))
+          {
+          itk::ExceptionObject exc(__FILE__, __LINE__);
+          exc.SetDescription("Slice differs from the reference slice");
+          throw exc;
+          }
+        }
+      }
+    }
+
+  // We are finished testing
+  std::cout << "Testing complete" << std::endl;
+}
+
+#endif //__TestSlicerSpeed_h_
@@ -48,7 +48,7 @@ StatisticsTable
   m_Body.clear();
 
   // Get first entry
-  SegmentationStatistics::Entry e = data.GetStats()[0];
+  const SegmentationStatistics::Entry &e = data.GetStats()[0];
 
   // Set the columns
   m_Header.push_back("Label");
@@ -67,7 +67,7 @@ StatisticsTable
   // Set the body of the table
   for(size_t i = 0; i < MAX_COLOR_LABELS; i++)
     {
-    SegmentationStatistics::Entry e = data.GetStats()[i];
+    const SegmentationStatistics::Entry &e = data.GetStats()[i];
     const ColorLabel &cl = clt.GetColorLabel(i);
     if(e.count == 0) 
       continue;
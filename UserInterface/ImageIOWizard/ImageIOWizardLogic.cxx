@@ -67,6 +67,7 @@ ImageIOWizardLogic
 
   // Initialize the callback pointer
   m_Callback = NULL;
+  m_ProgressCommand = NULL;
 }
 
 
@@ -588,7 +589,8 @@ ImageIOWizardLogic
     {     
     // Since we want to store the image IO, we need to use these two calls 
     // instead of just calling ReadImage with the registry
-    m_GuidedIO.ReadNativeImage(m_InFilePageBrowser->value(), m_Registry);
+    m_GuidedIO.ReadNativeImage(
+      m_InFilePageBrowser->value(), m_Registry, m_ProgressCommand);
 
     /* 
     if(this->IsNativeFormatSupported())
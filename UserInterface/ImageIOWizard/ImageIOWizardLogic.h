@@ -62,6 +62,7 @@ namespace itk
   template <unsigned int VDimensions> class ImageBase;
   class ImageIOBase;  
   class GDCMSeriesFileNames;
+  class Command;
 }
 
 /**
@@ -205,6 +206,10 @@ public:
   void SetImageInfoCallback(ImageInfoCallbackInterface *iCallback)
     { this->m_Callback = iCallback; }
 
+  /** Set the command that observes the progress of reading an image */
+  void SetProgressCommand(itk::Command *command)
+    { this->m_ProgressCommand = command; }
+
   /** Get the native image IO */
   GuidedNativeImageIO *GetNativeImageIO()
     { return &m_GuidedIO; }
@@ -252,6 +257,9 @@ protected:
   /** A callback for retrieving image information */
   ImageInfoCallbackInterface *m_Callback;
 
+  /** A command that observes the progress of reading the image */
+  itk::Command *m_ProgressCommand;
+
   /** DICOM file names lister */
   itk::SmartPointer<itk::GDCMSeriesFileNames> m_DICOMLister;
 
@@ -602,6 +602,8 @@ LabelEditorUILogic
     if(nChanged)
       {
       iSeg->Modified();
+      m_Driver->GetCurrentImageData()->GetSegmentation()->AddDirtyRegion(
+        iSeg->GetBufferedRegion());
       m_Parent->StoreUndoPoint("Topological Merge");
       m_Parent->OnSegmentationImageUpdate(false);
       }
@@ -380,13 +380,18 @@ PreprocessingUILogic
       // Create the filter
       m_EdgePreviewFilter[i] = EdgeFilterType::New();
 
-      // Give it an input
+      // Give it an input. The filter only processes the slice requested by
+      // the slicer, padded by the support of the Gaussian kernel
       m_EdgePreviewFilter[i]->SetInput(
         m_Driver->GetSNAPImageData()->GetGrey()->GetImage());
   
       // Pass the current settings to the filter
       m_EdgePreviewFilter[i]->SetEdgePreprocessingSettings(
         m_GlobalState->GetEdgePreprocessingSettings());
+
+      // The range of the gradient magnitude over the whole image is only
+      // computed by the first filter, and shared with the other two
+      m_EdgePreviewFilter[i]->SetGradientRangeSource(m_EdgePreviewFilter[0]);
       }
         
     // Attach the preview filters to the corresponding slicers
@@ -447,7 +452,7 @@ PreprocessingUILogic
       // Create the filter
       m_InOutPreviewFilter[i] = InOutFilterType::New();
 
-      // Give it an input
+      // Give it an input. Only the slice requested by the slicer is computed
       m_InOutPreviewFilter[i]->SetInput(
         m_Driver->GetSNAPImageData()->GetGrey()->GetImage());
   
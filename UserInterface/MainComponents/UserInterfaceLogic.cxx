@@ -108,6 +108,12 @@ using namespace std;
 
 #define COLORBAR_LABEL FL_FREE_LABELTYPE
 
+// How often the display checks for new results from the snake worker (sec)
+#define SNAKE_DISPLAY_INTERVAL (1.0 / 30)
+
+// Timeout callback that displays results from the snake worker
+void fnSnakeDisplayFunction(void *userData);
+
 void xyz_draw(const Fl_Label *label, int x, int y, int w, int h, Fl_Align align) {  
   // We can't trust the label's color because it can be changed when the menu item
   // is selected. Instead, we encode the color in the label itself using octal notation
@@ -427,6 +433,12 @@ UserInterfaceLogic
   m_ProgressCommand->SetCallbackFunction(
     this,&UserInterfaceLogic::OnITKProgressEvent);
 
+  // The image IO wizards report the progress of reading images
+  m_WizGreyIO->SetProgressCommand(m_ProgressCommand);
+  m_WizSegmentationIO->SetProgressCommand(m_ProgressCommand);
+  m_WizPreprocessingIO->SetProgressCommand(m_ProgressCommand);
+  m_WizLevelSetIO->SetProgressCommand(m_ProgressCommand);
+
   // Initialize the preprocessing windows
   m_PreprocessingUI = new PreprocessingUILogic;
   m_PreprocessingUI->MakeWindow();
@@ -478,6 +490,11 @@ UserInterfaceLogic
   // Create a callback command for the snake loop
   m_PostSnakeCommand = SimpleCommandType::New();
 
+  // Create a callback command for displaying image previews
+  m_PreviewCommand = SimpleCommandType::New();
+  m_PreviewCommand->SetCallbackFunction(
+    this, &UserInterfaceLogic::OnMainImagePreview);
+
   // Initialize the Help UI
   m_HelpUI = new HelpViewerLogic;
   m_HelpUI->MakeWindow();
@@ -492,6 +509,9 @@ UserInterfaceLogic
   m_DlgLabelsIO->SetLoadCallback(this,&UserInterfaceLogic::OnLoadLabelsAction);
   m_DlgLabelsIO->SetSaveCallback(this,&UserInterfaceLogic::OnSaveLabelsAction);
 
+  /** Statistics for the volumes window */
+  m_Statistics = new SegmentationStatistics();
+
   /** Write voxels dialog */
   m_DlgVoxelCountsIO = new SimpleFileDialogLogic();
   m_DlgVoxelCountsIO->MakeWindow();
@@ -547,6 +567,7 @@ UserInterfaceLogic
   // Other IO dialogs
   delete m_DlgLabelsIO;
   delete m_DlgVoxelCountsIO;
+  delete m_Statistics;
 
   // Delete the UI's
   delete m_SnakeParametersUI;
@@ -725,6 +746,11 @@ UserInterfaceLogic
     fl_alert("Out of memory! Try using a smaller region of interest or subsampling.");
     return;
     }
+  catch(itk::ProcessAborted &)
+    {
+    m_WinProgress->hide();
+    return;
+    }
 
   // Set the current application image mode to SNAP data
   m_Driver->SetCurrentImageDataToSNAP();
@@ -1305,6 +1331,12 @@ UserInterfaceLogic
 
   m_GlobalState->SetSnakeActive(true);
 
+  // Run the evolution on a worker thread, and poll for its results at the
+  // display rate
+  snapData->StartSegmentationWorker();
+  Fl::remove_timeout(fnSnakeDisplayFunction, this);
+  Fl::add_timeout(SNAKE_DISPLAY_INTERVAL, fnSnakeDisplayFunction, this);
+
   OnSnakeUpdate();
 }
 
@@ -1427,31 +1459,45 @@ UserInterfaceLogic
   // Stop the snake if it's running
   OnSnakeStopAction();
 
-  // Basically, we tell the level set driver that we want a restart
+  // Basically, we tell the level set driver that we want a restart. The
+  // display is updated once the worker has done so
   m_Driver->GetSNAPImageData()->RestartSegmentation();
-
-  // Update the display
-  OnSnakeUpdate();
 }
 
-void fnSnakeIdleFunction(void *userData)
+void fnSnakeDisplayFunction(void *userData)
 {
   // Get the instance of the calling class
   UserInterfaceLogic *uiLogic = (UserInterfaceLogic *) userData;
 
-  // Request that the desired number of iterations be executed
-  uiLogic->GetDriver()->GetSNAPImageData()->RunSegmentation(
-    uiLogic->m_SnakeStepSize);
-  
-  // Update the display
-  uiLogic->OnSnakeUpdate();
+  // Stop polling once the segmentation has been terminated
+  SNAPImageData *snapData = uiLogic->GetDriver()->GetSNAPImageData();
+  if(!snapData || !snapData->IsSegmentationActive())
+    return;
+
+  // Display the latest state of the snake published by the worker
+  try
+    {
+    if(snapData->UpdateSegmentationSnapshot())
+      uiLogic->OnSnakeUpdate();
+    }
+  catch(IRISException &exc)
+    {
+    // The worker has stopped the evolution, so stop showing it as running
+    uiLogic->m_Activation->UpdateFlag(UIF_SNAP_SNAKE_EDITABLE, true);
+    uiLogic->OnSnakeUpdate();
+    fl_alert("%s", exc.what());
+    }
+
+  Fl::repeat_timeout(SNAKE_DISPLAY_INTERVAL, fnSnakeDisplayFunction, userData);
 }
 
 void 
 UserInterfaceLogic
 ::OnSnakeStopAction()
 {
-  Fl::remove_idle(fnSnakeIdleFunction, this);
+  SNAPImageData *snapData = m_Driver->GetSNAPImageData();
+  if(snapData && snapData->IsSegmentationActive())
+    snapData->PauseSegmentation();
   m_Activation->UpdateFlag(UIF_SNAP_SNAKE_EDITABLE, true);
 }
 
@@ -1460,7 +1506,7 @@ UserInterfaceLogic
 ::OnSnakePlayAction()
 {
   m_Activation->UpdateFlag(UIF_SNAP_SNAKE_RUNNING, true);
-  Fl::add_idle(fnSnakeIdleFunction, this);
+  m_Driver->GetSNAPImageData()->PlaySegmentation(m_SnakeStepSize);
 }
 
 void 
@@ -1489,8 +1535,8 @@ UserInterfaceLogic
   // Stop the snake if it's running
   OnSnakeStopAction();
 
-  // Call the idle function directly
-  fnSnakeIdleFunction(this);
+  // Ask the worker for one block of iterations
+  m_Driver->GetSNAPImageData()->RunSegmentation(m_SnakeStepSize);
 }
 
 void 
@@ -1499,6 +1545,10 @@ UserInterfaceLogic
 {
   // Save the step size
   m_SnakeStepSize = atoi(m_InStepSize->text());
+
+  // Pass it on to the worker if the snake is running
+  if(m_Activation->GetFlag(UIF_SNAP_SNAKE_RUNNING))
+    m_Driver->GetSNAPImageData()->PlaySegmentation(m_SnakeStepSize);
 }
 
 
@@ -1629,6 +1679,9 @@ UserInterfaceLogic
   // Turn off segmentation if it's active
   if(m_Driver->GetSNAPImageData()->IsSegmentationActive())
     {
+    // Bring the snake image up to date with the final state of the level set
+    m_Driver->GetSNAPImageData()->StopSegmentationWorker();
+
     // Tell the update loop to terminate
     m_Driver->GetSNAPImageData()->TerminateSegmentation();
     }
@@ -4045,9 +4098,9 @@ void
 UserInterfaceLogic
 ::OnStatisticsUpdateAction()
 {
-  SegmentationStatistics stats;
-  stats.Compute(m_Driver->GetCurrentImageData());
-  m_TableStatistics->SetSegmentationStatistics(stats, *m_Driver->GetColorLabelTable());
+  m_Statistics->Compute(m_Driver->GetCurrentImageData());
+  m_TableStatistics->SetSegmentationStatistics(
+    *m_Statistics, *m_Driver->GetColorLabelTable());
   m_TableStatistics->redraw();
 }
   
@@ -4274,6 +4327,25 @@ UserInterfaceLogic
     }
 }
 
+void
+UserInterfaceLogic
+::OnMainImagePreview()
+{
+  // The driver holds a subsampled copy of the image that is being loaded.
+  // Show it in the slice windows, leaving the activation flags and the rest
+  // of the user interface alone until the full resolution image is in place
+  for(unsigned int i = 0; i < 3; i++)
+    {
+    m_IRISWindowManager2D[i]->InitializeSlice(m_Driver->GetCurrentImageData());
+    m_SliceWindow[i]->redraw();
+    }
+  m_SliceCoordinator->ResetViewToFitInAllWindows();
+
+  // Draw the windows before the loading continues. Unlike Fl::check(), this
+  // does not handle events, so the menus can not be used during the load
+  Fl::flush();
+}
+
 void
 UserInterfaceLogic
 ::OnRGBImageUpdate()
@@ -4535,7 +4607,18 @@ UserInterfaceLogic
   IRISApplication::MainImageType intype = 
     force_grey ? IRISApplication::MAIN_SCALAR : 
     (force_rgb ? IRISApplication::MAIN_RGB : IRISApplication::MAIN_ANY);
-  IRISApplication::MainImageType type = m_Driver->LoadMainImage(fname, intype);
+  IRISApplication::MainImageType type;
+  try
+    {
+    type = m_Driver->LoadMainImage(
+      fname, intype, m_PreviewCommand, m_ProgressCommand);
+    }
+  catch(...)
+    {
+    // Take the slice windows off the preview, which the driver unloaded
+    UnloadAllImages();
+    throw;
+    }
 
   if(type == IRISApplication::MAIN_SCALAR)
     {
@@ -4585,7 +4668,17 @@ UserInterfaceLogic
   UnloadAllImages();
 
   // Load the image on the logical side
-  m_Driver->LoadMainImage(fname, IRISApplication::MAIN_SCALAR);
+  try
+    {
+    m_Driver->LoadMainImage(fname, IRISApplication::MAIN_SCALAR, 
+      m_PreviewCommand, m_ProgressCommand);
+    }
+  catch(...)
+    {
+    // Take the slice windows off the preview, which the driver unloaded
+    UnloadAllImages();
+    throw;
+    }
 
   // Update the system's history list
   m_SystemInterface->UpdateHistory("GreyImage", 
@@ -4631,9 +4724,21 @@ UserInterfaceLogic
     UnloadAllImages();
 
     // Send the image and RAI to the IRIS application driver
-    m_Driver->UpdateIRISMainImage(
-      m_WizGreyIO->GetNativeImageIO(), IRISApplication::MAIN_SCALAR);
-    m_WizGreyIO->ReleaseImage();
+    try
+      {
+      m_Driver->UpdateIRISMainImage(
+        m_WizGreyIO->GetNativeImageIO(), IRISApplication::MAIN_SCALAR,
+        m_PreviewCommand);
+      m_WizGreyIO->ReleaseImage();
+      }
+    catch(itk::ExceptionObject &exc)
+      {
+      // Take the slice windows off the preview, which the driver unloaded
+      m_WizGreyIO->ReleaseImage();
+      UnloadAllImages();
+      fl_alert("Error loading greyscale image: %s", exc.what());
+      return;
+      }
 
     // Update the system's history list
     m_SystemInterface->UpdateHistory("GreyImage", m_WizGreyIO->GetFileName());
@@ -4662,7 +4767,8 @@ UserInterfaceLogic
   UnloadAllImages();
 
   // Perform the loading on the Logic side
-  m_Driver->LoadMainImage(fname, IRISApplication::MAIN_RGB);
+  m_Driver->LoadMainImage(
+    fname, IRISApplication::MAIN_RGB, NULL, m_ProgressCommand);
 
   // Add the filename to the history
   m_SystemInterface->UpdateHistory("RGBImage",  
@@ -4691,7 +4797,8 @@ UserInterfaceLogic
   IRISApplication::MainImageType intype = 
     force_grey ? IRISApplication::MAIN_SCALAR : 
     (force_rgb ? IRISApplication::MAIN_RGB : IRISApplication::MAIN_ANY);
-  IRISApplication::MainImageType type = m_Driver->LoadOverlayImage(fname, intype);
+  IRISApplication::MainImageType type = 
+    m_Driver->LoadOverlayImage(fname, intype, m_ProgressCommand);
 
   // Update the system's history list
   if(type == IRISApplication::MAIN_SCALAR)
@@ -4722,7 +4829,8 @@ UserInterfaceLogic
 {
   // Load using the right type
   IRISApplication::MainImageType intype = IRISApplication::MAIN_VECTOR;
-  IRISApplication::MainImageType type = m_Driver->LoadOverlayImage(fname, intype);
+  IRISApplication::MainImageType type = 
+    m_Driver->LoadOverlayImage(fname, intype, m_ProgressCommand);
 
   // Update the system's history list
   m_SystemInterface->UpdateHistory("VectorOverlay",
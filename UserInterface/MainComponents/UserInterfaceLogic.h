@@ -61,6 +61,7 @@ class ResizeRegionDialogLogic;
 class AppearanceDialogUILogic;
 class ReorientImageUILogic;
 class Window3D;
+class SegmentationStatistics;
 
 template <class TFlag> class FLTKWidgetActivationManager;
 //template<class TPixel> class ImageIOWizardLogic;
@@ -535,6 +536,9 @@ public:
   /** Update the user interface after loading a new grey main image  */
   void OnGreyImageUpdate();
 
+  /** Display the coarse preview of a grey image that is still being loaded */
+  void OnMainImagePreview();
+
   /** Update the user interface after loading a new RGB main image  */
   void OnRGBImageUpdate();
 
@@ -870,6 +874,9 @@ private:
   // The callback command used in the (complicated) snake VCR pipeline
   itk::SmartPointer<SimpleCommandType> m_PostSnakeCommand;
 
+  // The callback command used to display previews of large images
+  itk::SmartPointer<SimpleCommandType> m_PreviewCommand;
+
   // The main window label
   std::string m_MainWindowLabel;
 
@@ -934,6 +941,10 @@ private:
   /** Write voxels dialog */
   SimpleFileDialogLogic *m_DlgVoxelCountsIO;
 
+  /** Statistics shown in the volumes window, kept between updates so that
+   * only the parts of the segmentation that changed are revisited */
+  SegmentationStatistics *m_Statistics;
+
   // An adapter used in association with the image IO wizard
   ImageInfoCallbackInterface *m_GreyCallbackInterface;
 
@@ -1021,7 +1032,7 @@ private:
   itk::SmartPointer<ProgressCommandType> m_ProgressCommand;
 
   // A function used to run the snake in the background
-  friend void fnSnakeIdleFunction(void *userData);
+  friend void fnSnakeDisplayFunction(void *userData);
   friend class UserInterfaceLogicMemberObserver;
 
   // Update the menu of recent files
@@ -253,6 +253,69 @@ void usage()
 
   cout << "   --zoom, -z FACTOR            : " <<
     "Specify initial zoom in screen pixels / physical mm" << endl;
+
+  cout << "   --export-slices <a|c|s> DIR  : " <<
+    "Save all axial, coronal or sagittal slices as PNG files in DIR and exit" 
+    << endl;
+  cout << "                                  " <<
+    "(one pixel per voxel, main image and segmentation only)" << endl;
+}
+
+// Loads the images given on the command line and saves a slice series
+// without showing the user interface
+int ExportSlicesHeadless(IRISApplication *iris, const char *fnMain,
+                         bool force_grey, bool force_rgb,
+                         CommandLineArgumentParseResult &parseResult)
+{
+  string slice = parseResult.GetOptionParameter("--export-slices", 0);
+  const char *dir = parseResult.GetOptionParameter("--export-slices", 1);
+  if(slice.length() == 0 || !(slice[0] == 'a' || slice[0] == 'c' || slice[0] == 's'))
+    {
+    cerr << "Error: wrong direction passed to '--export-slices'" << endl;
+    return -1;
+    }
+
+  if(!fnMain)
+    {
+    cerr << "Error: --export-slices can not be used without --main, --grey, or --rgb" << endl;
+    return -1;
+    }
+
+  try
+    {
+    // Load the main image and the display settings saved with it
+    IRISApplication::MainImageType type = force_grey 
+      ? IRISApplication::MAIN_SCALAR 
+      : (force_rgb ? IRISApplication::MAIN_RGB : IRISApplication::MAIN_ANY);
+    iris->LoadMainImage(fnMain, type);
+
+    Registry associated;
+    if(iris->GetSystemInterface()->FindRegistryAssociatedWithFile(fnMain, associated))
+      {
+      SNAPRegistryIO rio;
+      rio.ReadImageAssociatedSettings(associated, iris, true, true, true, true);
+      }
+
+    if(parseResult.IsOptionPresent("--segmentation"))
+      iris->LoadLabelImageFile(parseResult.GetOptionParameter("--segmentation"));
+
+    if(parseResult.IsOptionPresent("--labels"))
+      iris->GetColorLabelTable()->LoadFromFile(
+        parseResult.GetOptionParameter("--labels"));
+
+    // Save the slices
+    AnatomicalDirection dir_anat = slice[0] == 'a' ? ANATOMY_AXIAL 
+      : (slice[0] == 'c' ? ANATOMY_CORONAL : ANATOMY_SAGITTAL);
+    iris->ExportSliceSeries(dir_anat, dir);
+    }
+  catch(itk::ExceptionObject &exc)
+    {
+    cerr << "Error exporting slices" << endl;
+    cerr << "Reason: " << exc << endl;
+    return -1;
+    }
+
+  return 0;
 }
     
 
@@ -296,6 +359,8 @@ int main(int argc, char **argv)
   parser.AddOption("--compact", 1);
   parser.AddSynonim("--compact", "-c");
 
+  parser.AddOption("--export-slices", 2);
+
   parser.AddOption("--help", 0);
   parser.AddSynonim("--help", "-h");
 
@@ -328,20 +393,6 @@ int main(int argc, char **argv)
   if(!FindDataDirectoryInteractive(argv[0],system))
     return -1;
 
-  // Create a UI object
-  UserInterfaceLogic *ui = new UserInterfaceLogic(iris);
-
-  // Initialize FLTK
-  Fl::visual(FL_DOUBLE|FL_INDEX);
-  Fl::gl_visual(FL_RGB);  
-  Fl::background(236,233,216);
-
-  // Show the IRIS Interface
-  ui->Launch();
-
-  // Show the splash screen
-  ui->ShowSplashScreen();
-
   // The following situations are possible for main image
   // itksnap file                       <- load as main image, detect file type
   // itksnap --main file                <- load as main image, detect file type
@@ -406,6 +457,29 @@ int main(int argc, char **argv)
     return -1;
     }
 
+  // Save a slice series without starting the user interface
+  if(parseResult.IsOptionPresent("--export-slices"))
+    {
+    int rc = ExportSlicesHeadless(
+      iris, fnMain, force_grey, force_rgb, parseResult);
+    delete iris;
+    return rc;
+    }
+
+  // Create a UI object
+  UserInterfaceLogic *ui = new UserInterfaceLogic(iris);
+
+  // Initialize FLTK
+  Fl::visual(FL_DOUBLE|FL_INDEX);
+  Fl::gl_visual(FL_RGB);  
+  Fl::background(236,233,216);
+
+  // Show the IRIS Interface
+  ui->Launch();
+
+  // Show the splash screen
+  ui->ShowSplashScreen();
+
   // Load main image file
   if(fnMain)
     {
@@ -37,12 +37,16 @@
 #include <itkNeighborhoodIterator.h>
 
 #include "OpenGLSliceTexture.h"
+#include <algorithm>
+#include <cstring>
 
 OpenGLSliceTexture
 ::OpenGLSliceTexture()
 {
   // Set to -1 to force a call to 'generate'
   m_IsTextureInitalized = false;
+  m_IsTextureAllocated = false;
+  m_UploadedSize.Fill(0);
 
   // Set the update time to -1
   m_UpdateTime = 0;
@@ -53,9 +57,6 @@ OpenGLSliceTexture
   m_GlType = GL_UNSIGNED_BYTE;
   m_InterpolationMode = GL_NEAREST;
 
-  // Initialize the buffer pointer
-  m_Buffer = NULL;
-
   // default is no.
   m_IsVectorOverlay = false;
   m_vectorOverlayList = glGenLists(1);
@@ -68,6 +69,8 @@ OpenGLSliceTexture
 {
   // Set to -1 to force a call to 'generate'
   m_IsTextureInitalized = false;
+  m_IsTextureAllocated = false;
+  m_UploadedSize.Fill(0);
 
   // Set the update time to -1
   m_UpdateTime = 0;
@@ -77,8 +80,6 @@ OpenGLSliceTexture
   m_GlType = GL_UNSIGNED_BYTE;
   m_InterpolationMode = GL_NEAREST;
 
-  // Initialize the buffer pointer
-  m_Buffer = NULL;
   m_IsVectorOverlay = false;
   m_vectorOverlayList = glGenLists(1);
   m_overlayChanged = true;
@@ -88,8 +89,6 @@ OpenGLSliceTexture
 OpenGLSliceTexture
 ::~OpenGLSliceTexture()
 {
-  if(m_Buffer)
-    delete [] reinterpret_cast<unsigned char*>(m_Buffer);
   if(m_IsTextureInitalized)
     glDeleteTextures(1,&m_TextureIndex);
 }
@@ -123,18 +122,16 @@ OpenGLSliceTexture
   if (m_IsTextureInitalized && m_UpdateTime == m_Image->GetPipelineMTime())
     return;
 
-  if(m_Buffer) delete [] reinterpret_cast<unsigned char*>(m_Buffer);
-  m_Buffer = getBuffer(m_Slice);
   m_overlayChanged = true;
     
   // Promote the image dimensions to powers of 2
   itk::Size<2> szImage = m_Image->GetLargestPossibleRegion().GetSize();
-  m_TextureSize = Vector2ui(1);
+  Vector2ui szTexture(1);
 
   // Use shift to quickly double the coordinates
   for (unsigned int i=0;i<2;i++)
-    while (m_TextureSize(i) < szImage[i])
-      m_TextureSize(i) <<= 1;
+    while (szTexture(i) < szImage[i])
+      szTexture(i) <<= 1;
 
   // Create the texture index if necessary
   if(!m_IsTextureInitalized)
@@ -142,6 +139,7 @@ OpenGLSliceTexture
     // Generate one texture
     glGenTextures(1,&m_TextureIndex);
     m_IsTextureInitalized = true;
+    m_IsTextureAllocated = false;
     }
 
   // Select the texture for pixel pumping
@@ -156,10 +154,16 @@ OpenGLSliceTexture
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
   glPixelStorei(GL_PACK_ALIGNMENT, 1);
 
-  // Allocate texture of slightly bigger size
-  glTexImage2D(GL_TEXTURE_2D, 0, m_GlComponents,
-    m_TextureSize(0), m_TextureSize(1),
-    0, m_GlFormat, m_GlType, NULL);
+  // Allocate texture of slightly bigger size, but only if the size changed
+  if(!m_IsTextureAllocated || szTexture != m_TextureSize)
+    {
+    m_TextureSize = szTexture;
+    glTexImage2D(GL_TEXTURE_2D, 0, m_GlComponents,
+      m_TextureSize(0), m_TextureSize(1),
+      0, m_GlFormat, m_GlType, NULL);
+    m_IsTextureAllocated = true;
+    m_UploadedSize.Fill(0);
+    }
 
   // Mip Map settings...
   // TODO: use something like bicubic interpolation instead of linear...
@@ -169,8 +173,59 @@ OpenGLSliceTexture
   //Generate the texture with mipmaps
   //gluBuild2DMipmaps( GL_TEXTURE_2D, m_GlFormat, szImage[0], szImage[1], m_GlFormat, m_GlType, m_Buffer ); 
 
-  // Copy a subtexture of correct size into the image
-  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, szImage[0], szImage[1], m_GlFormat, m_GlType, m_Buffer);
+  // Copy the part of the image that changed since the last upload into the
+  // texture. The last uploaded slice is kept so that we can tell
+  const DisplayPixelType *pixels = m_Image->GetBufferPointer();
+  size_t w = szImage[0], h = szImage[1];
+  size_t x0 = 0, x1 = w, y0 = 0, y1 = h;
+  if(szImage == m_UploadedSize)
+    {
+    const DisplayPixelType *last = &m_Uploaded[0];
+    size_t rowBytes = w * sizeof(DisplayPixelType);
+
+    // Find the first and last rows that changed
+    while(y0 < h && !memcmp(last + y0 * w, pixels + y0 * w, rowBytes))
+      y0++;
+    while(y1 > y0 && !memcmp(last + (y1-1) * w, pixels + (y1-1) * w, rowBytes))
+      y1--;
+
+    // Find the first and last columns that changed in these rows
+    x0 = w; x1 = 0;
+    for(size_t y = y0; y < y1; y++)
+      {
+      const DisplayPixelType *a = last + y * w, *b = pixels + y * w;
+      size_t l = 0, r = w;
+      while(l < x0 && a[l] == b[l])
+        l++;
+      while(r > std::max(x1, l) && a[r-1] == b[r-1])
+        r--;
+      x0 = std::min(x0, l);
+      x1 = std::max(x1, r);
+      }
+    }
+  else
+    {
+    m_Uploaded.resize(w * h);
+    m_UploadedSize = szImage;
+    }
+
+  if(x0 < x1 && y0 < y1)
+    {
+    // Copy a subtexture of correct size into the image
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, x0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, y0);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, x1 - x0, y1 - y0, 
+      m_GlFormat, m_GlType, pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+
+    // Remember what the texture holds
+    for(size_t y = y0; y < y1; y++)
+      std::copy(pixels + y * w + x0, pixels + y * w + x1, 
+        m_Uploaded.begin() + y * w + x0);
+    }
 
   // Remember the image's timestamp
   m_UpdateTime = m_Image->GetPipelineMTime();
@@ -252,11 +307,19 @@ void DrawRect( float cx, float cy, float w, float h, int r, int g, int b, int a
     glEnable(GL_TEXTURE_2D); 
 }  
 
+// The vector overlay display slice stores normalized vector components
+// mapped from [-1,1] to [0,255] (see ImageOfVectorsWrapper)
+inline float DecodeVectorComponent(unsigned char c)
+{
+  return c / 127.5f - 1.0f;
+}
+
 template<class T>
 float diff(const T &p1, const T &p2)
 {
-  return sqrt((p1[0]-p2[0])*(p1[0]-p2[0])+
-              (p1[1]-p2[1])*(p1[1]-p2[1]));
+  float dx = DecodeVectorComponent(p1[0]) - DecodeVectorComponent(p2[0]);
+  float dy = DecodeVectorComponent(p1[1]) - DecodeVectorComponent(p2[1]);
+  return sqrt(dx * dx + dy * dy);
 }
 
 template<class T>
@@ -276,7 +339,7 @@ OpenGLSliceTexture
 ::DrawVectors(size_t x_index, size_t y_index, int x_facing, int y_facing)
 {
   Update();
-  if( m_Slice )
+  if( m_Image )
   {
     if(m_overlayChanged) // recreate display list..
     {
@@ -292,7 +355,7 @@ OpenGLSliceTexture
       typedef itk::NeighborhoodIterator<SliceType> ItType;
       typename SliceType::SizeType radius;
       radius.Fill(1);
-      ItType it(radius, m_Slice, m_Slice->GetLargestPossibleRegion());
+      ItType it(radius, m_Image, m_Image->GetLargestPossibleRegion());
       for(; !it.IsAtEnd(); ++it)
       {
         // if the vector is sufficiently different from its neighborhood, draw it.
@@ -304,10 +367,12 @@ OpenGLSliceTexture
           float scale = 0.7; // scales the vector to leave a border at the edges of pixel "box".
           float cx = (.5+index[0]);
           float cy = (.5+index[1]);
-          float ax = cx - x_facing*pixel[x_index]*.5*scale; // pixel is normalized vec component.
-          float ay = cy - y_facing*pixel[y_index]*.5*scale; // pixel is normalized vec component.
-          float bx = cx + x_facing*pixel[x_index]*.5*scale; // pixel is normalized vec component.
-          float by = cy + y_facing*pixel[y_index]*.5*scale; // pixel is normalized vec component.
+          float vx = DecodeVectorComponent(pixel[x_index]); // normalized vec component.
+          float vy = DecodeVectorComponent(pixel[y_index]); // normalized vec component.
+          float ax = cx - x_facing*vx*.5*scale;
+          float ay = cy - y_facing*vy*.5*scale;
+          float bx = cx + x_facing*vx*.5*scale;
+          float by = cy + y_facing*vy*.5*scale;
           DrawLine( ax,ay, bx,by, line_width, r,g,b,a );
           //DrawRect( ax,ay, 0.2,0.2, r,g,b,a );
         }
@@ -45,6 +45,8 @@
 #endif
 
 #include "itkOrientedImage.h"
+#include "itkRGBAPixel.h"
+#include <vector>
 
 /**
  * \class OpenGLSliceTexture
@@ -60,9 +62,11 @@ public:
   typedef itk::ImageBase<2> ImageBaseType;
   typedef itk::SmartPointer<ImageBaseType> ImageBasePointer;
 
-  // see SpeedImageWrapper.h: SpeedImageWrapper::OverlaySliceType
-  typedef itk::RGBAPixel<float> OverlayPixelType;
-  typedef itk::Image<OverlayPixelType,2> SliceType;
+  // All display slices (see ImageWrapperBase::DisplaySliceType) are RGBA 
+  // images with 8 bits per component, which are uploaded to GL as is
+  typedef itk::RGBAPixel<unsigned char> DisplayPixelType;
+  typedef itk::Image<DisplayPixelType,2> SliceType;
+  typedef itk::SmartPointer<SliceType> SlicePointer;
 
   /** Constructor, initializes the texture object */
   OpenGLSliceTexture();
@@ -71,52 +75,15 @@ public:
   /** Destructor, deallocates texture memory */
   virtual ~OpenGLSliceTexture();
   
-  template<class TPixel> 
-  unsigned char * getBuffer(itk::Image<TPixel,2> *inImage)
+  /** Pass in a pointer to a 2D image */
+  void SetImage(SliceType *inImage)
   {
-    // TODO: figure out a better way to do this..
-    // need to interpret data as floats for vector orientation image,
-    // but need unsigned char data for the opengl texture of the image.
-    // this is very innefficient...
-    typedef itk::Image<TPixel,2> ImageType;
-    typename ImageType::RegionType region = inImage->GetLargestPossibleRegion();
-    //typename ImageType::RegionType region = inImage->GetBufferedRegion();
-    typename ImageType::SizeType size = region.GetSize();
-    typename ImageType::IndexType regionIndex = region.GetIndex();
-    unsigned char * buffer = new unsigned char [ size[0] * size[1] * m_GlComponents ];
-    for(size_t i=0; i<size[0]; ++i)
-    {
-      for(size_t j=0; j<size[1]; ++j)
+    if(inImage != m_Image.GetPointer())
       {
-        typename ImageType::IndexType index;
-        index[0] = regionIndex[0] + i;
-        index[1] = regionIndex[1] + j;
-        typename ImageType::PixelType pixel = inImage->GetPixel(index);
-        size_t b = m_GlComponents*size[0]*j+i*m_GlComponents;
-        for(size_t k=0; k<m_GlComponents; ++k)
-        {
-          buffer[b+k] = static_cast<unsigned char>(pixel[k]);
-        }
+      m_Image = inImage;
+      m_UpdateTime = 0;
+      m_overlayChanged = true;
       }
-    }
-    return buffer;
-  }
-
-  /** Pass in a pointer to a 2D image */
-  template<class TPixel> void SetImage(itk::Image<TPixel,2> *inImage)
-  {
-    m_Image = inImage;
-    m_Image->GetSource()->UpdateLargestPossibleRegion();
-    if(m_Buffer) delete [] reinterpret_cast<unsigned char*>(m_Buffer);
-    m_Buffer = getBuffer(inImage);
-    //m_Buffer = inImage->GetBufferPointer();
-    m_Slice = dynamic_cast<SliceType*>(inImage);
-    if(!m_Slice)
-    {
-      std::cerr << "Error: could not convert image pointer." << std::endl;
-    }
-    m_UpdateTime = 0;
-    m_overlayChanged = true;
   }
 
   /** Get the dimensions of the texture image, which are powers of 2 */
@@ -188,12 +155,7 @@ private:
   Vector2ui m_TextureSize;
 
   // The pointer to the image from which the texture is computed
-  ImageBasePointer m_Image;
-
-  // Pointer to the image's data buffer (this should have been provided by ImageBase)
-  void *m_Buffer;
-
-  SliceType * m_Slice;
+  SlicePointer m_Image;
 
   // The texture number (index)
   GLuint m_TextureIndex;
@@ -201,6 +163,14 @@ private:
   // Has the texture been initialized?
   bool m_IsTextureInitalized;
 
+  // Has storage of size m_TextureSize been allocated for the texture?
+  bool m_IsTextureAllocated;
+
+  // A copy of the image as last uploaded into the texture, used to find the
+  // part of the texture that needs to be replaced on update
+  std::vector<DisplayPixelType> m_Uploaded;
+  itk::Size<2> m_UploadedSize;
+
   // The pipeline time of the source image (vs. our pipeline time)
   unsigned long m_UpdateTime;
 
@@ -535,6 +535,7 @@ PaintbrushInteractionMode
   if(flagUpdate)
     {
     imgLabel->GetImage()->Modified();
+    imgLabel->AddDirtyRegion(xTestRegion);
     m_ParentUI->OnPaintbrushPaint();
     m_ParentUI->RedrawWindows();
     }